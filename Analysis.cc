@@ -7,6 +7,7 @@
 #include <getopt.h>
 #include <chrono>
 #include <float.h>
+#include <algorithm>
 
 //some ROOT includes
 #include "TInterpreter.h"
@@ -49,6 +50,9 @@
 #include "Mode.hh"
 #include "Purity.hh"
 #include "EventInfo.hh"
+#include "ThreadPool.hh"
+#include "WaveformView.hh"
+#include "WaveformSums.hh"
 
 using namespace daqAnalysis;
 
@@ -57,19 +61,49 @@ Analysis::Analysis(fhicl::ParameterSet const & p) :
   //art::ServiceHandle<daqAnalysis::VSTChannelMap>()->GetProvider()), // get a handle to the VST Channel Map service
   _config(p),
   _channel_index_map(_channel_map->NChannels()),
+  _channel_data_store(_channel_map->NChannels()),
   _per_channel_data(_channel_map->NChannels()),
   _per_channel_data_reduced((_config.reduce_data) ? _channel_map->NChannels() : 0), // setup reduced event vector if we need it
   _noise_samples(_channel_map->NChannels()),
+  _noise_masks(_config.noise_masks ? _channel_map->NChannels() : 0),
+  _channel_summaries(_config.use_summary ? _channel_map->NChannels() : 0, NULL),
   _header_data(std::max(_config.n_headers,0)),
   _event_info(),
   _nevis_tpc_metadata(std::max(_config.n_metadata,0)),
   _thresholds( (_config.threshold_calc == 3) ? _channel_map->NChannels() : 0),
   _fem_summed_waveforms((_config.sum_waveforms) ? _channel_map->NFEM() : 0),
   _fem_summed_fft((_config.sum_waveforms && _config.fft_summed_waveforms) ? _channel_map->NFEM() : 0),
-  _fft_manager(  (_config.static_input_size > 0) ? _config.static_input_size: 0),
+  _fft_manager(),
+  _thread_pool(_config.n_threads),
   _analyzed(false)
 
 {
+  auto start = std::chrono::high_resolution_clock::now();
+  FFTPlanCache &fft_plans = FFTPlanCache::Instance();
+  // load the wisdom before anything gets planned
+  if (_config.fftw_wisdom_file.size() != 0) {
+    if (!fft_plans.ImportWisdom(_config.fftw_wisdom_file)) {
+      mf::LogInfo("Analysis") << "No FFTW wisdom read from " << _config.fftw_wisdom_file << ". It will be written there." << std::endl;
+    }
+  }
+  if (_config.static_input_size > 0) {
+    _fft_manager.Set(_config.static_input_size);
+  }
+  // one set of per-channel state for each thread
+  for (unsigned i = 0; i < _thread_pool.NThreads(); i++) {
+    _workers.emplace_back(new ChannelWorker((_config.static_input_size > 0) ? _config.static_input_size: 0,
+      _config.fft_per_channel ? _config.fft_batch_size : 0, _config.fft_float));
+  }
+  _n_fft_plans = fft_plans.NPlans();
+  _fft_planning_time = fft_plans.PlanningTime();
+  if (_n_fft_plans != 0 && _config.fftw_wisdom_file.size() != 0 && !fft_plans.ExportWisdom()) {
+    mf::LogWarning("Analysis") << "Could not write FFTW wisdom to " << _config.fftw_wisdom_file << std::endl;
+  }
+  if (_config.timing) {
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "FFT STARTUP  : " << std::chrono::duration<float, std::milli>(end - start).count() 
+              << " (" << _n_fft_plans << " plans in " << _fft_planning_time << ")" << std::endl;
+  }
   _event_ind = 0;
   _sub_run_start_time = -99999;
   _sub_run_holder = -99999;
@@ -116,6 +150,10 @@ Analysis::AnalysisConfig::AnalysisConfig(const fhicl::ParameterSet &param) {
 
   // sets percentage of mode samples to be 100 / n_mode_skip
   n_mode_skip = param.get<unsigned>("n_mode_skip", 1);
+
+  // whether to find the exact mode with a histogram instead of the
+  // approximate one
+  exact_mode = param.get<bool>("exact_mode", false);
  
   // only used if noise_range_sampling == 0
   // number of samples in noise sample
@@ -138,7 +176,23 @@ Analysis::AnalysisConfig::AnalysisConfig(const fhicl::ParameterSet &param) {
   sum_waveforms = param.get<bool>("sum_waveforms", false);
   fft_summed_waveforms = param.get<bool>("fft_summed_waveforms", false);
   fft_per_channel = param.get<bool>("fft_per_channel", false);
+  // number of channels of the same size to take the FFT of at once
+  fft_batch_size = std::max(param.get<unsigned>("fft_batch_size", 64), 1u);
+  // whether to take the per-channel FFT's in single precision
+  fft_float = param.get<bool>("fft_float", false);
+  // file to load FFTW wisdom from at startup and save it to whenever new
+  // FFT's get planned (empty == don't)
+  fftw_wisdom_file = param.get<std::string>("fftw_wisdom_file", "");
   fill_waveforms = param.get<bool>("fill_waveforms", false);
+  // whether to get per-channel statistics in as few passes over the ADC's as possible
+  fused_kernel = param.get<bool>("fused_kernel", false);
+  // whether to get noise range statistics from prefix sums over the ADC's
+  prefix_sums = param.get<bool>("prefix_sums", false);
+  // whether to calculate noise between channels with bitmasks of the noise ranges
+  noise_masks = param.get<bool>("noise_masks", false);
+  // whether to use the per-channel statistics from the decoder (if there are any)
+  // instead of recalculating them
+  use_summary = param.get<bool>("use_summary", false);
   reduce_data = param.get<bool>("reduce_data", false);
   timing = param.get<bool>("timing", false);
 
@@ -178,6 +232,16 @@ Analysis::AnalysisConfig::AnalysisConfig(const fhicl::ParameterSet &param) {
   LifetimePlots    = param.get<bool>("LifetimePlots", false);
   fforceanglecut   = param.get<bool>("fforcedanglecut", false);
 
+  // number of threads to split up per-channel processing
+  // 1 == process all channels serially
+  n_threads = std::max(param.get<unsigned>("n_threads", 1), 1u);
+  // number of channels handed to a thread at a time
+  n_channels_per_task = std::max(param.get<unsigned>("n_channels_per_task", 16), 1u);
+  // the gauss fitter threshold uses ROOT fitting, which isn't thread safe
+  if (threshold_calc == 1 && n_threads > 1) {
+    mf::LogWarning("Analysis") << "threshold_calc == 1 is not thread safe. Processing channels serially." << std::endl;
+    n_threads = 1;
+  }
 
 }
 
@@ -298,11 +362,18 @@ void Analysis::AnalyzeEvent(art::Event const & event) {
   }
 
   // clear out containers from last iter
+  // noise samples point into the worker arenas, so drop them before re-using the arenas
+  for (unsigned i = 0; i < _channel_map->NChannels(); i++) {
+    _noise_samples[i] = NoiseSample();
+  }
+  for (auto &worker: _workers) {
+    worker->arena.Reset();
+  }
   for (unsigned i = 0; i < _channel_map->NChannels(); i++) {
-    _per_channel_data[i].waveform.clear();
-    _per_channel_data[i].fft_real.clear();
-    _per_channel_data[i].fft_imag.clear();
-    _per_channel_data[i].peaks.clear();
+    _channel_data_store.waveform[i].clear();
+    _channel_data_store.fft.Clear(i);
+    _channel_data_store.float_fft.Clear(i);
+    _channel_data_store.peaks[i].clear();
   }
   // also for summed waveforms
   if (_config.sum_waveforms) {
@@ -327,28 +398,62 @@ void Analysis::AnalyzeEvent(art::Event const & event) {
     std::cerr << "ERROR: No Raw Hits Present\n" << std::endl;
   }
 
-  unsigned index = 0;
+  unsigned n_digits = raw_digits_handle->size();
+  for (unsigned index = 0; index < n_digits; index++) {
+    _channel_index_map[(*raw_digits_handle)[index].Channel()] = index;
+  }
+
+  // per-channel statistics already calculated by the decoder
+  std::fill(_channel_summaries.begin(), _channel_summaries.end(), (const ChannelSummary *)NULL);
+  if (_config.use_summary) {
+    art::Handle<std::vector<daqAnalysis::ChannelSummary>> summary_handle;
+    if (event.getByLabel(_config.daq_tag, summary_handle)) {
+      for (auto const &summary: *summary_handle) {
+        if (summary.channel_no < _channel_summaries.size()) {
+          _channel_summaries[summary.channel_no] = &summary;
+        }
+      }
+    }
+  }
+
   // calculate per channel stuff 
+  // Channels are split into tasks of n_channels_per_task which are handed out to
+  // the thread pool. Each channel only writes to its own entries in the output
+  // containers, so the result does not depend on the number of threads.
+  unsigned n_per_task = _config.n_channels_per_task;
+  unsigned n_tasks = (n_digits + n_per_task - 1) / n_per_task;
   if (_config.fUseRawHits || _config.fProcessRawHits) {
     // === Associations between hits and raw digits === 
     art::FindManyP<recob::Hit>   fmhr(raw_digits_handle, event,_config.fHitsModuleLabel);
 
     // loop over all tracks in the handle and get their hits
-    for(size_t digit_int = 0; digit_int < raw_digits_handle->size(); ++digit_int){
-      //Get the raw digit object.    
-      auto const& digits=rawdigits[digit_int];  
-      //Get the hits associated to the raw digit. 
-      const std::vector<art::Ptr<recob::Hit> >& hits = fmhr.at(digit_int);
-      _channel_index_map[digits->Channel()] = index;
-      ProcessChannel(*digits, hits);
-      index++;
-    }
+    _thread_pool.Run(n_tasks, [&](unsigned task, unsigned thread) {
+      unsigned end = std::min(n_digits, (task + 1) * n_per_task);
+      for (unsigned digit_int = task * n_per_task; digit_int < end; digit_int++) {
+        //Get the hits associated to the raw digit. 
+        const std::vector<art::Ptr<recob::Hit> >& hits = fmhr.at(digit_int);
+        ProcessChannel((*raw_digits_handle)[digit_int], hits, *_workers[thread]);
+      }
+    });
   }
   else {
-    for (auto const& digits: *raw_digits_handle) {
-      _channel_index_map[digits.Channel()] = index;
-      ProcessChannel(digits);
-      index++;
+    _thread_pool.Run(n_tasks, [&](unsigned task, unsigned thread) {
+      unsigned end = std::min(n_digits, (task + 1) * n_per_task);
+      for (unsigned digit_int = task * n_per_task; digit_int < end; digit_int++) {
+        ProcessChannel((*raw_digits_handle)[digit_int], *_workers[thread]);
+      }
+    });
+  }
+
+  if (_config.fft_per_channel) {
+    ChannelFFTs(*raw_digits_handle);
+  }
+
+  // collect timing info from the workers
+  if (_config.timing) {
+    for (auto &worker: _workers) {
+      _timing.Add(worker->timing);
+      worker->timing = Timing();
     }
   }
 
@@ -357,8 +462,8 @@ void Analysis::AnalyzeEvent(art::Event const & event) {
   }
   // make the reduced channel data stuff if need be
   if (_config.reduce_data) {
-    for (size_t i = 0; i < _per_channel_data.size(); i++) {
-      _per_channel_data_reduced[i] = daqAnalysis::ReducedChannelData(_per_channel_data[i]);
+    for (size_t i = 0; i < _channel_data_store.Size(); i++) {
+      _per_channel_data_reduced[i] = _channel_data_store.GetReduced(i);
     }
   }
   if (_config.timing) {
@@ -375,28 +480,31 @@ void Analysis::AnalyzeEvent(art::Event const & event) {
   for (unsigned i = 0; i < _channel_map->NChannels() - 1; i++) {
     unsigned next_channel = i + 1; 
 
-    if (!_per_channel_data[i].empty && !_per_channel_data[next_channel].empty) {
+    if (!_channel_data_store.empty[i] && !_channel_data_store.empty[next_channel]) {
       unsigned raw_digits_i = _channel_index_map[i];
       unsigned raw_digits_next_channel = _channel_index_map[next_channel];
-      float unscaled_dnoise = _noise_samples[i].DNoise(
+      float unscaled_dnoise = (_config.noise_masks) ?
+        NoiseMask::DNoise(_noise_masks[i], (*raw_digits_handle)[raw_digits_i].ADCs(), _noise_samples[i].Baseline(),
+          _noise_masks[next_channel], (*raw_digits_handle)[raw_digits_next_channel].ADCs(), _noise_samples[next_channel].Baseline()) :
+        _noise_samples[i].DNoise(
           (*raw_digits_handle)[raw_digits_i].ADCs(), _noise_samples[next_channel], (*raw_digits_handle)[raw_digits_next_channel].ADCs());
       // Don't use same noise sample to scale dnoise
       // This should probably be ok, as long as the dnoise sample is large enough
 
       // but special case when rms is too small
-      if (_per_channel_data[i].rms > 1e-4 && _per_channel_data[next_channel].rms > 1e-4) {
-        float dnoise_scale = sqrt(_per_channel_data[i].rms * _per_channel_data[i].rms + 
-                                  _per_channel_data[next_channel].rms * _per_channel_data[next_channel].rms);
+      if (_channel_data_store.rms[i] > 1e-4 && _channel_data_store.rms[next_channel] > 1e-4) {
+        float dnoise_scale = sqrt(_channel_data_store.rms[i] * _channel_data_store.rms[i] + 
+                                  _channel_data_store.rms[next_channel] * _channel_data_store.rms[next_channel]);
     
-        _per_channel_data[i].next_channel_dnoise = unscaled_dnoise / dnoise_scale; 
+        _channel_data_store.next_channel_dnoise[i] = unscaled_dnoise / dnoise_scale; 
       }
       else {
-        _per_channel_data[i].next_channel_dnoise = 1.;
+        _channel_data_store.next_channel_dnoise[i] = 1.;
       }
     }
   }
   // don't set last dnoise
-  _per_channel_data[_channel_map->NChannels() - 1].next_channel_dnoise = 0;
+  _channel_data_store.next_channel_dnoise[_channel_map->NChannels() - 1] = 0;
 
   if (_config.timing) {
     _timing.EndTime(&_timing.coherent_noise_calc);
@@ -425,12 +533,40 @@ void Analysis::AnalyzeEvent(art::Event const & event) {
   // print stuff out
   if (_config.verbose) {
     std::cout << "EVENT NUMBER: " << _event_ind << std::endl;
-    for (auto &channel_data: _per_channel_data) {
-      std::cout << channel_data.Print();
+    for (unsigned i = 0; i < _channel_data_store.Size(); i++) {
+      std::cout << _channel_data_store.Print(i);
     }
   }
+  // keep the wisdom file up to date with any FFT's planned since the last
+  // event (here or in anything else in the process)
+  FFTPlanCache &fft_plans = FFTPlanCache::Instance();
+  unsigned n_fft_plans = fft_plans.NPlans();
+  float fft_planning_time = fft_plans.PlanningTime();
+  if (n_fft_plans != _n_fft_plans && _config.fftw_wisdom_file.size() != 0 && !fft_plans.ExportWisdom()) {
+    mf::LogWarning("Analysis") << "Could not write FFTW wisdom to " << _config.fftw_wisdom_file << std::endl;
+  }
   if (_config.timing) {
     _timing.Print();
+    std::cout << "FFT PLANNING : " << fft_planning_time - _fft_planning_time << " (" << n_fft_plans - _n_fft_plans << " new plans)" << std::endl;
+    unsigned n_arena_allocations = 0;
+    size_t arena_capacity = 0;
+    for (auto &worker: _workers) {
+      n_arena_allocations += worker->arena.NHeapAllocations();
+      arena_capacity += worker->arena.Capacity();
+    }
+    std::cout << "ARENA ALLOCS : " << n_arena_allocations << " (" << arena_capacity / 1024 << " kB)" << std::endl;
+  }
+  _n_fft_plans = n_fft_plans;
+  _fft_planning_time = fft_planning_time;
+}
+
+void Analysis::SnapshotWaveforms(art::Event const & event) {
+  if (_config.fill_waveforms) return;
+  // only the ADC's of mapped channels are copied
+  auto const& raw_digits_handle = event.getValidHandle<std::vector<raw::RawDigit>>(_config.daq_tag);
+  for (auto const &digits: *raw_digits_handle) {
+    if (digits.Channel() >= _channel_map->NChannels()) continue;
+    _channel_data_store.waveform[digits.Channel()] = digits.ADCs();
   }
 }
 
@@ -442,13 +578,12 @@ void Analysis::SumWaveforms(art::Event const & event) {
     std::vector<std::vector<const std::vector<int16_t> *>> channel_waveforms_per_fem(n_fem);
     std::vector<std::vector<int16_t>> all_baselines(n_fem);
     // collect the waveforms
+    const daqAnalysis::ChannelLookup &lookup = _channel_map->Lookup();
     for (unsigned i = 0; i < _channel_map->NChannels(); i++) {
       unsigned raw_digits_i = _channel_index_map[i];
-      unsigned channel_ind = _channel_map->Wire2Channel(i);
-      daqAnalysis::ReadoutChannel info = _channel_map->Ind2ReadoutChannel(channel_ind); 
-      unsigned fem_ind = _channel_map->SlotIndex(info);
+      unsigned fem_ind = lookup.Wire2FEM(i);
       channel_waveforms_per_fem[fem_ind].push_back(&(*raw_digits_handle)[raw_digits_i].ADCs());
-      all_baselines[fem_ind].push_back(_per_channel_data[i].baseline);
+      all_baselines[fem_ind].push_back(_channel_data_store.baseline[i]);
     }
     // sum all of them
     for (unsigned i = 0; i < n_fem; i++) {
@@ -489,114 +624,153 @@ void Analysis::ProcessMetaData(const daqAnalysis::NevisTPCMetaData &metadata) {
 }
 
 void Analysis::ProcessChannel(const raw::RawDigit &digits, const std::vector<art::Ptr<recob::Hit> > &hits){
+  ProcessChannel(digits, hits, *_workers[0]);
+}
+
+void Analysis::ProcessChannel(const raw::RawDigit &digits) {
+  ProcessChannel(digits, *_workers[0]);
+}
+
+void Analysis::ProcessChannel(const raw::RawDigit &digits, const std::vector<art::Ptr<recob::Hit> > &hits, ChannelWorker &worker){
 
   auto channel = digits.Channel();
 
   // uses the RawHitFinder Module to find the peak and then processes the channel as before.
   if (_config.fUseRawHits) {
-    PeakFinder peaks(hits);
-    _per_channel_data[channel].peaks.assign(peaks.Peaks()->begin(), peaks.Peaks()->end());
+    // peak finder storage is only needed until the peaks are copied out
+    Arena::Marker arena_mark = worker.arena.Mark();
+    {
+      PeakFinder peaks(hits, &worker.arena);
+      _channel_data_store.peaks[channel].assign(peaks.Peaks()->begin(), peaks.Peaks()->end());
+    }
+    worker.arena.Rewind(arena_mark);
   }
 
   // fill up channel data even if we're using PeakFinder
-  _per_channel_data[channel].Hitoccupancy = hits.size();
-  _per_channel_data[channel].Hitmean_peak_height = _per_channel_data[channel].meanPeakHeight(hits);
+  _channel_data_store.Hitoccupancy[channel] = hits.size();
+  _channel_data_store.Hitmean_peak_height[channel] = ChannelData::meanPeakHeight(hits);
 
 
-  ProcessChannel(digits);
+  ProcessChannel(digits, worker);
 }
 
 
-void Analysis::ProcessChannel(const raw::RawDigit &digits) {
+void Analysis::ProcessChannel(const raw::RawDigit &digits, ChannelWorker &worker) {
+  // per-thread state
+  Timing &timing = worker.timing;
+
   auto channel = digits.Channel();
   if (channel >= _channel_map->NChannels()) return;
   // handle empty events
   if (digits.NADC() == 0) {
-    // default constructor handles empty event
-    _per_channel_data[channel] = ChannelData(channel);
+    // reset handles empty event
+    _channel_data_store.Reset(channel);
     _noise_samples[channel] = NoiseSample();
     return;
   }
    
   // if there are ADC's, the channel isn't empty
-  _per_channel_data[channel].empty = false;
+  _channel_data_store.empty[channel] = false;
  
-  // re-allocate FFT if necessary
-  if (_fft_manager.InputSize() != digits.NADC()) {
-    _fft_manager.Set(digits.NADC());
-  }
-   
-  _per_channel_data[channel].channel_no = channel;
+  _channel_data_store.channel_no[channel] = channel;
 
   int16_t max = -INT16_MAX;
   int16_t min = INT16_MAX;
-  auto adc_vec = digits.ADCs();
+  // read the ADC's in place -- no copy
+  WaveformView adcs(digits.ADCs());
   if (_config.timing) {
-    _timing.StartTime();
+    timing.StartTime();
   }
   auto n_adc = digits.NADC();
-  if (_config.fill_waveforms || _config.fft_per_channel) {
+  // sums over the waveform and mode finding for the fused kernel
+  WaveformSums sums;
+  ModeFinder mode_finder(_config.n_mode_skip);
+  ExactModeFinder &exact_mode_finder = worker.exact_mode_finder;
+  exact_mode_finder.Reset(_config.n_mode_skip);
+  // if the decoder already has the sums, min/max and mode, don't recalculate them
+  const ChannelSummary *summary = (_channel_summaries.empty()) ? NULL : _channel_summaries[channel];
+  if (summary != NULL && summary->n_samples != n_adc) summary = NULL;
+  if (summary != NULL) {
+    sums = summary->Sums();
+    // min/max are only set when filling waveforms (same as below), so that
+    // they don't depend on whether there is a summary
+    if (_config.fill_waveforms) {
+      max = summary->max;
+      min = summary->min;
+    }
+  }
+  bool have_sums = _config.fused_kernel || summary != NULL;
+  if (_config.fused_kernel && summary == NULL) {
+    // Get everything that needs a full pass over the ADC's here. The raw RMS,
+    // noise RMS and refined baseline are calculated from the sums later on.
+    // Peak finding is the only other pass.
+    bool find_mode = _config.baseline_calc == 2;
+    if (_config.fill_waveforms) {
+      _channel_data_store.waveform[channel].reserve(n_adc);
+    }
     for (unsigned i = 0; i < n_adc; i ++) {
-      int16_t adc = adc_vec[i];
+      int16_t adc = adcs[i];
+      sums.Add(adc);
+      if (find_mode) {
+        if (_config.exact_mode) exact_mode_finder.Add(adc);
+        else mode_finder.Add(adc);
+      }
+      if (_config.fill_waveforms) {
+        _channel_data_store.waveform[channel].push_back(adc);
+      }
+    }
+    // min/max are only set when filling waveforms (same as below)
+    if (_config.fill_waveforms) {
+      max = sums.max;
+      min = sums.min;
+    }
+  }
+  else if (_config.fill_waveforms) {
+    for (unsigned i = 0; i < n_adc; i ++) {
+      int16_t adc = adcs[i];
     
       // fill up waveform
-       if (_config.fill_waveforms) {
-        if (adc > max) max = adc;
-        if (adc < min) min = adc;
-
-        _per_channel_data[channel].waveform.push_back(adc);
-      }
+      if (adc > max) max = adc;
+      if (adc < min) min = adc;
 
-      if (_config.fft_per_channel) {
-        // fill up fftw array
-        double *input = _fft_manager.InputAt(i);
-        *input = (double) adc;
-      }
+      _channel_data_store.waveform[channel].push_back(adc);
     }
   }
 
   if (_config.timing) {
-    _timing.EndTime(&_timing.fill_waveform);
+    timing.EndTime(&timing.fill_waveform);
   }
   if (_config.timing) {
-    _timing.StartTime();
+    timing.StartTime();
   }
   if (_config.baseline_calc == 0) {
-    _per_channel_data[channel].baseline = 0;
+    _channel_data_store.baseline[channel] = 0;
   }
   else if (_config.baseline_calc == 1) {
-    _per_channel_data[channel].baseline = digits.GetPedestal();
+    _channel_data_store.baseline[channel] = digits.GetPedestal();
   }
   else if (_config.baseline_calc == 2) {
-    _per_channel_data[channel].baseline = Mode(digits.ADCs(), _config.n_mode_skip);
+    if (summary != NULL) {
+      _channel_data_store.baseline[channel] = summary->pedestal;
+    }
+    else if (_config.exact_mode) {
+      _channel_data_store.baseline[channel] = (_config.fused_kernel) ? exact_mode_finder.Mode() : ExactMode(adcs, _config.n_mode_skip);
+    }
+    else {
+      _channel_data_store.baseline[channel] = (_config.fused_kernel) ? mode_finder.Mode() : Mode(adcs, _config.n_mode_skip);
+    }
   }
   if (_config.timing) {
-    _timing.EndTime(&_timing.baseline_calc);
+    timing.EndTime(&timing.baseline_calc);
   }
 
-  _per_channel_data[channel].max = max;
-  _per_channel_data[channel].min = min;
+  _channel_data_store.max[channel] = max;
+  _channel_data_store.min[channel] = min;
   
-  if (_config.timing) {
-    _timing.StartTime();
-  }
-  // calculate FFTs
-  if (_config.fft_per_channel) {
-    _fft_manager.Execute();
-    int adc_fft_size = _fft_manager.OutputSize();
-    for (int i = 0; i < adc_fft_size; i++) {
-      _per_channel_data[channel].fft_real.push_back(_fft_manager.ReOutputAt(i));
-      _per_channel_data[channel].fft_imag.push_back(_fft_manager.ImOutputAt(i));
-    } 
-  }
-  if (_config.timing) {
-    _timing.EndTime(&_timing.execute_fft);
-  }
-
   // Run Peak Finding only if we aren't depending on RawHitFinder for that part
   if(!_config.fUseRawHits){
     if (_config.timing) {
-      _timing.StartTime();
+      timing.StartTime();
     }
     // get thresholds 
     float threshold = _config.threshold;
@@ -604,12 +778,18 @@ void Analysis::ProcessChannel(const raw::RawDigit &digits) {
       threshold = _config.threshold;
     }
     else if (_config.threshold_calc == 1) {
-      auto thresholds = Threshold(adc_vec, _per_channel_data[channel].baseline, _config.threshold_sigma, _config.verbose);
+      auto thresholds = Threshold(adcs, _channel_data_store.baseline[channel], _config.threshold_sigma, _config.verbose);
       threshold = thresholds.Val();
     }
     else if (_config.threshold_calc == 2) {
-      NoiseSample temp({{0, (unsigned)digits.NADC()-1}}, _per_channel_data[channel].baseline);
-      float raw_rms = temp.RMS(adc_vec);
+      float raw_rms = 0;
+      if (have_sums) {
+        raw_rms = sums.RMS(_channel_data_store.baseline[channel]);
+      }
+      else {
+        NoiseSample temp({{0, (unsigned)digits.NADC()-1}}, _channel_data_store.baseline[channel]);
+        raw_rms = temp.RMS(adcs);
+      }
       threshold = raw_rms * _config.threshold_sigma;
     }
     else if (_config.threshold_calc == 3) {
@@ -617,69 +797,158 @@ void Analysis::ProcessChannel(const raw::RawDigit &digits) {
       float n_sigma = _config.threshold_sigma;
       if (_config.use_planes && _channel_map->PlaneType(channel) == 2) n_sigma = n_sigma * 1.5;
     
-      threshold = _thresholds[channel].Threshold(adc_vec, _per_channel_data[channel].baseline, n_sigma);
+      if (have_sums) {
+        threshold = _thresholds[channel].Threshold(sums, _channel_data_store.baseline[channel], n_sigma);
+      }
+      else {
+        threshold = _thresholds[channel].Threshold(adcs, _channel_data_store.baseline[channel], n_sigma);
+      }
     }
     if (_config.timing) {
-      _timing.EndTime(&_timing.calc_threshold);
+      timing.EndTime(&timing.calc_threshold);
     }
 
-    _per_channel_data[channel].threshold = threshold;
+    _channel_data_store.threshold[channel] = threshold;
 
     if (_config.timing) {
-      _timing.StartTime();
+      timing.StartTime();
     }
     // get Peaks
     unsigned peak_plane = (_config.use_planes) ? _channel_map->PlaneType(channel) : 0;
   
-    PeakFinder peaks(adc_vec, _per_channel_data[channel].baseline, threshold, 
-        _config.n_smoothing_samples, _config.n_above_threshold, peak_plane);
-    _per_channel_data[channel].peaks.assign(peaks.Peaks()->begin(), peaks.Peaks()->end());
+    // peak finder storage is only needed until the peaks are copied out
+    Arena::Marker arena_mark = worker.arena.Mark();
+    {
+      PeakFinder peaks(adcs, _channel_data_store.baseline[channel], threshold, 
+          _config.n_smoothing_samples, _config.n_above_threshold, peak_plane, &worker.arena);
+      _channel_data_store.peaks[channel].assign(peaks.Peaks()->begin(), peaks.Peaks()->end());
+    }
+    worker.arena.Rewind(arena_mark);
     if (_config.timing) {
-      _timing.EndTime(&_timing.find_peaks);
+      timing.EndTime(&timing.find_peaks);
     }
   }
 
   if (_config.timing) {
-    _timing.StartTime();
+    timing.StartTime();
   }
   // get noise samples
   if (_config.noise_range_sampling == 0) {
     // use first n_noise_samples
-    _noise_samples[channel] = NoiseSample( { { 0, _config.n_noise_samples -1 } }, _per_channel_data[channel].baseline);
+    _noise_samples[channel] = NoiseSample( { { 0, _config.n_noise_samples -1 } }, _channel_data_store.baseline[channel], &worker.arena);
   }
   else {
     // or use peak finding
-    _noise_samples[channel] = NoiseSample(_per_channel_data[channel].peaks, _per_channel_data[channel].baseline, digits.NADC()); 
+    _noise_samples[channel] = NoiseSample(_channel_data_store.peaks[channel], _channel_data_store.baseline[channel], digits.NADC(), &worker.arena); 
+  }
+
+  // Filling the prefix sums is a pass over the whole waveform, which costs
+  // about as much as reading each sample of the noise ranges once per
+  // calculation (see WaveformBenchmark). Only fill them if that reads more.
+  unsigned n_noise_reads = (_config.refine_baseline ? 2 : 1) * _noise_samples[channel].NSamples();
+  bool use_prefix_sums = _config.prefix_sums && n_noise_reads > adcs.size();
+  if (use_prefix_sums) {
+    worker.prefix_sums.Fill(adcs);
   }
 
   // Refine baseline values by taking the mean over the background range
   if (_config.refine_baseline) {
-    _noise_samples[channel].ResetBaseline(adc_vec);
-    _per_channel_data[channel].baseline = _noise_samples[channel].Baseline(); 
+    if (use_prefix_sums) {
+      _noise_samples[channel].ResetBaseline(worker.prefix_sums);
+    }
+    else if (have_sums) {
+      _noise_samples[channel].ResetBaseline(adcs, sums);
+    }
+    else {
+      _noise_samples[channel].ResetBaseline(adcs);
+    }
+    _channel_data_store.baseline[channel] = _noise_samples[channel].Baseline(); 
   }
 
-  _per_channel_data[channel].rms = _noise_samples[channel].RMS(adc_vec);
-  _per_channel_data[channel].noise_ranges = *_noise_samples[channel].Ranges();
+  if (use_prefix_sums) {
+    _channel_data_store.rms[channel] = _noise_samples[channel].RMS(worker.prefix_sums);
+  }
+  else if (have_sums) {
+    _channel_data_store.rms[channel] = _noise_samples[channel].RMS(adcs, sums);
+  }
+  else {
+    _channel_data_store.rms[channel] = _noise_samples[channel].RMS(adcs);
+  }
+  _channel_data_store.noise_ranges[channel].assign(_noise_samples[channel].Ranges()->begin(), _noise_samples[channel].Ranges()->end());
+  if (_config.noise_masks) {
+    _noise_masks[channel].FromRanges(*_noise_samples[channel].Ranges(), digits.NADC());
+  }
   if (_config.timing) {
-    _timing.EndTime(&_timing.calc_noise);
+    timing.EndTime(&timing.calc_noise);
   }
 
   // register rms if using running threshold
   if (_config.threshold_calc == 3 && !_config.fUseRawHits) {
-    _thresholds[channel].AddRMS(_per_channel_data[channel].rms);
+    _thresholds[channel].AddRMS(_channel_data_store.rms[channel]);
   }
 
   // calculate derived quantities
-  _per_channel_data[channel].occupancy = _per_channel_data[channel].Occupancy();
-  _per_channel_data[channel].mean_peak_height = _per_channel_data[channel].meanPeakHeight();
+  _channel_data_store.occupancy[channel] = ChannelData::Occupancy(_channel_data_store.peaks[channel]);
+  _channel_data_store.mean_peak_height[channel] = ChannelData::meanPeakHeight(_channel_data_store.peaks[channel]);
+}
+
+void Analysis::ChannelFFTs(const std::vector<raw::RawDigit> &digits) {
+  unsigned n_channels = _channel_map->NChannels();
+  // the spectra all get room for the longest waveform
+  _fft_waveforms.assign(n_channels, NULL);
+  size_t max_n_adc = 0;
+  for (auto const &digit: digits) {
+    if (digit.Channel() >= n_channels) continue;
+    _fft_waveforms[digit.Channel()] = &digit.ADCs();
+    max_n_adc = std::max(max_n_adc, digit.ADCs().size());
+  }
+  if (_config.fft_float) {
+    _channel_data_store.float_fft.Resize(n_channels, max_n_adc/2 + 1);
+  }
+  else {
+    _channel_data_store.fft.Resize(n_channels, max_n_adc/2 + 1);
+  }
+  if (max_n_adc == 0) return;
+
+  // Each task is a whole number of batches of consecutive wires, so that the
+  // batches are written straight into the spectra. Waveforms of any other
+  // size (if there are some) are done one at a time.
+  unsigned batch_size = _config.fft_batch_size;
+  unsigned n_per_task = batch_size * ((_config.n_channels_per_task + batch_size - 1) / batch_size);
+  unsigned n_tasks = (n_channels + n_per_task - 1) / n_per_task;
+  _thread_pool.Run(n_tasks, [&](unsigned task, unsigned thread) {
+    ChannelWorker &worker = *_workers[thread];
+    if (_config.timing) {
+      worker.timing.StartTime();
+    }
+    unsigned first = task * n_per_task;
+    unsigned last = std::min(n_channels, first + n_per_task);
+    if (_config.fft_float) {
+      worker.float_batch_fft.Set(max_n_adc, batch_size);
+      CalculateSpectra(_fft_waveforms, first, last, worker.float_batch_fft, worker.float_fft_manager, _channel_data_store.float_fft);
+    }
+    else {
+      worker.batch_fft.Set(max_n_adc, batch_size);
+      CalculateSpectra(_fft_waveforms, first, last, worker.batch_fft, worker.fft_manager, _channel_data_store.fft);
+    }
+    if (_config.timing) {
+      worker.timing.EndTime(&worker.timing.execute_fft);
+    }
+  });
 }
 
 bool Analysis::ReadyToProcess() {
   return _analyzed;
 }
 
+void Analysis::FillChannelData() {
+  for (unsigned i = 0; i < _channel_data_store.Size(); i++) {
+    _channel_data_store.Get(i, _per_channel_data[i]);
+  }
+}
+
 bool Analysis::EmptyEvent() {
-  return _per_channel_data[0].empty;
+  return _channel_data_store.empty[0];
 }
 
 void Timing::StartTime() {
@@ -689,6 +958,18 @@ void Timing::EndTime(float *field) {
   auto now = std::chrono::high_resolution_clock::now();
   *field += std::chrono::duration<float, std::milli>(now- start).count();
 }
+void Timing::Add(const Timing &other) {
+  fill_waveform += other.fill_waveform;
+  baseline_calc += other.baseline_calc;
+  execute_fft += other.execute_fft;
+  calc_threshold += other.calc_threshold;
+  find_peaks += other.find_peaks;
+  calc_noise += other.calc_noise;
+  reduce_data += other.reduce_data;
+  coherent_noise_calc += other.coherent_noise_calc;
+  copy_headers += other.copy_headers;
+}
+
 void Timing::Print() {
   std::cout << "FILL WAVEFORM: " << fill_waveform << std::endl;
   std::cout << "CALC BASELINE: " << baseline_calc << std::endl;
@@ -6,6 +6,7 @@
 #include <ctime>
 #include <chrono>
 #include <numeric>
+#include <memory>
 
 #include "TROOT.h"
 #include "TTree.h"
@@ -22,23 +23,31 @@
 #include "lardataobj/RecoBase/Hit.h"
 
 #include "ChannelData.hh"
+#include "ChannelDataStore.hh"
 #include "HeaderData.hh"
 #include "NevisTPCMetaData.hh"
 #include "VSTChannelMap.hh"
 #include "FFT.hh"
 #include "Noise.hh"
 #include "EventInfo.hh"
+#include "ThreadPool.hh"
+#include "Arena.hh"
+#include "WaveformPrefixSums.hh"
+#include "Mode.hh"
+#include "NoiseMask.hh"
+#include "ChannelSummary.hh"
 
 /*
   * Main analysis code of the online Monitoring.
   * Takes as input raw::RawDigits and produces
   * a number of useful metrics all defined in 
-  * ChannelData.hh
+  * ChannelData.hh (and stored in a ChannelDataStore)
 */
 
 namespace daqAnalysis {
   class Analysis;
   class Timing;
+  class ChannelWorker;
 }
 
 // keep track of timing information
@@ -69,10 +78,41 @@ public:
   
   void StartTime();
   void EndTime(float *field);
+  // add in the timing info from another instance (e.g. a worker thread)
+  void Add(const Timing &other);
 
   void Print();
 };
 
+// state owned by each thread processing channels. Each worker gets
+// its own FFT managers, timing info and memory arena so that 
+// ProcessChannel() can run on many channels at once.
+class daqAnalysis::ChannelWorker {
+public:
+  // for the per-channel FFT's (if fft_per_channel is set), in double
+  // precision or, if fft_float is set, single precision
+  FFTManager fft_manager;
+  BatchFFTManager batch_fft;
+  FloatFFTManager float_fft_manager;
+  FloatBatchFFTManager float_batch_fft;
+  Timing timing;
+  // backs the peaks and noise ranges made while processing channels.
+  // Reset at the start of each event.
+  Arena arena;
+  // prefix sums of the channel being processed (if prefix_sums is set)
+  WaveformPrefixSums prefix_sums;
+  // for the fused kernel with exact_mode set. Reset for each channel
+  ExactModeFinder exact_mode_finder;
+
+  // only plans the FFT's of the precision that will be used
+  ChannelWorker(unsigned fft_input_size, unsigned fft_batch_size, bool fft_float): 
+    fft_manager(fft_float ? 0 : fft_input_size),
+    batch_fft(fft_float ? 0 : fft_input_size, fft_batch_size),
+    float_fft_manager(fft_float ? fft_input_size : 0),
+    float_batch_fft(fft_float ? fft_input_size : 0, fft_batch_size)
+  {}
+};
+
 
 class daqAnalysis::Analysis {
 public:
@@ -82,6 +122,9 @@ public:
   void AnalyzeEvent(art::Event const & e);
   // sum FEM waveforms
   void SumWaveforms(art::Event const & event);
+  // fill the waveform of each channel in the ChannelDataStore for a snapshot
+  // (does nothing if fill_waveforms already did)
+  void SnapshotWaveforms(art::Event const & event);
 
   // configuration
   struct AnalysisConfig {
@@ -101,6 +144,7 @@ public:
     unsigned baseline_calc;
     bool refine_baseline;
     unsigned n_mode_skip;
+    bool exact_mode;
     unsigned noise_range_sampling;
     bool use_planes;
     unsigned threshold_calc;
@@ -111,7 +155,14 @@ public:
     bool sum_waveforms;
     bool fft_summed_waveforms;
     bool fft_per_channel;
+    unsigned fft_batch_size;
+    bool fft_float;
+    std::string fftw_wisdom_file;
     bool fill_waveforms;
+    bool fused_kernel;
+    bool prefix_sums;
+    bool noise_masks;
+    bool use_summary;
     bool reduce_data;
     bool timing;
     bool fUseRawHits;
@@ -120,6 +171,9 @@ public:
     bool fDoPurityAna;
     bool fCosmicRun;
 
+    unsigned n_threads;
+    unsigned n_channels_per_task;
+
     std::string fHitsModuleLabel;
 
     //Purity config... Sorry for loads I don't know if they will ned changing.  
@@ -148,10 +202,20 @@ public:
   // other functions
   void ProcessChannel(const raw::RawDigit &digits);
   void ProcessChannel(const raw::RawDigit &digits, const std::vector<art::Ptr<recob::Hit> > &hits);
+  // process a channel using the state of a particular worker thread
+  void ProcessChannel(const raw::RawDigit &digits, daqAnalysis::ChannelWorker &worker);
+  void ProcessChannel(const raw::RawDigit &digits, const std::vector<art::Ptr<recob::Hit> > &hits, daqAnalysis::ChannelWorker &worker);
   void ProcessHeader(const daqAnalysis::HeaderData &header);
   void ProcessMetaData(const daqAnalysis::NevisTPCMetaData &metadata); 
   void ProcessEventInfo(double &lifetime);
 
+  // copy the per-channel data from the store into _per_channel_data
+  void FillChannelData();
+
+  // calculate the per-channel FFT's into _channel_data_store.fft (or
+  // float_fft if fft_float is set)
+  void ChannelFFTs(const std::vector<raw::RawDigit> &digits);
+
   // if the containers filled by the analysis are ready to be processed
   bool ReadyToProcess();
   bool EmptyEvent();
@@ -167,9 +231,17 @@ public:
   // keeping track of wire id to index into stuff from Decoder
   std::vector<unsigned> _channel_index_map;
   // output containers of analysis code. Only use after calling ReadyToProcess()
+  // per-channel data, stored column-wise
+  daqAnalysis::ChannelDataStore _channel_data_store;
+  // the same, one object per-channel. Only filled by FillChannelData()
   std::vector<daqAnalysis::ChannelData> _per_channel_data;
   std::vector<daqAnalysis::ReducedChannelData> _per_channel_data_reduced;
   std::vector<daqAnalysis::NoiseSample> _noise_samples;
+  // the same noise ranges as bitmasks (only filled if noise_masks is set)
+  std::vector<daqAnalysis::NoiseMask> _noise_masks;
+  // statistics of each channel from the decoder in this event (only filled
+  // if use_summary is set and the decoder produced them)
+  std::vector<const daqAnalysis::ChannelSummary *> _channel_summaries;
   daqAnalysis::EventInfo _event_info;
   std::vector<RunningThreshold> _thresholds;
   std::vector<std::vector<int>> _fem_summed_waveforms;
@@ -178,8 +250,16 @@ public:
 private:
   unsigned _event_ind;
   FFTManager _fft_manager;
+  // waveform of each wire to take the FFT of (NULL if there isn't one)
+  std::vector<const std::vector<int16_t> *> _fft_waveforms;
+  // FFT plans made and time spent making them as of the last event
+  unsigned _n_fft_plans;
+  float _fft_planning_time;
   // keep track of timing data (maybe)
   daqAnalysis::Timing _timing;
+  // threads for per-channel processing and their state
+  daqAnalysis::ThreadPool _thread_pool;
+  std::vector<std::unique_ptr<daqAnalysis::ChannelWorker>> _workers;
   // whether we have analyzed stuff
   bool _analyzed;
   uint32_t _sub_run_start_time;
@@ -0,0 +1,68 @@
+#include <vector>
+#include <algorithm>
+
+#include "Arena.hh"
+
+using namespace daqAnalysis;
+
+Arena::Arena(size_t block_size):
+  _block_ind(0),
+  _offset(0),
+  _block_size(block_size),
+  _n_heap_allocations(0)
+{}
+
+Arena::~Arena() {
+  for (auto &block: _blocks) {
+    ::operator delete(block.data);
+  }
+}
+
+void Arena::AddBlock(size_t size) {
+  _blocks.push_back(Block {static_cast<char *>(::operator new(size)), size});
+  _n_heap_allocations ++;
+}
+
+void *Arena::Allocate(size_t size, size_t align) {
+  while (_block_ind < _blocks.size()) {
+    size_t start = (_offset + align - 1) / align * align;
+    if (start + size <= _blocks[_block_ind].size) {
+      _offset = start + size;
+      return _blocks[_block_ind].data + start;
+    }
+    // doesn't fit -- move on to the next block
+    _block_ind ++;
+    _offset = 0;
+  }
+  // out of blocks -- make a new one big enough for this allocation
+  // (memory from operator new is aligned for any type)
+  AddBlock(std::max(_block_size, size));
+  _block_ind = _blocks.size() - 1;
+  _offset = size;
+  return _blocks[_block_ind].data;
+}
+
+void Arena::Reset() {
+  _n_heap_allocations = 0;
+  // if last event needed more than one block, replace them with a
+  // single block big enough for all of it
+  if (_blocks.size() > 1) {
+    size_t capacity = Capacity();
+    for (auto &block: _blocks) {
+      ::operator delete(block.data);
+    }
+    _blocks.clear();
+    _block_size = std::max(_block_size, capacity);
+    AddBlock(_block_size);
+  }
+  _block_ind = 0;
+  _offset = 0;
+}
+
+size_t Arena::Capacity() const {
+  size_t capacity = 0;
+  for (auto const &block: _blocks) {
+    capacity += block.size;
+  }
+  return capacity;
+}
@@ -0,0 +1,109 @@
+#ifndef _sbnddaq_analysis_Arena
+#define _sbnddaq_analysis_Arena
+#include <vector>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+
+// Monotonic memory arena for short lived per-event containers.
+//
+// Memory is handed out from a few large blocks and is never given back
+// on its own. Instead, the whole arena is Reset() at the start of each
+// event, after which the same blocks are handed out again. Once the
+// arena has seen a typical event it no longer needs to touch the heap.
+//
+// Mark()/Rewind() can be used to give back everything allocated after
+// some point, e.g. scratch space used while processing one channel.
+//
+// An arena is not thread safe: each thread should have its own.
+namespace daqAnalysis {
+class Arena {
+public:
+  // position in the arena, as returned by Mark()
+  struct Marker {
+    size_t block;
+    size_t offset;
+  };
+
+  explicit Arena(size_t block_size=1<<16);
+  ~Arena();
+
+  // Arenas own their memory and should not be copied
+  Arena(Arena const &) = delete;
+  Arena & operator = (Arena const &) = delete;
+
+  void *Allocate(size_t size, size_t align);
+  // give back all memory (doesn't free it)
+  void Reset();
+
+  Marker Mark() const { return Marker {_block_ind, _offset}; }
+  // give back all memory allocated since the marker was made
+  void Rewind(Marker mark) { _block_ind = mark.block; _offset = mark.offset; }
+
+  // number of heap allocations made by the arena since the last Reset()
+  unsigned NHeapAllocations() const { return _n_heap_allocations; }
+  // total size of the blocks owned by the arena
+  size_t Capacity() const;
+
+private:
+  struct Block {
+    char *data;
+    size_t size;
+  };
+  void AddBlock(size_t size);
+
+  std::vector<Block> _blocks;
+  size_t _block_ind;
+  size_t _offset;
+  size_t _block_size;
+  unsigned _n_heap_allocations;
+};
+
+// STL allocator drawing from an Arena. A default constructed allocator
+// (no arena) falls back on the heap, so containers using it work the same
+// as regular ones when no arena is provided.
+template<typename T>
+class ArenaAllocator {
+public:
+  typedef T value_type;
+  // allocator goes along with the data on container assignment
+  typedef std::true_type propagate_on_container_copy_assignment;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator() noexcept: _arena(nullptr) {}
+  explicit ArenaAllocator(Arena *arena) noexcept: _arena(arena) {}
+  template<typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) noexcept: _arena(other.GetArena()) {}
+
+  T *allocate(size_t n) {
+    if (_arena != nullptr) {
+      return static_cast<T *>(_arena->Allocate(n * sizeof(T), alignof(T)));
+    }
+    return static_cast<T *>(::operator new(n * sizeof(T)));
+  }
+  void deallocate(T *ptr, size_t) noexcept {
+    // arena memory is given back on Reset()
+    if (_arena == nullptr) {
+      ::operator delete(ptr);
+    }
+  }
+
+  Arena *GetArena() const { return _arena; }
+
+private:
+  Arena *_arena;
+};
+
+template<typename T, typename U>
+inline bool operator==(const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) { return lhs.GetArena() == rhs.GetArena(); }
+template<typename T, typename U>
+inline bool operator!=(const ArenaAllocator<T> &lhs, const ArenaAllocator<U> &rhs) { return !(lhs == rhs); }
+
+// vector backed by an arena
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+} // namespace daqAnalysis
+
+#endif
@@ -0,0 +1,129 @@
+#ifndef _sbnddaq_analysis_BoundedQueue
+#define _sbnddaq_analysis_BoundedQueue
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+#include <utility>
+
+// Fixed size queue for handing objects between threads. Everything is
+// done under one mutex, and Push()/Pop() sleep on a condition variable.
+//
+// TryPush() and TryPop() never wait: they return false if the queue is
+// full/empty. Push() and Pop() instead sleep until there is room/a value,
+// or until the queue is Close()'d.
+namespace daqAnalysis {
+template<typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity): _capacity(capacity > 0 ? capacity : 1), _closed(false) {}
+
+  // Queues own their contents and should not be copied
+  BoundedQueue(BoundedQueue const &) = delete;
+  BoundedQueue & operator = (BoundedQueue const &) = delete;
+
+  // move value into the queue. If the queue is full, value is left alone
+  bool TryPush(T &value);
+  // move the oldest value in the queue into value
+  bool TryPop(T &value);
+  // move value into the queue. If the queue is full, value takes the place
+  // of the newest value in the queue, which is moved out into value.
+  // Returns whether a value was replaced
+  bool PushReplaceNewest(T &value);
+
+  // same as TryPush(), but waits for room. Returns false (leaving value
+  // alone) if the queue is closed
+  bool Push(T &value);
+  // same as TryPop(), but waits for a value. Returns false once the queue
+  // is closed and empty
+  bool Pop(T &value);
+  // wake up everything waiting in Push()/Pop(). Values already in the
+  // queue can still be popped
+  void Close();
+
+  size_t Capacity() const { return _capacity; }
+
+private:
+  size_t _capacity;
+  std::deque<T> _values;
+  bool _closed;
+  std::mutex _mutex;
+  std::condition_variable _not_empty;
+  std::condition_variable _not_full;
+};
+
+template<typename T>
+bool BoundedQueue<T>::TryPush(T &value) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_values.size() >= _capacity) return false;
+    _values.push_back(std::move(value));
+  }
+  _not_empty.notify_one();
+  return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::TryPop(T &value) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_values.empty()) return false;
+    value = std::move(_values.front());
+    _values.pop_front();
+  }
+  _not_full.notify_one();
+  return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::PushReplaceNewest(T &value) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_values.size() >= _capacity) {
+      std::swap(_values.back(), value);
+      return true;
+    }
+    _values.push_back(std::move(value));
+  }
+  _not_empty.notify_one();
+  return false;
+}
+
+template<typename T>
+bool BoundedQueue<T>::Push(T &value) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_full.wait(lock, [this] { return _closed || _values.size() < _capacity; });
+    if (_closed) return false;
+    _values.push_back(std::move(value));
+  }
+  _not_empty.notify_one();
+  return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::Pop(T &value) {
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _not_empty.wait(lock, [this] { return _closed || !_values.empty(); });
+    if (_values.empty()) return false;
+    value = std::move(_values.front());
+    _values.pop_front();
+  }
+  _not_full.notify_one();
+  return true;
+}
+
+template<typename T>
+void BoundedQueue<T>::Close() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _closed = true;
+  }
+  _not_empty.notify_all();
+  _not_full.notify_all();
+}
+
+} // namespace daqAnalysis
+
+#endif
@@ -9,6 +9,10 @@
 #include "ChannelData.hh"
 
 float daqAnalysis::ChannelData::meanPeakHeight() {
+  return meanPeakHeight(peaks);
+}
+
+float daqAnalysis::ChannelData::meanPeakHeight(const std::vector<PeakFinder::Peak> &peaks) {
   if (peaks.size() == 0) {
     return 0;
   } 
@@ -34,8 +38,12 @@ float daqAnalysis::ChannelData::meanPeakHeight(const std::vector<art::Ptr<recob:
 }
 
 
-// only count up peaks
 float daqAnalysis::ChannelData::Occupancy() {
+  return Occupancy(peaks);
+}
+
+// only count up peaks
+float daqAnalysis::ChannelData::Occupancy(const std::vector<PeakFinder::Peak> &peaks) {
   float n_peaks = 0;
   for (unsigned i = 0; i < peaks.size(); i++) {
     if (peaks[i].is_up) {
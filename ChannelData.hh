@@ -21,6 +21,7 @@ public:
   float next_channel_dnoise;
   float threshold;
   std::vector<int16_t> waveform;
+  // double precision, even if the spectrum was calculated in single precision (fft_float)
   std::vector<double> fft_real;
   std::vector<double> fft_imag;
   std::vector<PeakFinder::Peak> peaks;
@@ -34,9 +35,13 @@ public:
   float Hitmean_peak_height;
 
   float meanPeakHeight();
-  float meanPeakHeight(const std::vector<art::Ptr<recob::Hit> > &hits);
   float Occupancy();
 
+  // versions which work on peaks/hits stored elsewhere (e.g. ChannelDataStore)
+  static float meanPeakHeight(const std::vector<PeakFinder::Peak> &peaks);
+  static float meanPeakHeight(const std::vector<art::Ptr<recob::Hit> > &hits);
+  static float Occupancy(const std::vector<PeakFinder::Peak> &peaks);
+
   // zero initialize
   explicit ChannelData(unsigned channel=0):
     channel_no(channel),
@@ -0,0 +1,113 @@
+#include <vector>
+#include <string>
+
+#include "ChannelData.hh"
+#include "ChannelDataStore.hh"
+
+void daqAnalysis::ChannelDataStore::Resize(unsigned n_channels) {
+  channel_no.resize(n_channels);
+  empty.resize(n_channels);
+  baseline.resize(n_channels);
+  max.resize(n_channels);
+  min.resize(n_channels);
+  rms.resize(n_channels);
+  next_channel_dnoise.resize(n_channels);
+  threshold.resize(n_channels);
+  mean_peak_height.resize(n_channels);
+  occupancy.resize(n_channels);
+  Hitoccupancy.resize(n_channels);
+  Hitmean_peak_height.resize(n_channels);
+
+  waveform.resize(n_channels);
+  fft.Resize(n_channels, fft.MaxBins());
+  float_fft.Resize(n_channels, float_fft.MaxBins());
+  peaks.resize(n_channels);
+  noise_ranges.resize(n_channels);
+
+  for (unsigned i = 0; i < n_channels; i++) {
+    Reset(i);
+  }
+}
+
+// same as ChannelData(channel)
+void daqAnalysis::ChannelDataStore::Reset(unsigned channel) {
+  channel_no[channel] = channel;
+  empty[channel] = true;
+  baseline[channel] = 0;
+  max[channel] = 0;
+  min[channel] = 0;
+  rms[channel] = 0;
+  next_channel_dnoise[channel] = 0;
+  threshold[channel] = 0;
+  mean_peak_height[channel] = 0;
+  occupancy[channel] = 0;
+  Hitoccupancy[channel] = 0;
+  Hitmean_peak_height[channel] = 0;
+  Clear(channel);
+}
+
+void daqAnalysis::ChannelDataStore::Clear(unsigned channel) {
+  waveform[channel].clear();
+  fft.Clear(channel);
+  float_fft.Clear(channel);
+  peaks[channel].clear();
+  noise_ranges[channel].clear();
+}
+
+template<class Precision>
+static void copySpectrum(const BasicSpectra<Precision> &spectra, unsigned channel, daqAnalysis::ChannelData &channel_data) {
+  channel_data.fft_real.resize(spectra.NBins(channel));
+  channel_data.fft_imag.resize(spectra.NBins(channel));
+  for (unsigned i = 0; i < spectra.NBins(channel); i++) {
+    channel_data.fft_real[i] = spectra.Re(channel, i);
+    channel_data.fft_imag[i] = spectra.Im(channel, i);
+  }
+}
+
+void daqAnalysis::ChannelDataStore::Get(unsigned channel, daqAnalysis::ChannelData &channel_data) const {
+  channel_data.channel_no = channel_no[channel];
+  channel_data.empty = empty[channel];
+  channel_data.baseline = baseline[channel];
+  channel_data.max = max[channel];
+  channel_data.min = min[channel];
+  channel_data.rms = rms[channel];
+  channel_data.next_channel_dnoise = next_channel_dnoise[channel];
+  channel_data.threshold = threshold[channel];
+  channel_data.mean_peak_height = mean_peak_height[channel];
+  channel_data.occupancy = occupancy[channel];
+  channel_data.Hitoccupancy = Hitoccupancy[channel];
+  channel_data.Hitmean_peak_height = Hitmean_peak_height[channel];
+
+  channel_data.waveform = waveform[channel];
+  if (float_fft.NBins(channel) != 0) {
+    copySpectrum(float_fft, channel, channel_data);
+  }
+  else {
+    copySpectrum(fft, channel, channel_data);
+  }
+  channel_data.peaks = peaks[channel];
+  channel_data.noise_ranges = noise_ranges[channel];
+}
+
+daqAnalysis::ChannelData daqAnalysis::ChannelDataStore::Get(unsigned channel) const {
+  daqAnalysis::ChannelData ret;
+  Get(channel, ret);
+  return ret;
+}
+
+daqAnalysis::ReducedChannelData daqAnalysis::ChannelDataStore::GetReduced(unsigned channel) const {
+  daqAnalysis::ReducedChannelData ret;
+  ret.channel_no = channel_no[channel];
+  ret.empty = empty[channel];
+  ret.baseline = baseline[channel];
+  ret.rms = rms[channel];
+  ret.occupancy = occupancy[channel];
+  ret.mean_peak_amplitude = mean_peak_height[channel];
+  ret.Hitoccupancy = Hitoccupancy[channel];
+  ret.Hitmean_peak_height = Hitmean_peak_height[channel];
+  return ret;
+}
+
+std::string daqAnalysis::ChannelDataStore::Print(unsigned channel) const {
+  return Get(channel).Print();
+}
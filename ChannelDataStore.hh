@@ -0,0 +1,76 @@
+#ifndef _sbnddaq_analysis_ChannelDataStore
+#define _sbnddaq_analysis_ChannelDataStore
+
+#include <vector>
+#include <array>
+#include <string>
+
+#include "PeakFinder.hh"
+#include "ChannelData.hh"
+#include "FFT.hh"
+
+/*
+ * Column-wise storage of the per-channel output of the Analysis.
+ *
+ * Each scalar quantity in ChannelData gets its own contiguous array
+ * indexed by wire number, so that code looping over all channels to
+ * look at one quantity (e.g. the Redis metrics) only touches the memory
+ * it needs. The variable length parts (waveform, peaks, noise ranges)
+ * are kept in separate per-channel buffers which are cleared (but not
+ * freed) between events, so their storage gets re-used. The per-channel
+ * FFT's are kept together in one Spectra (a FloatSpectra in single
+ * precision), so they can be filled in batches.
+ *
+ * ChannelData is still available through Get() for things that want
+ * one object per channel (e.g. the TTree output in VSTAnalysis).
+*/
+
+namespace daqAnalysis {
+  class ChannelDataStore;
+}
+
+class daqAnalysis::ChannelDataStore {
+public:
+  explicit ChannelDataStore(unsigned n_channels=0) { Resize(n_channels); }
+
+  void Resize(unsigned n_channels);
+  unsigned Size() const { return channel_no.size(); }
+
+  // zero out the data for a channel
+  void Reset(unsigned channel);
+  // clear out the variable length data for a channel (keeps the storage)
+  void Clear(unsigned channel);
+
+  // ChannelData adaptors
+  void Get(unsigned channel, daqAnalysis::ChannelData &channel_data) const;
+  daqAnalysis::ChannelData Get(unsigned channel) const;
+  daqAnalysis::ReducedChannelData GetReduced(unsigned channel) const;
+
+  std::string Print(unsigned channel) const;
+
+  // scalar per-channel data
+  // (empty is stored as char so that different channels can be written from different threads)
+  std::vector<unsigned> channel_no;
+  std::vector<char> empty;
+  std::vector<int16_t> baseline;
+  std::vector<int16_t> max;
+  std::vector<int16_t> min;
+  std::vector<float> rms;
+  std::vector<float> next_channel_dnoise;
+  std::vector<float> threshold;
+  std::vector<float> mean_peak_height;
+  std::vector<float> occupancy;
+  std::vector<float> Hitoccupancy;
+  std::vector<float> Hitmean_peak_height;
+
+  // variable length per-channel data
+  std::vector<std::vector<int16_t>> waveform;
+  // indexed by wire, only filled if fft_per_channel is set. Depending on
+  // fft_float, either fft or float_fft is used
+  Spectra fft;
+  FloatSpectra float_fft;
+  std::vector<std::vector<PeakFinder::Peak>> peaks;
+  std::vector<std::vector<std::array<unsigned, 2>>> noise_ranges;
+};
+
+#endif
@@ -0,0 +1,154 @@
+#ifndef _sbnddaq_analysis_ChannelLookup
+#define _sbnddaq_analysis_ChannelLookup
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include <cstdint>
+
+// Flat lookup tables for the channel map queries done once per waveform
+// (or wire) in the decoder, analysis and Redis code, so each one is an
+// indexed load instead of a walk through a std::map (or three).
+//
+// All of the tables are filled once from the queries of the channel map
+// itself, so they agree with it by construction. Values outside of the
+// tables report kNotInTable, and the caller should ask the map instead.
+//
+// Also describes the crate/FEM/channel hierarchy of the mapped channels for
+// the metrics sent to Redis: FEMs are numbered over all crates (crate
+// by crate), and each mapped channel knows its index in its FEM and crate.
+namespace daqAnalysis {
+class ChannelLookup {
+public:
+  // readout location of a mapped wire
+  class Entry {
+  public:
+    unsigned wire;
+    unsigned crate;
+    // index of the FEM in its crate (the SlotIndex())
+    unsigned fem;
+    // index of the FEM over all crates
+    unsigned global_fem;
+    // index of the channel on the FEM
+    unsigned fem_channel_ind;
+    // index of the channel in its crate (ordered by wire)
+    unsigned crate_channel_ind;
+  };
+
+  static const int kNotMapped = -1;
+  static const int kNotInTable = -2;
+  // largest raw slot number in a crate
+  static const unsigned kMaxSlots = 32;
+
+  ChannelLookup(): _n_fem_per_crate(0), _n_slot_channels(0) {}
+
+  // crate_ids[i] is the raw (header) number of the i-th crate of the map
+  template<typename Map>
+  void Build(const Map &map, const std::vector<unsigned> &crate_ids);
+
+  unsigned NWires() const { return _wire_to_channel.size(); }
+  // same as Map::Wire2Channel()
+  inline unsigned Wire2Channel(unsigned wire) const { return _wire_to_channel[wire]; }
+  // same as Map::SlotIndex(Map::Ind2ReadoutChannel(Map::Wire2Channel(wire)))
+  inline unsigned Wire2FEM(unsigned wire) const { return _wire_to_fem[wire]; }
+
+  // mapped channels over the crate, FEM and channel indices, in that order
+  const std::vector<Entry> &Entries() const { return _entries; }
+
+  // the hierarchy
+  unsigned NCrates() const { return _n_crate_channels.size(); }
+  // over all crates
+  unsigned NFEMs() const { return _n_fem_channels.size(); }
+  inline unsigned GlobalFEM(unsigned crate, unsigned fem) const { return crate * _n_fem_per_crate + fem; }
+  inline unsigned FEMCrate(unsigned global_fem) const { return global_fem / _n_fem_per_crate; }
+  inline unsigned FEMInCrate(unsigned global_fem) const { return global_fem % _n_fem_per_crate; }
+  // number of mapped channels
+  unsigned NFEMChannels(unsigned global_fem) const { return _n_fem_channels[global_fem]; }
+  unsigned NCrateChannels(unsigned crate) const { return _n_crate_channels[crate]; }
+  // index of the crate with the raw (header) number, or -1
+  inline int CrateIndex(unsigned crate) const { return (crate < _crate_ind.size()) ? _crate_ind[crate] : -1; }
+
+  // wire of the channel at the raw (nevis) channel, slot and crate numbers.
+  // kNotMapped if it isn't mapped to a wire
+  inline int NevisChannel2Wire(unsigned channel, unsigned slot, unsigned crate) const {
+    if (crate >= _crate_ind.size() || _crate_ind[crate] < 0 || slot >= kMaxSlots || channel >= _n_slot_channels) {
+      return kNotInTable;
+    }
+    return _nevis_to_wire[(_crate_ind[crate] * kMaxSlots + slot) * _n_slot_channels + channel];
+  }
+
+private:
+  std::vector<unsigned> _wire_to_channel;
+  std::vector<unsigned> _wire_to_fem;
+  std::vector<Entry> _entries;
+  unsigned _n_fem_per_crate;
+  std::vector<unsigned> _n_fem_channels;
+  std::vector<unsigned> _n_crate_channels;
+  // raw crate number to index into _nevis_to_wire (or -1)
+  std::vector<int> _crate_ind;
+  unsigned _n_slot_channels;
+  std::vector<int> _nevis_to_wire;
+};
+
+template<typename Map>
+void ChannelLookup::Build(const Map &map, const std::vector<unsigned> &crate_ids) {
+  unsigned n_wires = map.NChannels();
+  _wire_to_channel.resize(n_wires);
+  _wire_to_fem.resize(n_wires);
+  for (unsigned wire = 0; wire < n_wires; wire++) {
+    _wire_to_channel[wire] = map.Wire2Channel(wire);
+    _wire_to_fem[wire] = map.SlotIndex(map.Ind2ReadoutChannel(_wire_to_channel[wire]));
+  }
+
+  _n_slot_channels = map.NSlotChannel();
+  _n_fem_per_crate = map.NFEM();
+  _n_fem_channels.assign(map.NCrates() * _n_fem_per_crate, 0);
+  _n_crate_channels.assign(map.NCrates(), 0);
+  _entries.clear();
+  for (unsigned crate = 0; crate < map.NCrates(); crate++) {
+    for (unsigned fem = 0; fem < map.NFEM(); fem++) {
+      for (unsigned channel = 0; channel < _n_slot_channels; channel++) {
+        if (!map.IsMappedChannel(channel, fem, crate, true)) continue;
+        Entry entry;
+        entry.wire = map.Channel2Wire(channel, fem, crate, true);
+        entry.crate = crate;
+        entry.fem = fem;
+        entry.global_fem = GlobalFEM(crate, fem);
+        entry.fem_channel_ind = map.ReadoutChannel2FEMInd(channel, fem, crate, true);
+        _entries.push_back(entry);
+        _n_fem_channels[entry.global_fem] ++;
+        _n_crate_channels[crate] ++;
+      }
+    }
+  }
+  // number the channels of each crate in wire order (with one crate, this is the wire)
+  std::vector<std::pair<unsigned, unsigned>> crate_wires;
+  for (unsigned crate = 0; crate < map.NCrates(); crate++) {
+    crate_wires.clear();
+    for (unsigned i = 0; i < _entries.size(); i++) {
+      if (_entries[i].crate == crate) crate_wires.emplace_back(_entries[i].wire, i);
+    }
+    std::sort(crate_wires.begin(), crate_wires.end());
+    for (unsigned rank = 0; rank < crate_wires.size(); rank++) {
+      _entries[crate_wires[rank].second].crate_channel_ind = rank;
+    }
+  }
+
+  // raw slots which aren't good are left to the map
+  _crate_ind.clear();
+  _nevis_to_wire.assign(crate_ids.size() * kMaxSlots * _n_slot_channels, (int)kNotInTable);
+  for (unsigned crate_ind = 0; crate_ind < crate_ids.size(); crate_ind++) {
+    unsigned crate = crate_ids[crate_ind];
+    if (crate >= _crate_ind.size()) _crate_ind.resize(crate + 1, -1);
+    _crate_ind[crate] = crate_ind;
+    for (unsigned slot = 0; slot < kMaxSlots; slot++) {
+      if (!map.IsGoodSlot(slot)) continue;
+      for (unsigned channel = 0; channel < _n_slot_channels; channel++) {
+        int &wire = _nevis_to_wire[(crate_ind * kMaxSlots + slot) * _n_slot_channels + channel];
+        wire = map.IsMappedChannel(channel, slot, crate) ? (int)map.Channel2Wire(channel, slot, crate) : kNotMapped;
+      }
+    }
+  }
+}
+
+} // namespace daqAnalysis
+#endif
@@ -0,0 +1,65 @@
+#ifndef _sbnddaq_analysis_ChannelSummary
+#define _sbnddaq_analysis_ChannelSummary
+#include <cstdint>
+#include <math.h>
+
+#include "WaveformSums.hh"
+
+// Per-channel statistics of a raw::RawDigit, calculated by the DaqDecoder
+// in the same pass that converts the Nevis data. Analysis uses them (when
+// present) instead of scanning the ADC's again.
+//
+// All values describe the ADC's as stored in the RawDigit (i.e. after the
+// pedestal subtraction, if the decoder does one).
+namespace daqAnalysis {
+class ChannelSummary {
+public:
+  unsigned channel_no;
+  // mode of the ADC's
+  int16_t pedestal;
+  int16_t min;
+  int16_t max;
+  // RMS around the pedestal
+  float raw_rms;
+  unsigned n_samples;
+  // sums of the ADC values and their squares, so that statistics around
+  // any other baseline can be recovered exactly
+  int64_t sum;
+  int64_t sum_sq;
+
+  ChannelSummary():
+    channel_no(0),
+    pedestal(0),
+    min(0),
+    max(0),
+    raw_rms(0),
+    n_samples(0),
+    sum(0),
+    sum_sq(0)
+  {}
+
+  ChannelSummary(unsigned channel, int16_t mode, const WaveformSums &sums):
+    channel_no(channel),
+    pedestal(mode),
+    min(sums.min),
+    max(sums.max),
+    raw_rms(sums.n_samples > 0 ? sums.RMS(mode) : 0),
+    n_samples(sums.n_samples),
+    sum(sums.sum),
+    sum_sq(sums.sum_sq)
+  {}
+
+  // back to the sums of the waveform
+  WaveformSums Sums() const {
+    WaveformSums ret;
+    ret.n_samples = n_samples;
+    ret.min = min;
+    ret.max = max;
+    ret.sum = sum;
+    ret.sum_sq = sum_sq;
+    return ret;
+  }
+};
+
+} // namespace daqAnalysis
+#endif
@@ -1,78 +1,438 @@
 #include <vector>
 #include <cassert>
 #include <iostream>
+#include <mutex>
+#include <cstring>
+#include <chrono>
+#include <map>
+#include <string>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "fftw3.h"
 
 #include "FFT.hh"
 
-FFTManager::FFTManager(unsigned input_size) {
+// FFTW planning is not thread safe (only fftw_execute is), so all
+// plan creation/destruction and wisdom goes through this lock. It also
+// protects the FFTPlanCache.
+static std::mutex fftw_planner_mutex;
+
+// make an r2c plan on scratch arrays with the same layout as BatchFFTManager
+static fftw_plan planMany(int n, unsigned batch_size, unsigned input_stride, unsigned output_stride) {
+  double *input = fftw_alloc_real((size_t)input_stride * batch_size);
+  fftw_complex *output = fftw_alloc_complex((size_t)output_stride * batch_size);
+  fftw_plan plan = fftw_plan_many_dft_r2c(1, &n, batch_size,
+    input, NULL, 1, input_stride,
+    output, NULL, 1, output_stride, FFTW_MEASURE);
+  fftw_free(input);
+  fftw_free(output);
+  return plan;
+}
+
+static fftwf_plan planManyFloat(int n, unsigned batch_size, unsigned input_stride, unsigned output_stride) {
+  float *input = fftwf_alloc_real((size_t)input_stride * batch_size);
+  fftwf_complex *output = fftwf_alloc_complex((size_t)output_stride * batch_size);
+  fftwf_plan plan = fftwf_plan_many_dft_r2c(1, &n, batch_size,
+    input, NULL, 1, input_stride,
+    output, NULL, 1, output_stride, FFTW_MEASURE);
+  fftwf_free(input);
+  fftwf_free(output);
+  return plan;
+}
+
+FFTPlanCache &FFTPlanCache::Instance() {
+  static FFTPlanCache instance;
+  return instance;
+}
+
+fftw_plan FFTPlanCache::Plan(unsigned input_size, unsigned batch_size) {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  Key key(input_size, batch_size);
+  auto found = _plans.find(key);
+  if (found != _plans.end()) return found->second;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  fftw_plan plan = planMany(input_size, batch_size,
+    BatchFFTManager::PaddedInputSize(input_size), Spectra::PaddedBins(input_size/2 + 1));
+  _plans[key] = plan;
+  auto end = std::chrono::high_resolution_clock::now();
+  _planning_time += std::chrono::duration<float, std::milli>(end - start).count();
+  return plan;
+}
+
+fftwf_plan FFTPlanCache::FloatPlan(unsigned input_size, unsigned batch_size) {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  Key key(input_size, batch_size);
+  auto found = _float_plans.find(key);
+  if (found != _float_plans.end()) return found->second;
+
+  auto start = std::chrono::high_resolution_clock::now();
+  fftwf_plan plan = planManyFloat(input_size, batch_size,
+    FloatBatchFFTManager::PaddedInputSize(input_size), FloatSpectra::PaddedBins(input_size/2 + 1));
+  _float_plans[key] = plan;
+  auto end = std::chrono::high_resolution_clock::now();
+  _planning_time += std::chrono::duration<float, std::milli>(end - start).count();
+  return plan;
+}
+
+bool FFTPlanCache::ImportWisdom(const std::string &file_name) {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  _wisdom_file = file_name;
+  bool read_double = fftw_import_wisdom_from_filename(file_name.c_str()) != 0;
+  bool read_float = fftwf_import_wisdom_from_filename((file_name + ".float").c_str()) != 0;
+  return read_double || read_float;
+}
+
+bool FFTPlanCache::ExportWisdom() {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  if (_wisdom_file.size() == 0) return false;
+  bool success = fftw_export_wisdom_to_filename(_wisdom_file.c_str()) != 0;
+  if (_float_plans.size() != 0) {
+    success = (fftwf_export_wisdom_to_filename((_wisdom_file + ".float").c_str()) != 0) && success;
+  }
+  return success;
+}
+
+std::string FFTPlanCache::WisdomFile() {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  return _wisdom_file;
+}
+
+unsigned FFTPlanCache::NPlans() {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  return _plans.size() + _float_plans.size();
+}
+
+float FFTPlanCache::PlanningTime() {
+  std::lock_guard<std::mutex> lock(fftw_planner_mutex);
+  return _planning_time;
+}
+
+FFTPlanCache::~FFTPlanCache() {
+  for (auto &plan: _plans) {
+    fftw_destroy_plan(plan.second);
+  }
+  for (auto &plan: _float_plans) {
+    fftwf_destroy_plan(plan.second);
+  }
+}
+
+void ConvertADCs(const int16_t *adcs, size_t n, double *output) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(adcs + i));
+    // sign extend to 32 bits by unpacking into the high halves
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_pd(output + i, _mm_cvtepi32_pd(lo));
+    _mm_storeu_pd(output + i + 2, _mm_cvtepi32_pd(_mm_shuffle_epi32(lo, _MM_SHUFFLE(1, 0, 3, 2))));
+    _mm_storeu_pd(output + i + 4, _mm_cvtepi32_pd(hi));
+    _mm_storeu_pd(output + i + 6, _mm_cvtepi32_pd(_mm_shuffle_epi32(hi, _MM_SHUFFLE(1, 0, 3, 2))));
+  }
+#endif
+  for (; i < n; i++) {
+    output[i] = (double) adcs[i];
+  }
+}
+
+void ConvertADCs(const int16_t *adcs, size_t n, float *output) {
+  size_t i = 0;
+#ifdef __SSE2__
+  for (; i + 8 <= n; i += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i *)(adcs + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16);
+    _mm_storeu_ps(output + i, _mm_cvtepi32_ps(lo));
+    _mm_storeu_ps(output + i + 4, _mm_cvtepi32_ps(hi));
+  }
+#endif
+  for (; i < n; i++) {
+    output[i] = (float) adcs[i];
+  }
+}
+
+template<class Precision>
+BasicFFTManager<Precision>::BasicFFTManager(unsigned input_size) {
+  _input_size = 0;
+  _output_size = 0;
+  _capacity = 0;
   _is_allocated = false;
   if (input_size != 0) { 
     Set(input_size);
   }
 }
 
-void FFTManager::Set(unsigned input_size) {
+template<class Precision>
+void BasicFFTManager<Precision>::Set(unsigned input_size) {
+  if (_is_allocated && input_size == _input_size) return;
   _input_size = input_size;
   // output size of a 1d real FFT
   _output_size = input_size/2 + 1;
   Alloc();
 }
 
-void FFTManager::Alloc() {
-  if (_is_allocated) {
+template<class Precision>
+void BasicFFTManager<Precision>::Alloc() {
+  if (!_is_allocated || _input_size > _capacity) {
     DeAlloc();
+    _input_array = Precision::AllocReal(_input_size);
+    _output_array = Precision::AllocComplex(_output_size);
+    _capacity = _input_size;
   }
-  //unsigned flags = FFTW_ESTIMATE;
-  unsigned flags = FFTW_MEASURE;
-  _input_array = fftw_alloc_real(_input_size);
-  _output_array = fftw_alloc_complex(_output_size);
-  _plan = fftw_plan_dft_r2c_1d(_input_size, _input_array, _output_array, flags);
+  _plan = Precision::CachedPlan(_input_size, 1);
   _is_allocated = true;
 }
 
-void FFTManager::DeAlloc() {
+template<class Precision>
+void BasicFFTManager<Precision>::DeAlloc() {
+  // the plan belongs to the FFTPlanCache
   if (_is_allocated) {
-    fftw_free(_input_array);
-    fftw_free(_output_array);
-    fftw_destroy_plan(_plan);
+    Precision::Free(_input_array);
+    Precision::Free(_output_array);
   }
+  _capacity = 0;
   _is_allocated = false;
 }
 
-void FFTManager::Execute() {
-  fftw_execute(_plan);
+template<class Precision>
+void BasicFFTManager<Precision>::Execute() {
+  Precision::Execute(_plan, _input_array, _output_array);
 }
 
 // get pointer to ith input
-double *FFTManager::InputAt(const int index) {
+template<class Precision>
+typename Precision::Real *BasicFFTManager<Precision>::InputAt(const int index) {
   assert(_is_allocated);
   assert(index < _input_size);
   return &_input_array[index];
 }
 
-double FFTManager::ReOutputAt(const int index) {
+template<class Precision>
+typename Precision::Real BasicFFTManager<Precision>::ReOutputAt(const int index) {
   assert(_is_allocated);
   assert(index < _output_size);
   return _output_array[index][0];
 }
 
-double FFTManager::ImOutputAt(const int index) {
+template<class Precision>
+typename Precision::Real BasicFFTManager<Precision>::ImOutputAt(const int index) {
   assert(_is_allocated);
   assert(index < _output_size);
   return _output_array[index][1];
 }
 
-double FFTManager::AbsOutputAt(const int index) {
+template<class Precision>
+typename Precision::Real BasicFFTManager<Precision>::AbsOutputAt(const int index) {
   assert(_is_allocated);
   assert(index < _output_size);
   return _output_array[index][0]*_output_array[index][0] + _output_array[index][1]*_output_array[index][1];
 }
 
-FFTManager::~FFTManager() {
+template<class Precision>
+BasicFFTManager<Precision>::~BasicFFTManager() {
+  DeAlloc();
+}
+
+template<class Precision>
+BasicSpectra<Precision>::BasicSpectra(const BasicSpectra &other):
+  _max_bins(0),
+  _stride(0),
+  _capacity(0),
+  _data(NULL)
+{
+  *this = other;
+}
+
+template<class Precision>
+BasicSpectra<Precision> &BasicSpectra<Precision>::operator=(const BasicSpectra &other) {
+  if (this == &other) return *this;
+  Resize(other.Size(), other.MaxBins());
+  _n_bins = other._n_bins;
+  if (_data != NULL) {
+    memcpy(_data, other._data, (size_t)Size() * _stride * sizeof(Complex));
+  }
+  return *this;
+}
+
+template<class Precision>
+void BasicSpectra<Precision>::Resize(unsigned n_spectra, unsigned max_bins) {
+  _max_bins = max_bins;
+  _stride = PaddedBins(max_bins);
+  size_t size = (size_t)n_spectra * _stride;
+  if (size > _capacity) {
+    if (_data != NULL) Precision::Free(_data);
+    _data = Precision::AllocComplex(size);
+    _capacity = size;
+  }
+  _n_bins.assign(n_spectra, 0);
+}
+
+template<class Precision>
+BasicSpectra<Precision>::~BasicSpectra() {
+  if (_data != NULL) Precision::Free(_data);
+}
+
+template<class Precision>
+BasicBatchFFTManager<Precision>::BasicBatchFFTManager(unsigned input_size, unsigned batch_size) {
+  _input_size = 0;
+  _output_size = 0;
+  _batch_size = 0;
+  _input_stride = 0;
+  _output_stride = 0;
+  _input_capacity = 0;
+  _output_capacity = 0;
+  _is_allocated = false;
+  if (input_size != 0 && batch_size != 0) {
+    Set(input_size, batch_size);
+  }
+}
+
+template<class Precision>
+void BasicBatchFFTManager<Precision>::Set(unsigned input_size, unsigned batch_size) {
+  if (_is_allocated && input_size == _input_size && batch_size == _batch_size) return;
+  _input_size = input_size;
+  _batch_size = batch_size;
+  // output size of a 1d real FFT
+  _output_size = input_size/2 + 1;
+  // pad each input and output to 64 bytes, so they are all aligned the same
+  _input_stride = PaddedInputSize(input_size);
+  _output_stride = BasicSpectra<Precision>::PaddedBins(_output_size);
+  Alloc();
+}
+
+template<class Precision>
+void BasicBatchFFTManager<Precision>::Alloc() {
+  size_t input_size = (size_t)_input_stride * _batch_size;
+  size_t output_size = (size_t)_output_stride * _batch_size;
+  if (!_is_allocated || input_size > _input_capacity || output_size > _output_capacity) {
+    DeAlloc();
+    _input_array = Precision::AllocReal(input_size);
+    _output_array = Precision::AllocComplex(output_size);
+    // partial batches leave some of the input unset
+    memset(_input_array, 0, input_size * sizeof(Real));
+    _input_capacity = input_size;
+    _output_capacity = output_size;
+  }
+  _plan = Precision::CachedPlan(_input_size, _batch_size);
+  _is_allocated = true;
+}
+
+template<class Precision>
+void BasicBatchFFTManager<Precision>::DeAlloc() {
+  // the plan belongs to the FFTPlanCache
+  if (_is_allocated) {
+    Precision::Free(_input_array);
+    Precision::Free(_output_array);
+  }
+  _input_capacity = 0;
+  _output_capacity = 0;
+  _is_allocated = false;
+}
+
+template<class Precision>
+typename Precision::Real *BasicBatchFFTManager<Precision>::Input(unsigned k) {
+  assert(_is_allocated);
+  assert(k < _batch_size);
+  return _input_array + (size_t)k * _input_stride;
+}
+
+template<class Precision>
+void BasicBatchFFTManager<Precision>::Execute() {
+  Precision::Execute(_plan, _input_array, _output_array);
+}
+
+template<class Precision>
+void BasicBatchFFTManager<Precision>::Execute(Complex *out) {
+  // new-array execute: out has the same alignment and layout as _output_array
+  Precision::Execute(_plan, _input_array, out);
+}
+
+template<class Precision>
+const typename Precision::Complex *BasicBatchFFTManager<Precision>::Output(unsigned k) {
+  assert(_is_allocated);
+  assert(k < _batch_size);
+  return _output_array + (size_t)k * _output_stride;
+}
+
+template<class Precision>
+BasicBatchFFTManager<Precision>::~BasicBatchFFTManager() {
   DeAlloc();
 }
 
+// transform the filled inputs of a batch, which belong to spectra[spectrum_inds[k]]
+template<class Precision>
+static void executeBatch(BasicBatchFFTManager<Precision> &batch, const std::vector<unsigned> &spectrum_inds, BasicSpectra<Precision> &spectra) {
+  unsigned n_bins = batch.OutputSize();
+  assert(n_bins <= spectra.MaxBins());
+  // indices are increasing, so a full batch spanning BatchSize() indices is a run
+  bool direct = spectrum_inds.size() == batch.BatchSize() 
+    && spectrum_inds.back() - spectrum_inds.front() == spectrum_inds.size() - 1
+    && spectra.Stride() == batch.OutputStride();
+  if (direct) {
+    batch.Execute(spectra.Data(spectrum_inds.front()));
+  }
+  else {
+    batch.Execute();
+    for (unsigned k = 0; k < spectrum_inds.size(); k++) {
+      memcpy(spectra.Data(spectrum_inds[k]), batch.Output(k), n_bins * sizeof(typename Precision::Complex));
+    }
+  }
+  for (unsigned ind: spectrum_inds) {
+    spectra.SetNBins(ind, n_bins);
+  }
+}
 
+template<class Precision>
+void CalculateSpectra(const std::vector<const std::vector<int16_t> *> &waveforms, unsigned first, unsigned last,
+    BasicBatchFFTManager<Precision> &batch, BasicFFTManager<Precision> &single, BasicSpectra<Precision> &spectra) {
+  std::vector<unsigned> spectrum_inds;
+  spectrum_inds.reserve(batch.BatchSize());
+  for (unsigned i = first; i < last; i++) {
+    const std::vector<int16_t> *waveform = waveforms[i];
+    if (waveform == NULL || waveform->size() == 0) continue;
+    size_t n_adc = waveform->size();
+    if (batch.BatchSize() > 0 && n_adc == batch.InputSize()) {
+      ConvertADCs(waveform->data(), n_adc, batch.Input(spectrum_inds.size()));
+      spectrum_inds.push_back(i);
+      if (spectrum_inds.size() == batch.BatchSize()) {
+        executeBatch(batch, spectrum_inds, spectra);
+        spectrum_inds.clear();
+      }
+    }
+    // odd sized waveforms
+    else {
+      if (single.InputSize() != n_adc) {
+        single.Set(n_adc);
+      }
+      ConvertADCs(waveform->data(), n_adc, single.InputAt(0));
+      single.Execute();
+      unsigned n_bins = single.OutputSize();
+      assert(n_bins <= spectra.MaxBins());
+      typename Precision::Complex *out = spectra.Data(i);
+      for (unsigned bin = 0; bin < n_bins; bin++) {
+        out[bin][0] = single.ReOutputAt(bin);
+        out[bin][1] = single.ImOutputAt(bin);
+      }
+      spectra.SetNBins(i, n_bins);
+    }
+  }
+  if (spectrum_inds.size() != 0) {
+    executeBatch(batch, spectrum_inds, spectra);
+  }
+}
 
+// the two precisions
+template class BasicFFTManager<FFTDouble>;
+template class BasicFFTManager<FFTFloat>;
+template class BasicSpectra<FFTDouble>;
+template class BasicSpectra<FFTFloat>;
+template class BasicBatchFFTManager<FFTDouble>;
+template class BasicBatchFFTManager<FFTFloat>;
+template void CalculateSpectra<FFTDouble>(const std::vector<const std::vector<int16_t> *> &, unsigned, unsigned,
+  BatchFFTManager &, FFTManager &, Spectra &);
+template void CalculateSpectra<FFTFloat>(const std::vector<const std::vector<int16_t> *> &, unsigned, unsigned,
+  FloatBatchFFTManager &, FloatFFTManager &, FloatSpectra &);
@@ -1,34 +1,128 @@
 #ifndef _sbnddaq_analysis_FFT
 #define _sbnddaq_analysis_FFT
 #include <vector>
+#include <map>
+#include <string>
+#include <cstdint>
+#include <cstddef>
 
 #include "fftw3.h"
 
+// Process-wide cache of FFTW plans, keyed by input size, batch size and
+// precision. Each shape is planned (and measured) once, however many
+// managers use it and however often they switch between sizes.
+//
+// The plans are made on scratch arrays, so they must only be run with
+// the new-array execute functions (e.g. fftw_execute_dft_r2c()), on
+// arrays laid out like the ones in BatchFFTManager. Any number of threads
+// can run the same plan at once.
+//
+// Measured plans can be saved to and loaded from a file of FFTW wisdom,
+// so that a new process doesn't have to measure them again.
+class FFTPlanCache {
+public:
+  static FFTPlanCache &Instance();
+
+  // r2c plan for batch_size transforms of input_size values each
+  fftw_plan Plan(unsigned input_size, unsigned batch_size);
+  // the same in single precision
+  fftwf_plan FloatPlan(unsigned input_size, unsigned batch_size);
+
+  // load the wisdom in file_name, which is also where ExportWisdom()
+  // writes. FFTW keeps the single precision wisdom apart, in
+  // file_name + ".float". Returns false if neither file could be read.
+  bool ImportWisdom(const std::string &file_name);
+  // save all of the wisdom so far. Returns false if it couldn't be written
+  bool ExportWisdom();
+  std::string WisdomFile();
+
+  // number of plans made so far (in both precisions)
+  unsigned NPlans();
+  // total time spent making them (ms)
+  float PlanningTime();
+
+  ~FFTPlanCache();
+  FFTPlanCache(FFTPlanCache const &) = delete;
+  FFTPlanCache & operator = (FFTPlanCache const &) = delete;
+
+private:
+  FFTPlanCache(): _planning_time(0) {}
+
+  // (input size, batch size), with one map per precision
+  typedef std::pair<unsigned, unsigned> Key;
+
+  std::map<Key, fftw_plan> _plans;
+  std::map<Key, fftwf_plan> _float_plans;
+  std::string _wisdom_file;
+  float _planning_time;
+};
+
+// FFTW types and functions of each precision, for the templates below
+class FFTDouble {
+public:
+  typedef double Real;
+  typedef fftw_complex Complex;
+  typedef fftw_plan Plan;
+
+  static Real *AllocReal(size_t n) { return fftw_alloc_real(n); }
+  static Complex *AllocComplex(size_t n) { return fftw_alloc_complex(n); }
+  static void Free(void *p) { fftw_free(p); }
+  static void Execute(Plan plan, Real *input, Complex *output) { fftw_execute_dft_r2c(plan, input, output); }
+  static Plan CachedPlan(unsigned input_size, unsigned batch_size) { return FFTPlanCache::Instance().Plan(input_size, batch_size); }
+};
+
+class FFTFloat {
+public:
+  typedef float Real;
+  typedef fftwf_complex Complex;
+  typedef fftwf_plan Plan;
+
+  static Real *AllocReal(size_t n) { return fftwf_alloc_real(n); }
+  static Complex *AllocComplex(size_t n) { return fftwf_alloc_complex(n); }
+  static void Free(void *p) { fftwf_free(p); }
+  static void Execute(Plan plan, Real *input, Complex *output) { fftwf_execute_dft_r2c(plan, input, output); }
+  static Plan CachedPlan(unsigned input_size, unsigned batch_size) { return FFTPlanCache::Instance().FloatPlan(input_size, batch_size); }
+};
+
+// convert n ADC's to FFT input (with SSE2 when available)
+void ConvertADCs(const int16_t *adcs, size_t n, double *output);
+void ConvertADCs(const int16_t *adcs, size_t n, float *output);
+
 // Computes the Discrete Fourier Transform of the _real_ input data.
 // Output has a size 2 *(n/2 + 1) where n is the size of the input data.
-// Returned array must be free'd with fftw_free
-class FFTManager {
+// Plans come from the FFTPlanCache, and the arrays are only re-allocated
+// when they need to grow, so changing the size is cheap.
+//
+// Comes in double (FFTManager) and single (FloatFFTManager) precision.
+template<class Precision>
+class BasicFFTManager {
 public:
+  typedef typename Precision::Real Real;
+
   // Make a new FFT manager and allocate a setup for an input array of size input_size
-  explicit FFTManager(unsigned input_size);
+  explicit BasicFFTManager(unsigned input_size);
   // Make a new FFT manager and don't allocate
-  FFTManager() {}
+  BasicFFTManager(): _input_size(0), _output_size(0), _capacity(0), _is_allocated(false) {}
   // allocate a setup for an input array of size input_size (NOTE: is idempotent)
   void Set(unsigned input_size);
   // execute the FFT
   void Execute();
   // get a member of the input array
-  double *InputAt(const int index);
+  Real *InputAt(const int index);
   // get a member of the output array
-  double ReOutputAt(const int index);
-  double ImOutputAt(const int index);
-  double AbsOutputAt(const int index);
-  
+  Real ReOutputAt(const int index);
+  Real ImOutputAt(const int index);
+  Real AbsOutputAt(const int index);
+
   // input/output sizes
   unsigned InputSize() {return _input_size;}
   unsigned OutputSize() {return _output_size;}
 
-  ~FFTManager();
+  ~BasicFFTManager();
+
+  // FFT managers own their arrays and should not be copied
+  BasicFFTManager(BasicFFTManager const &) = delete;
+  BasicFFTManager & operator = (BasicFFTManager const &) = delete;
 
 protected:
   // Internal functions
@@ -37,10 +131,142 @@ protected:
 
   unsigned _input_size;
   unsigned _output_size;
+  // input size the arrays are allocated for
+  unsigned _capacity;
   bool _is_allocated;
-  fftw_complex *_output_array;
-  double *_input_array;
-  fftw_plan _plan;
+  typename Precision::Complex *_output_array;
+  Real *_input_array;
+  typename Precision::Plan _plan;
 };
 
+typedef BasicFFTManager<FFTDouble> FFTManager;
+typedef BasicFFTManager<FFTFloat> FloatFFTManager;
+
+// Storage for the spectra of many waveforms (e.g. one per channel), one
+// after another in one SIMD aligned buffer. Each spectrum has room for
+// up to MaxBins() complex bins and starts Stride() bins after the last
+// one, so that batches of them can be written straight from FFTW.
+template<class Precision>
+class BasicSpectra {
+public:
+  typedef typename Precision::Real Real;
+  typedef typename Precision::Complex Complex;
+
+  BasicSpectra(): _max_bins(0), _stride(0), _capacity(0), _data(NULL) {}
+  BasicSpectra(const BasicSpectra &other);
+  BasicSpectra &operator=(const BasicSpectra &other);
+  ~BasicSpectra();
+
+  // make room for n_spectra spectra of up to max_bins bins. Clears all
+  // of the spectra. Keeps the storage if it is already big enough.
+  void Resize(unsigned n_spectra, unsigned max_bins);
+  unsigned Size() const { return _n_bins.size(); }
+  unsigned MaxBins() const { return _max_bins; }
+  unsigned Stride() const { return _stride; }
+
+  // number of bins of spectrum i (0 if it isn't filled)
+  unsigned NBins(unsigned i) const { return _n_bins[i]; }
+  void SetNBins(unsigned i, unsigned n_bins) { _n_bins[i] = n_bins; }
+  void Clear(unsigned i) { _n_bins[i] = 0; }
+
+  Complex *Data(unsigned i) { return _data + (size_t)i * _stride; }
+  const Complex *Data(unsigned i) const { return _data + (size_t)i * _stride; }
+  Real Re(unsigned i, unsigned bin) const { return Data(i)[bin][0]; }
+  Real Im(unsigned i, unsigned bin) const { return Data(i)[bin][1]; }
+  Real Abs(unsigned i, unsigned bin) const { return Re(i, bin) * Re(i, bin) + Im(i, bin) * Im(i, bin); }
+
+  // bins between spectra of up to n_bins bins (keeps each one 64 byte aligned)
+  static unsigned PaddedBins(unsigned n_bins) {
+    const unsigned align = 64 / sizeof(Complex);
+    return (n_bins + align - 1) & ~(align - 1);
+  }
+
+protected:
+  unsigned _max_bins;
+  unsigned _stride;
+  std::vector<unsigned> _n_bins;
+  // allocated size of _data, in bins
+  size_t _capacity;
+  Complex *_data;
+};
+
+typedef BasicSpectra<FFTDouble> Spectra;
+typedef BasicSpectra<FFTFloat> FloatSpectra;
+
+// Computes the same FFT's as FFTManager, but for a batch of BatchSize()
+// inputs of the same size at once, using one FFTW plan made by
+// fftw_plan_many_dft_r2c. Each input and output is SIMD aligned, so the
+// outputs can be written directly into a Spectra.
+template<class Precision>
+class BasicBatchFFTManager {
+public:
+  typedef typename Precision::Real Real;
+  typedef typename Precision::Complex Complex;
+
+  BasicBatchFFTManager(unsigned input_size, unsigned batch_size);
+  // Make a new manager and don't allocate
+  BasicBatchFFTManager():
+    _input_size(0), _output_size(0), _batch_size(0), _input_stride(0), _output_stride(0),
+    _input_capacity(0), _output_capacity(0), _is_allocated(false) {}
+  // allocate a setup for batch_size inputs of size input_size (NOTE: is idempotent)
+  void Set(unsigned input_size, unsigned batch_size);
+  // the input_size values of the k-th input
+  Real *Input(unsigned k);
+  // FFT all of the inputs into the internal output
+  void Execute();
+  // FFT all of the inputs into BatchSize() spectra starting at out, which
+  // have to be laid out like the ones in a Spectra with
+  // Spectra::Stride() == OutputStride()
+  void Execute(Complex *out);
+  // the output_size bins of the k-th output (after Execute())
+  const Complex *Output(unsigned k);
+
+  unsigned InputSize() const { return _input_size; }
+  unsigned OutputSize() const { return _output_size; }
+  unsigned BatchSize() const { return _batch_size; }
+  unsigned OutputStride() const { return _output_stride; }
+
+  // values between inputs of size input_size (keeps each one 64 byte aligned)
+  static unsigned PaddedInputSize(unsigned input_size) {
+    const unsigned align = 64 / sizeof(Real);
+    return (input_size + align - 1) & ~(align - 1);
+  }
+
+  ~BasicBatchFFTManager();
+
+  // Batch managers own their arrays and should not be copied
+  BasicBatchFFTManager(BasicBatchFFTManager const &) = delete;
+  BasicBatchFFTManager & operator = (BasicBatchFFTManager const &) = delete;
+
+protected:
+  void Alloc();
+  void DeAlloc();
+
+  unsigned _input_size;
+  unsigned _output_size;
+  unsigned _batch_size;
+  unsigned _input_stride;
+  unsigned _output_stride;
+  // allocated sizes of the arrays
+  size_t _input_capacity;
+  size_t _output_capacity;
+  bool _is_allocated;
+  Real *_input_array;
+  Complex *_output_array;
+  typename Precision::Plan _plan;
+};
+
+typedef BasicBatchFFTManager<FFTDouble> BatchFFTManager;
+typedef BasicBatchFFTManager<FFTFloat> FloatBatchFFTManager;
+
+// Fill spectra[i] with the FFT of waveforms[i] for first <= i < last.
+// NULL or empty waveforms are skipped (and their spectra are left
+// alone). Waveforms with batch.InputSize() ADC's are transformed
+// batch.BatchSize() at a time, directly into the spectra when a batch
+// is a run of consecutive indices. Any others are done one at a time
+// with single, and have to fit into spectra.MaxBins().
+template<class Precision>
+void CalculateSpectra(const std::vector<const std::vector<int16_t> *> &waveforms, unsigned first, unsigned last,
+  BasicBatchFFTManager<Precision> &batch, BasicFFTManager<Precision> &single, BasicSpectra<Precision> &spectra);
+
 #endif
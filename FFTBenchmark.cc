@@ -0,0 +1,106 @@
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "FFT.hh"
+
+/*
+ * Compares the per-channel FFT's in single precision (fft_float) with the
+ * ones in double precision on random waveforms with 12 bit ADC's
+ * (a baseline, gaussian noise and a few pulses).
+ *
+ * Usage: FFTBenchmark [n_channels] [n_ticks] [n_events] [batch_size]
+ *
+ * Reports the error of the single precision spectra, relative to the
+ * largest bin of each channel and bin by bin in the power (|X|^2) of the
+ * bins with at least 1e-6 of the peak power, along with the time per
+ * event and the size of the spectra of each precision.
+*/
+
+template<class Precision>
+static float timeSpectra(const std::vector<const std::vector<int16_t> *> &waveforms, unsigned n_ticks, unsigned batch_size,
+    unsigned n_events, BasicSpectra<Precision> &spectra) {
+  BasicBatchFFTManager<Precision> batch(n_ticks, batch_size);
+  BasicFFTManager<Precision> single;
+  // once to plan and touch all of the memory
+  spectra.Resize(waveforms.size(), n_ticks/2 + 1);
+  CalculateSpectra(waveforms, 0, waveforms.size(), batch, single, spectra);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (unsigned event = 0; event < n_events; event++) {
+    spectra.Resize(waveforms.size(), n_ticks/2 + 1);
+    CalculateSpectra(waveforms, 0, waveforms.size(), batch, single, spectra);
+  }
+  auto end = std::chrono::high_resolution_clock::now();
+  return std::chrono::duration<float, std::milli>(end - start).count() / n_events;
+}
+
+int main(int argc, char **argv) {
+  unsigned n_channels = argc > 1 ? atoi(argv[1]) : 1024;
+  unsigned n_ticks = argc > 2 ? atoi(argv[2]) : 3200;
+  unsigned n_events = argc > 3 ? atoi(argv[3]) : 20;
+  unsigned batch_size = argc > 4 ? atoi(argv[4]) : 64;
+
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0., 3.);
+  std::uniform_int_distribution<unsigned> baseline(400, 2100);
+  std::uniform_int_distribution<unsigned> tick(0, n_ticks - 1);
+  std::vector<std::vector<int16_t>> adcs(n_channels);
+  std::vector<const std::vector<int16_t> *> waveforms(n_channels);
+  for (unsigned i = 0; i < n_channels; i++) {
+    int channel_baseline = baseline(rng);
+    adcs[i].resize(n_ticks);
+    for (unsigned j = 0; j < n_ticks; j++) {
+      adcs[i][j] = channel_baseline + (int16_t)std::round(noise(rng));
+    }
+    for (unsigned pulse = 0; pulse < 3; pulse++) {
+      unsigned start = tick(rng);
+      for (unsigned j = start; j < std::min(n_ticks, start + 20); j++) {
+        adcs[i][j] = std::min(4095, adcs[i][j] + 200);
+      }
+    }
+    waveforms[i] = &adcs[i];
+  }
+
+  Spectra spectra;
+  FloatSpectra float_spectra;
+  float double_time = timeSpectra(waveforms, n_ticks, batch_size, n_events, spectra);
+  float float_time = timeSpectra(waveforms, n_ticks, batch_size, n_events, float_spectra);
+
+  // worst error over all channels
+  double max_peak_error = 0.;
+  double max_power_error = 0.;
+  double sum_power_error = 0.;
+  unsigned long n_power_bins = 0;
+  for (unsigned i = 0; i < n_channels; i++) {
+    double peak_power = 0.;
+    for (unsigned bin = 0; bin < spectra.NBins(i); bin++) {
+      peak_power = std::max(peak_power, spectra.Abs(i, bin));
+    }
+    double peak = std::sqrt(peak_power);
+    for (unsigned bin = 0; bin < spectra.NBins(i); bin++) {
+      double re_error = float_spectra.Re(i, bin) - spectra.Re(i, bin);
+      double im_error = float_spectra.Im(i, bin) - spectra.Im(i, bin);
+      max_peak_error = std::max(max_peak_error, std::sqrt(re_error * re_error + im_error * im_error) / peak);
+      double power = spectra.Abs(i, bin);
+      if (power < 1e-6 * peak_power) continue;
+      double power_error = std::fabs((double)float_spectra.Abs(i, bin) - power) / power;
+      max_power_error = std::max(max_power_error, power_error);
+      sum_power_error += power_error;
+      n_power_bins ++;
+    }
+  }
+
+  size_t double_size = (size_t)spectra.Size() * spectra.Stride() * sizeof(Spectra::Complex);
+  size_t float_size = (size_t)float_spectra.Size() * float_spectra.Stride() * sizeof(FloatSpectra::Complex);
+  std::cout << "INPUT        : " << n_channels << " channels of " << n_ticks << " ticks" << std::endl;
+  std::cout << "DOUBLE       : " << double_time << " ms/event " << double_size / (1024. * 1024.) << " MB" << std::endl;
+  std::cout << "FLOAT        : " << float_time << " ms/event " << float_size / (1024. * 1024.) << " MB" << std::endl;
+  std::cout << "PEAK ERROR   : " << max_peak_error << " (max |float - double| / max |double|)" << std::endl;
+  std::cout << "POWER ERROR  : " << max_power_error << " max " << sum_power_error / std::max(n_power_bins, 1ul) << " mean (relative)" << std::endl;
+  return 0;
+}
@@ -1,54 +1,204 @@
 #include <vector>
 #include <array>
+#include <algorithm>
+#include <cstdint>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "Mode.hh"
 
 // Calculate the mode to find a baseline of the passed in waveform.
 // Mode finding algorithm from: http://erikdemaine.org/papers/NetworkStats_ESA2002/paper.pdf (Algorithm FREQUENT)
-int16_t Mode(const std::vector<int16_t> &adcs, unsigned n_skip_samples) {
-  // 10 counters seem good
-  std::array<unsigned, 10> counters {}; // zero-initialize
-  std::array<int16_t, 10> modes {};
-
+int16_t Mode(daqAnalysis::WaveformView adcs, unsigned n_skip_samples) {
+  ModeFinder finder;
   for (unsigned adc_ind = 0; adc_ind < adcs.size(); adc_ind += n_skip_samples) {
-    int16_t val = adcs[adc_ind];
+    finder.AddValue(adcs[adc_ind]);
+  }
+  return finder.Mode();
+}
 
-    int home = -1;
-    // look for a home for the val
-    for (size_t i = 0; i < modes.size(); i ++) {
-      if (modes[i] == val) {
-        home = (int)i; 
-        break;
-      }
+void ModeFinder::AddValue(int16_t val) {
+  int home = -1;
+  // look for a home for the val
+  for (size_t i = 0; i < _modes.size(); i ++) {
+    if (_modes[i] == val) {
+      home = (int)i; 
+      break;
     }
-    // invade a home if you don't have one
-    if (home < 0) {
-      for (int i = 0; i < (int)modes.size(); i++) {
-        if (counters[i] == 0) {
-          home = i;
-          modes[i] = val;
-          break;
-        }
+  }
+  // invade a home if you don't have one
+  if (home < 0) {
+    for (int i = 0; i < (int)_modes.size(); i++) {
+      if (_counters[i] == 0) {
+        home = i;
+        _modes[i] = val;
+        break;
       }
     }
-    // incl if home
-    if (home >= 0) counters[home] ++;
-    // decl if no home
-    else {
-      for (int i = 0; i < (int)counters.size(); i++) {
-        counters[i] = (counters[i]==0) ? 0 : counters[i] - 1;
-      }
+  }
+  // incl if home
+  if (home >= 0) _counters[home] ++;
+  // decl if no home
+  else {
+    for (int i = 0; i < (int)_counters.size(); i++) {
+      _counters[i] = (_counters[i]==0) ? 0 : _counters[i] - 1;
     }
   }
+}
+
+int16_t ModeFinder::Mode() const {
   // highest counter has the mode
   unsigned max_counters = 0;
   short ret = 0;
-  for (int i = 0; i < (int)counters.size(); i++) {
-    if (counters[i] > max_counters) {
-      max_counters = counters[i];
-      ret = modes[i];
+  for (int i = 0; i < (int)_counters.size(); i++) {
+    if (_counters[i] > max_counters) {
+      max_counters = _counters[i];
+      ret = _modes[i];
+    }
+  }
+  return ret;
+}
+
+// widest range of values counted with the small histograms in ExactMode()
+static const unsigned kMaxWindow = 4096;
+// number of histograms filled in turn in ExactMode(). Consecutive samples
+// are often the same value, and this way the increment of one doesn't have
+// to wait on the store of the last
+static const unsigned kNHistograms = 4;
+
+// smallest and largest value in the waveform
+static void MinMax(daqAnalysis::WaveformView adcs, int16_t &min, int16_t &max) {
+  min = INT16_MAX;
+  max = INT16_MIN;
+  size_t i = 0;
+#ifdef __SSE2__
+  if (adcs.size() >= 8) {
+    __m128i vmin = _mm_set1_epi16(INT16_MAX);
+    __m128i vmax = _mm_set1_epi16(INT16_MIN);
+    for (; i + 8 <= adcs.size(); i += 8) {
+      __m128i vals = _mm_loadu_si128((const __m128i *)(adcs.data() + i));
+      vmin = _mm_min_epi16(vmin, vals);
+      vmax = _mm_max_epi16(vmax, vals);
+    }
+    int16_t mins[8], maxs[8];
+    _mm_storeu_si128((__m128i *)mins, vmin);
+    _mm_storeu_si128((__m128i *)maxs, vmax);
+    for (unsigned lane = 0; lane < 8; lane++) {
+      if (mins[lane] < min) min = mins[lane];
+      if (maxs[lane] > max) max = maxs[lane];
+    }
+  }
+#endif
+  for (; i < adcs.size(); i++) {
+    if (adcs[i] < min) min = adcs[i];
+    if (adcs[i] > max) max = adcs[i];
+  }
+}
+
+// lowest index of the highest count
+template<typename Count>
+static unsigned MaxBin(const Count *histogram, unsigned n_bins) {
+  unsigned ret = 0;
+  Count max_count = 0;
+  for (unsigned i = 0; i < n_bins; i++) {
+    if (histogram[i] > max_count) {
+      max_count = histogram[i];
+      ret = i;
     }
   }
   return ret;
 }
 
+int16_t ExactMode(daqAnalysis::WaveformView adcs, unsigned n_skip_samples) {
+  if (adcs.size() == 0) return 0;
+  if (n_skip_samples == 0) n_skip_samples = 1;
+
+  // only count over the values that are there
+  int16_t min, max;
+  MinMax(adcs, min, max);
+  unsigned window = (int)max - (int)min + 1;
+
+  size_t n_values = (adcs.size() + n_skip_samples - 1) / n_skip_samples;
+  // 16 bit counts are enough as long as the merged histogram can't see more
+  // than 2^16 - 1 values (the sub-histograms are added into one at the end)
+  if (window <= kMaxWindow && n_values < UINT16_MAX) {
+    uint16_t histograms[kNHistograms][kMaxWindow];
+    for (unsigned h = 0; h < kNHistograms; h++) {
+      std::fill(histograms[h], histograms[h] + window, 0);
+    }
+
+    const int16_t *data = adcs.data();
+    size_t stride = kNHistograms * n_skip_samples;
+    size_t i = 0;
+    for (; i + (kNHistograms - 1) * n_skip_samples < adcs.size(); i += stride) {
+      histograms[0][data[i] - min] ++;
+      histograms[1][data[i + n_skip_samples] - min] ++;
+      histograms[2][data[i + 2 * n_skip_samples] - min] ++;
+      histograms[3][data[i + 3 * n_skip_samples] - min] ++;
+    }
+    for (; i < adcs.size(); i += n_skip_samples) {
+      histograms[0][data[i] - min] ++;
+    }
+
+    // merge into the first one
+    for (unsigned bin = 0; bin < window; bin++) {
+      histograms[0][bin] += histograms[1][bin] + histograms[2][bin] + histograms[3][bin];
+    }
+    return min + MaxBin(histograms[0], window);
+  }
+
+  // very wide or very long waveforms
+  std::vector<unsigned> histogram(window, 0);
+  for (size_t i = 0; i < adcs.size(); i += n_skip_samples) {
+    histogram[adcs[i] - min] ++;
+  }
+  return min + MaxBin(histogram.data(), window);
+}
+
+void ExactModeFinder::Reset(unsigned n_skip_samples) {
+  if (_min_bin <= _max_bin) {
+    std::fill(_histogram.begin() + _min_bin, _histogram.begin() + _max_bin + 1, 0);
+  }
+  _min_bin = kNBins;
+  _max_bin = -1;
+  _out_of_range.clear();
+  _n_skip_samples = n_skip_samples;
+  _n_until_next = 0;
+}
+
+int16_t ExactModeFinder::Mode() const {
+  unsigned max_count = 0;
+  int16_t ret = 0;
+  // values below the histogram come first (ties go to the lowest value)
+  std::vector<int16_t> sorted(_out_of_range);
+  std::sort(sorted.begin(), sorted.end());
+  size_t i = 0;
+  for (; i < sorted.size() && sorted[i] < 0; ) {
+    size_t j = i;
+    while (j < sorted.size() && sorted[j] == sorted[i]) j++;
+    if (j - i > max_count) {
+      max_count = j - i;
+      ret = sorted[i];
+    }
+    i = j;
+  }
+  if (_min_bin <= _max_bin) {
+    unsigned bin = _min_bin + MaxBin(_histogram.data() + _min_bin, _max_bin - _min_bin + 1);
+    if (_histogram[bin] > max_count) {
+      max_count = _histogram[bin];
+      ret = bin;
+    }
+  }
+  for (; i < sorted.size(); ) {
+    size_t j = i;
+    while (j < sorted.size() && sorted[j] == sorted[i]) j++;
+    if (j - i > max_count) {
+      max_count = j - i;
+      ret = sorted[i];
+    }
+    i = j;
+  }
+  return ret;
+}
@@ -3,8 +3,9 @@
 
 #include <vector>
 #include <array>
+#include <cstdint>
 
-#include "Mode.hh"
+#include "WaveformView.hh"
 
 // Calculate the mode to find a baseline of the passed in waveform.
 // Mode finding algorithm from: http://erikdemaine.org/papers/NetworkStats_ESA2002/paper.pdf (Algorithm FREQUENT)
@@ -15,6 +16,87 @@
 // M ̈ohring and Rajeev Raman, editors, Algorithms — ESA 2002, pages
 // 348–360, Berlin, Heidelberg, 2002. Springer Berlin Heidelberg.
 
-int16_t Mode(const std::vector<int16_t> &adcs, unsigned n_skip_samples=1);
+int16_t Mode(daqAnalysis::WaveformView adcs, unsigned n_skip_samples=1);
+
+// Streaming version of Mode(): ADC values are passed in one at a time, so
+// that the mode can be found in the same loop as other per-waveform
+// quantities. Gives the same result as Mode() on the same values.
+class ModeFinder {
+public:
+  explicit ModeFinder(unsigned n_skip_samples=1):
+    _counters{}, _modes{}, _n_skip_samples(n_skip_samples), _n_until_next(0) {}
+
+  // pass in the next adc value (only every n_skip_samples-th is used)
+  inline void Add(int16_t val) {
+    if (_n_until_next == 0) {
+      AddValue(val);
+      _n_until_next = _n_skip_samples;
+    }
+    _n_until_next --;
+  }
+  // pass in an adc value that is always used
+  void AddValue(int16_t val);
+  // current estimate of the mode
+  int16_t Mode() const;
+
+private:
+  // 10 counters seem good
+  std::array<unsigned, 10> _counters;
+  std::array<int16_t, 10> _modes;
+  unsigned _n_skip_samples;
+  unsigned _n_until_next;
+};
+
+// Exact mode: the most common value (the lowest one if there is a tie)
+// among every n_skip_samples-th ADC. Counts values in a histogram over the
+// range between the smallest and largest ADC, so it is fastest for 12 bit
+// data, but works for any values.
+int16_t ExactMode(daqAnalysis::WaveformView adcs, unsigned n_skip_samples=1);
+
+// Streaming version of ExactMode(), with the same interface as ModeFinder.
+// Gives the same result as ExactMode() on the same values.
+//
+// The histogram is 16 KB, so keep one finder around and Reset() it for each
+// waveform instead of making a new one: only the bins that were filled get
+// cleared.
+class ExactModeFinder {
+public:
+  explicit ExactModeFinder(unsigned n_skip_samples=1):
+    _min_bin(kNBins), _max_bin(-1), _n_skip_samples(n_skip_samples), _n_until_next(0) {}
+
+  // start over on a new waveform (keeps the memory)
+  void Reset(unsigned n_skip_samples=1);
+
+  inline void Add(int16_t val) {
+    if (_n_until_next == 0) {
+      AddValue(val);
+      _n_until_next = _n_skip_samples;
+    }
+    _n_until_next --;
+  }
+  inline void AddValue(int16_t val) {
+    if (val >= 0 && val < kNBins) {
+      // only allocate once there's something to count
+      if (_histogram.empty()) _histogram.resize(kNBins, 0);
+      _histogram[val] ++;
+      if (val < _min_bin) _min_bin = val;
+      if (val > _max_bin) _max_bin = val;
+    }
+    else _out_of_range.push_back(val);
+  }
+  int16_t Mode() const;
+
+private:
+  // 12 bit ADC's
+  static const int kNBins = 4096;
+  std::vector<unsigned> _histogram;
+  // range of bins that have been filled since the last Reset()
+  int _min_bin;
+  int _max_bin;
+  // anything else is sorted at the end
+  std::vector<int16_t> _out_of_range;
+  unsigned _n_skip_samples;
+  unsigned _n_until_next;
+};
 
 #endif
@@ -0,0 +1,97 @@
+#include <vector>
+#include <map>
+#include <random>
+#include <iostream>
+#include <string>
+#include <cmath>
+
+#include "WaveformView.hh"
+#include "Mode.hh"
+
+/*
+ * Checks that ExactMode() and ExactModeFinder give the most common value
+ * (the lowest one if there is a tie), counted directly.
+ *
+ * Usage: ModeCheck
+ *
+ * Covers 12 bit waveforms with and without skipped samples, values outside
+ * of 12 bits and waveforms longer than 2^16 - 1 samples, where the counts
+ * don't fit in 16 bits. One ExactModeFinder is also Reset() and reused
+ * across all the checks, as in Analysis. Returns 1 if any check fails.
+*/
+
+using namespace daqAnalysis;
+
+// most common value of every n_skip_samples-th ADC, counted in a map
+static int16_t countedMode(const std::vector<int16_t> &adcs, unsigned n_skip_samples) {
+  std::map<int16_t, unsigned> counts;
+  for (size_t i = 0; i < adcs.size(); i += n_skip_samples) {
+    counts[adcs[i]] ++;
+  }
+  int16_t ret = 0;
+  unsigned max_count = 0;
+  for (auto const &count: counts) {
+    if (count.second > max_count) {
+      max_count = count.second;
+      ret = count.first;
+    }
+  }
+  return ret;
+}
+
+// reused between checks
+static ExactModeFinder reused_finder;
+
+static bool check(const std::string &name, const std::vector<int16_t> &adcs, unsigned n_skip_samples=1) {
+  int16_t expected = countedMode(adcs, n_skip_samples);
+  int16_t exact = ExactMode(adcs, n_skip_samples);
+  ExactModeFinder finder(n_skip_samples);
+  for (int16_t val: adcs) finder.Add(val);
+  int16_t streamed = finder.Mode();
+  reused_finder.Reset(n_skip_samples);
+  for (int16_t val: adcs) reused_finder.Add(val);
+  int16_t reused = reused_finder.Mode();
+
+  bool pass = exact == expected && streamed == expected && reused == expected;
+  std::cout << name << " : ExactMode " << exact << " ExactModeFinder " << streamed
+            << " reused " << reused << " expected " << expected << (pass ? "" : " FAIL") << std::endl;
+  return pass;
+}
+
+int main() {
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0., 3.);
+  bool pass = true;
+
+  // noise on a baseline
+  std::vector<int16_t> adcs(3200);
+  for (auto &adc: adcs) adc = 2000 + (int16_t)std::round(noise(rng));
+  pass = check("NOISE        ", adcs) && pass;
+  pass = check("NOISE SKIP 3 ", adcs, 3) && pass;
+
+  // a tie goes to the lowest value
+  std::vector<int16_t> tie(100, 7);
+  tie.insert(tie.end(), 100, 5);
+  pass = check("TIE          ", tie) && pass;
+
+  // wider than 12 bits
+  std::vector<int16_t> wide(adcs);
+  wide[0] = -20000;
+  wide[1] = 20000;
+  pass = check("WIDE         ", wide) && pass;
+
+  // more samples of one value than a 16 bit count can hold, followed by
+  // fewer of another
+  std::vector<int16_t> many(66000, 2000);
+  many.insert(many.end(), 10000, 2001);
+  pass = check("LONG         ", many) && pass;
+  pass = check("LONG SKIP 2  ", many, 2) && pass;
+
+  // the longest waveform that is still counted in 16 bits
+  std::vector<int16_t> edge(UINT16_MAX - 2, 100);
+  edge.insert(edge.end(), 1, 101);
+  pass = check("EDGE         ", edge) && pass;
+
+  std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
@@ -4,10 +4,78 @@
 #include <math.h> 
 #include <stdlib.h>
 #include <iostream>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "Noise.hh"
+#include "NoiseMask.hh"
+
+// sum of (a[i] - a_offset) * (b[i] - b_offset) for i in [0, n), accumulated in 64 bits.
+// Differences must fit in 16 bits (true for 12 bit ADC's)
+static int64_t DotProduct(const int16_t *a, int16_t a_offset, const int16_t *b, int16_t b_offset, unsigned n) {
+  int64_t ret = 0;
+  unsigned i = 0;
+#ifdef __SSE2__
+  __m128i a_off = _mm_set1_epi16(a_offset);
+  __m128i b_off = _mm_set1_epi16(b_offset);
+  __m128i total = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i da = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(a + i)), a_off);
+    __m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(b + i)), b_off);
+    __m128i prod = _mm_madd_epi16(da, db);
+    // sign extend the four 32 bit sums to 64 bits before adding them up
+    __m128i sign = _mm_srai_epi32(prod, 31);
+    total = _mm_add_epi64(total, _mm_unpacklo_epi32(prod, sign));
+    total = _mm_add_epi64(total, _mm_unpackhi_epi32(prod, sign));
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, total);
+  ret = lanes[0] + lanes[1];
+#endif
+  for (; i < n; i++) {
+    ret += (int64_t)(a[i] - a_offset) * (b[i] - b_offset);
+  }
+  return ret;
+}
+
+// sum of ((a[i] - a_offset) + sign * (b[i] - b_offset))^2 for i in [0, n), accumulated in 64 bits.
+// sign is +1 or -1. Values must fit in 16 bits (true for 12 bit ADC's)
+static int64_t SumSquares(const int16_t *a, int16_t a_offset, const int16_t *b, int16_t b_offset, int sign, unsigned n) {
+  int64_t ret = 0;
+  unsigned i = 0;
+#ifdef __SSE2__
+  __m128i a_off = _mm_set1_epi16(a_offset);
+  __m128i b_off = _mm_set1_epi16(b_offset);
+  __m128i zero = _mm_setzero_si128();
+  __m128i total = _mm_setzero_si128();
+  for (; i + 8 <= n; i += 8) {
+    __m128i da = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(a + i)), a_off);
+    __m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(b + i)), b_off);
+    __m128i val = (sign > 0) ? _mm_add_epi16(da, db) : _mm_sub_epi16(da, db);
+    // squares are positive, so zero extending is enough
+    __m128i sq = _mm_madd_epi16(val, val);
+    total = _mm_add_epi64(total, _mm_unpacklo_epi32(sq, zero));
+    total = _mm_add_epi64(total, _mm_unpackhi_epi32(sq, zero));
+  }
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, total);
+  ret = lanes[0] + lanes[1];
+#endif
+  for (; i < n; i++) {
+    int16_t val = (a[i] - a_offset) + sign * (b[i] - b_offset);
+    ret += (int64_t)val * val;
+  }
+  return ret;
+}
 
-daqAnalysis::NoiseSample::NoiseSample(std::vector<PeakFinder::Peak>& peaks, int16_t baseline, unsigned wvfm_size) {
+daqAnalysis::NoiseSample::NoiseSample(std::vector<PeakFinder::Peak>& peaks, int16_t baseline, unsigned wvfm_size, daqAnalysis::Arena *arena):
+  _ranges(RangeList::allocator_type(arena))
+{
+  // there is at most one more range than there are peaks
+  _ranges.reserve(peaks.size() + 1);
   // we assume here that the vector of peaks are "sorted"
   // that peak[i].start_loose <= peak[i+1].start_loose and
   // that peak[i].end_loose <= peak[i+1].end_loose
@@ -27,21 +95,26 @@ daqAnalysis::NoiseSample::NoiseSample(std::vector<PeakFinder::Peak>& peaks, int1
   _baseline = baseline;
 }
 
-float daqAnalysis::NoiseSample::CalcRMS(const std::vector<int16_t> &wvfm_self, std::vector<std::array<unsigned,2>> &ranges, int16_t baseline) {
+float daqAnalysis::NoiseSample::CalcRMS(daqAnalysis::WaveformView wvfm_self, RangeList &ranges, int16_t baseline) {
   unsigned n_samples = 0;
-  int ret = 0;
+  int64_t ret = 0;
   // iterate over the regions w/out signal
   for (auto &range: ranges) {
     for (unsigned i = range[0]; i <= range[1]; i++) {
       n_samples ++;
-      ret += (wvfm_self[i] - baseline) * (wvfm_self[i] - baseline);
+      ret += (int64_t)(wvfm_self[i] - baseline) * (wvfm_self[i] - baseline);
     }
   }
   return sqrt((float)ret / n_samples);
 }
 
 daqAnalysis::NoiseSample daqAnalysis::NoiseSample::DoIntersection(daqAnalysis::NoiseSample &me, daqAnalysis::NoiseSample &other, int16_t baseline) {
-  std::vector<std::array<unsigned, 2>> ranges;
+  // put the intersection in the same arena as me
+  daqAnalysis::NoiseSample ret;
+  ret._baseline = baseline;
+  RangeList &ranges = ret._ranges;
+  ranges = RangeList(me._ranges.get_allocator());
+  ranges.reserve(me._ranges.size() + other._ranges.size());
   unsigned self_ind = 0;
   unsigned other_ind = 0;
   while (self_ind < me._ranges.size() && other_ind < other._ranges.size()) {
@@ -60,40 +133,37 @@ daqAnalysis::NoiseSample daqAnalysis::NoiseSample::DoIntersection(daqAnalysis::N
 
   }
 
-  return daqAnalysis::NoiseSample(ranges, baseline);
+  return ret;
 }
 
-float daqAnalysis::NoiseSample::Covariance(const std::vector<int16_t> &wvfm_self, daqAnalysis::NoiseSample &other, const std::vector<int16_t> &wvfm_other) {
+float daqAnalysis::NoiseSample::Covariance(daqAnalysis::WaveformView wvfm_self, daqAnalysis::NoiseSample &other, daqAnalysis::WaveformView wvfm_other) {
   daqAnalysis::NoiseSample joint = Intersection(other);
   unsigned n_samples = 0;
-  int ret = 0;
+  int64_t ret = 0;
   // iterate over the regions w/out signal
   for (auto &range: joint._ranges) {
-    for (unsigned i = range[0]; i <= range[1]; i++) {
-      n_samples ++;
-      ret += (wvfm_self[i] - _baseline) * (wvfm_other[i] - other._baseline);
-    }
+    unsigned n = range[1] - range[0] + 1;
+    n_samples += n;
+    ret += DotProduct(wvfm_self.data() + range[0], _baseline, wvfm_other.data() + range[0], other._baseline, n);
   }
   return ((float)ret) / n_samples;
 }
 
-float daqAnalysis::NoiseSample::Correlation(const std::vector<int16_t> &wvfm_self, daqAnalysis::NoiseSample &other, const std::vector<int16_t> &wvfm_other) {
+float daqAnalysis::NoiseSample::Correlation(daqAnalysis::WaveformView wvfm_self, daqAnalysis::NoiseSample &other, daqAnalysis::WaveformView wvfm_other) {
   daqAnalysis::NoiseSample joint = Intersection(other);
   float scaling = CalcRMS(wvfm_self, joint._ranges, _baseline) * CalcRMS(wvfm_other, joint._ranges, other._baseline);
   return Covariance(wvfm_self, other, wvfm_other) / scaling;
 }
 
-float daqAnalysis::NoiseSample::SumRMS(const std::vector<int16_t> &wvfm_self, daqAnalysis::NoiseSample &other, const std::vector<int16_t> &wvfm_other) {
+float daqAnalysis::NoiseSample::SumRMS(daqAnalysis::WaveformView wvfm_self, daqAnalysis::NoiseSample &other, daqAnalysis::WaveformView wvfm_other) {
   daqAnalysis::NoiseSample joint = Intersection(other);
   unsigned n_samples = 0;
-  int ret = 0;
+  int64_t ret = 0;
   // iterate over the regions w/out signal
   for (auto &range: joint._ranges) {
-    for (unsigned i = range[0]; i <= range[1]; i++) {
-      n_samples ++;
-      int16_t val = wvfm_self[i] - _baseline + wvfm_other[i] - other._baseline;
-      ret += val * val;
-    }
+    unsigned n = range[1] - range[0] + 1;
+    n_samples += n;
+    ret += SumSquares(wvfm_self.data() + range[0], _baseline, wvfm_other.data() + range[0], other._baseline, 1, n);
   }
   return sqrt(((float)ret) / n_samples);
 }
@@ -101,29 +171,42 @@ float daqAnalysis::NoiseSample::SumRMS(const std::vector<int16_t> &wvfm_self, da
 float daqAnalysis::NoiseSample::ScaledSumRMS(std::vector<daqAnalysis::NoiseSample *>& noises, std::vector<const std::vector<int16_t> *>& waveforms) {
   // calculate the joint noise sample over all n samples
   // n must be >= 2
-  daqAnalysis::NoiseSample joint = DoIntersection(*noises[0], *noises[1]);
-  for (unsigned i = 2; i < noises.size(); i++) {
-    joint = DoIntersection(joint, *noises[i]);
+  // (as a mask, so that each intersection is just an AND)
+  size_t n_ticks = waveforms[0]->size();
+  for (unsigned i = 1; i < waveforms.size(); i++) {
+    n_ticks = std::min(n_ticks, waveforms[i]->size());
+  }
+  daqAnalysis::NoiseMask joint;
+  daqAnalysis::NoiseMask other;
+  joint.FromRanges(noises[0]->_ranges, n_ticks);
+  for (unsigned i = 1; i < noises.size(); i++) {
+    other.FromRanges(noises[i]->_ranges, n_ticks);
+    joint.Intersect(other);
   }
 
   unsigned n_samples = 0;
-  int ret = 0;
-  // iterate over the regions w/out signal
-  for (auto &range: joint._ranges) {
-    for (unsigned i = range[0]; i <= range[1]; i++) {
+  int64_t ret = 0;
+  // iterate over the ticks w/out signal
+  const std::vector<uint64_t> &words = joint.Words();
+  for (unsigned word = 0; word < words.size(); word++) {
+    uint64_t bits = words[word];
+    while (bits != 0) {
+      unsigned i = word * 64 + __builtin_ctzll(bits);
+      bits &= bits - 1;
       n_samples ++;
       int sample = 0;
       for (unsigned wvfm_ind = 0; wvfm_ind < noises.size(); wvfm_ind++) {
         sample += (*waveforms[wvfm_ind])[i] - noises[wvfm_ind]->_baseline;
       }
-      ret += sample * sample;
+      ret += (int64_t)sample * sample;
     }
   }
   float sum_rms = ((float)ret) / n_samples; 
 
   float rms_all = 0;
   for (unsigned wvfm_ind = 0; wvfm_ind < noises.size(); wvfm_ind++) {
-    rms_all += CalcRMS(*waveforms[wvfm_ind], joint._ranges, noises[wvfm_ind]->_baseline);
+    // same as CalcRMS over the joint ranges
+    rms_all += sqrt((float)joint.SumSquares(*waveforms[wvfm_ind], noises[wvfm_ind]->_baseline) / n_samples);
   }
   // send uncorrelated sum-rms value to 0
   float scale_sub = rms_all * sqrt((float) noises.size());
@@ -133,26 +216,24 @@ float daqAnalysis::NoiseSample::ScaledSumRMS(std::vector<daqAnalysis::NoiseSampl
   return (sum_rms - scale_sub) / scale_div; 
 }
 
-float daqAnalysis::NoiseSample::DNoise(const std::vector<int16_t> &wvfm_self, NoiseSample &other, const std::vector<int16_t> &wvfm_other) {
+float daqAnalysis::NoiseSample::DNoise(daqAnalysis::WaveformView wvfm_self, NoiseSample &other, daqAnalysis::WaveformView wvfm_other) {
   daqAnalysis::NoiseSample joint = Intersection(other);
 
   unsigned n_samples = 0;
-  int noise = 0;
+  int64_t noise = 0;
   // iterate over the regions w/out signal
   for (auto &range: joint._ranges) {
-    for (unsigned i = range[0]; i <= range[1]; i ++) {
-      n_samples ++;
-      int16_t val = (wvfm_self[i] - _baseline) - (wvfm_other[i] - other._baseline);
-      noise += val * val;
-    }
+    unsigned n = range[1] - range[0] + 1;
+    n_samples += n;
+    noise += SumSquares(wvfm_self.data() + range[0], _baseline, wvfm_other.data() + range[0], other._baseline, -1, n);
   }
   return sqrt(((float) noise) / n_samples);
 
 }
 
 // calculated the mean of all adc values in noise ranges, and sets that as baseline
-void daqAnalysis::NoiseSample::ResetBaseline(const std::vector<int16_t> &wvfm_self) {
-  int total = 0;
+void daqAnalysis::NoiseSample::ResetBaseline(daqAnalysis::WaveformView wvfm_self) {
+  int64_t total = 0;
   int n_values = 0;
   for (auto &range: _ranges) {
     for (unsigned i = range[0]; i <= range[1]; i++) {
@@ -167,6 +248,103 @@ void daqAnalysis::NoiseSample::ResetBaseline(const std::vector<int16_t> &wvfm_se
   _baseline = total / n_values;
 }
 
+// Gets the sums over the noise ranges. When the ranges cover most of the waveform,
+// start from the whole-waveform sums and subtract the samples in between the ranges
+// (i.e. the signal regions) so that only those have to be read again.
+void daqAnalysis::NoiseSample::RangeSums(daqAnalysis::WaveformView wvfm_self, const daqAnalysis::WaveformSums &sums, 
+    int64_t &sum, int64_t &sum_sq, unsigned &n_samples) {
+  n_samples = 0;
+  for (auto &range: _ranges) {
+    n_samples += range[1] - range[0] + 1;
+  }
+  bool in_bounds = _ranges.size() == 0 || _ranges.back()[1] < sums.n_samples;
+
+  if (in_bounds && 2 * n_samples > sums.n_samples) {
+    // ranges are sorted and don't overlap
+    sum = sums.sum;
+    sum_sq = sums.sum_sq;
+    unsigned start = 0;
+    for (auto &range: _ranges) {
+      for (unsigned i = start; i < range[0]; i++) {
+        sum -= wvfm_self[i];
+        sum_sq -= (int64_t)wvfm_self[i] * wvfm_self[i];
+      }
+      start = range[1] + 1;
+    }
+    for (unsigned i = start; i < sums.n_samples; i++) {
+      sum -= wvfm_self[i];
+      sum_sq -= (int64_t)wvfm_self[i] * wvfm_self[i];
+    }
+  }
+  else {
+    sum = 0;
+    sum_sq = 0;
+    for (auto &range: _ranges) {
+      for (unsigned i = range[0]; i <= range[1]; i++) {
+        sum += wvfm_self[i];
+        sum_sq += (int64_t)wvfm_self[i] * wvfm_self[i];
+      }
+    }
+  }
+}
+
+float daqAnalysis::NoiseSample::RMS(daqAnalysis::WaveformView wvfm_self, const daqAnalysis::WaveformSums &sums) {
+  int64_t sum, sum_sq;
+  unsigned n_samples;
+  RangeSums(wvfm_self, sums, sum, sum_sq, n_samples);
+  // sum of (x - baseline)^2 -- exactly the same value as in CalcRMS
+  int64_t ret = sum_sq - 2 * (int64_t)_baseline * sum + (int64_t)n_samples * _baseline * _baseline;
+  return sqrt((float)ret / n_samples);
+}
+
+void daqAnalysis::NoiseSample::ResetBaseline(daqAnalysis::WaveformView wvfm_self, const daqAnalysis::WaveformSums &sums) {
+  int64_t sum, sum_sq;
+  unsigned n_samples;
+  RangeSums(wvfm_self, sums, sum, sum_sq, n_samples);
+  // see ResetBaseline(wvfm_self) above
+  if (n_samples == 0) return;
+
+  _baseline = sum / (int64_t)n_samples;
+}
+
+unsigned daqAnalysis::NoiseSample::NSamples() const {
+  unsigned n_samples = 0;
+  for (auto &range: _ranges) {
+    n_samples += range[1] - range[0] + 1;
+  }
+  return n_samples;
+}
+
+void daqAnalysis::NoiseSample::PrefixRangeSums(const daqAnalysis::WaveformPrefixSums &prefix, int64_t &sum, int64_t &sum_sq, unsigned &n_samples) {
+  sum = 0;
+  sum_sq = 0;
+  n_samples = 0;
+  for (auto &range: _ranges) {
+    sum += prefix.Sum(range[0], range[1]);
+    sum_sq += prefix.SumSq(range[0], range[1]);
+    n_samples += range[1] - range[0] + 1;
+  }
+}
+
+float daqAnalysis::NoiseSample::RMS(const daqAnalysis::WaveformPrefixSums &prefix) {
+  int64_t sum, sum_sq;
+  unsigned n_samples;
+  PrefixRangeSums(prefix, sum, sum_sq, n_samples);
+  // sum of (x - baseline)^2 -- exactly the same value as in CalcRMS
+  int64_t ret = sum_sq - 2 * (int64_t)_baseline * sum + (int64_t)n_samples * _baseline * _baseline;
+  return sqrt((float)ret / n_samples);
+}
+
+void daqAnalysis::NoiseSample::ResetBaseline(const daqAnalysis::WaveformPrefixSums &prefix) {
+  int64_t sum, sum_sq;
+  unsigned n_samples;
+  PrefixRangeSums(prefix, sum, sum_sq, n_samples);
+  // see ResetBaseline(wvfm_self) above
+  if (n_samples == 0) return;
+
+  _baseline = sum / (int64_t)n_samples;
+}
+
 // sum a group of waveforms looking for e.g. coherent noise
 // assumes output is of size output_size
 void daqAnalysis::SumWaveforms(std::vector<int> &output, std::vector<const std::vector<int16_t>*>& waveforms, std::vector<int16_t> &baselines) {
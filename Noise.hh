@@ -4,45 +4,69 @@
 #include <array>
 
 #include "PeakFinder.hh"
+#include "WaveformView.hh"
+#include "WaveformSums.hh"
+#include "WaveformPrefixSums.hh"
+#include "Arena.hh"
 
 // keeps track of which regions of a waveform are suitable for noise calculations (i.e. don't contain signal)
 namespace daqAnalysis {
 class NoiseSample {
 public:
+  // ranges are stored in the arena passed on construction (if any). Samples
+  // made from this one (e.g. by Intersection()) use the same arena.
+  typedef ArenaVector<std::array<unsigned, 2>> RangeList;
+
   // construct sample from peaks (signals)
-  NoiseSample(std::vector<PeakFinder::Peak>& peaks, int16_t baseline, unsigned wvfm_size);
+  NoiseSample(std::vector<PeakFinder::Peak>& peaks, int16_t baseline, unsigned wvfm_size, Arena *arena=nullptr);
   // construct from a list of ranges that don't have signal
-  NoiseSample(std::vector<std::array<unsigned, 2>> ranges, int16_t baseline): _ranges(ranges), _baseline(baseline) {}
+  NoiseSample(const std::vector<std::array<unsigned, 2>> &ranges, int16_t baseline, Arena *arena=nullptr): 
+    _ranges(ranges.begin(), ranges.end(), RangeList::allocator_type(arena)), _baseline(baseline) {}
   // zero initialize
   NoiseSample(): _baseline(0) {}
 
   // calculate the intersect of ranges with another sample
   NoiseSample Intersection(NoiseSample &other) { return DoIntersection(*this, other, _baseline); }
 
-  float RMS(const std::vector<int16_t> &wvfm_self) { return CalcRMS(wvfm_self, _ranges, _baseline); } 
+  float RMS(WaveformView wvfm_self) { return CalcRMS(wvfm_self, _ranges, _baseline); } 
+  // same as RMS(), but uses the sums over the whole waveform so that only the
+  // samples outside of the noise ranges have to be re-read
+  float RMS(WaveformView wvfm_self, const WaveformSums &sums);
+  // same as RMS(), but from the prefix sums of the waveform (O(#ranges))
+  float RMS(const WaveformPrefixSums &prefix);
 
   // Functions for quantifying coherent noise:
-  float Covariance(const std::vector<int16_t> &wvfm_self, NoiseSample &other, const std::vector<int16_t> &wvfm_other);
-  float Correlation(const std::vector<int16_t> &wvfm_self, NoiseSample &other, const std::vector<int16_t> &wvfm_other);
+  float Covariance(WaveformView wvfm_self, NoiseSample &other, WaveformView wvfm_other);
+  float Correlation(WaveformView wvfm_self, NoiseSample &other, WaveformView wvfm_other);
   // the "Sum RMS" of a sample with another sample
-  float SumRMS(const std::vector<int16_t> &wvfm_self, NoiseSample &other, const std::vector<int16_t> &wvfm_other);
+  float SumRMS(WaveformView wvfm_self, NoiseSample &other, WaveformView wvfm_other);
   // the "Sum RMS" of n samples
   static float ScaledSumRMS(std::vector<NoiseSample *>& other, std::vector<const std::vector<int16_t> *>& wvfm_other);
   // "DNoise" with another sample
-  float DNoise(const std::vector<int16_t> &wvfm_self, NoiseSample &other, const std::vector<int16_t> &wvfm_other);
+  float DNoise(WaveformView wvfm_self, NoiseSample &other, WaveformView wvfm_other);
 
   // re-calculate the baseline as taking the mean of all values in the noise ranges
-  void ResetBaseline(const std::vector<int16_t> &wvfm_self);
+  void ResetBaseline(WaveformView wvfm_self);
+  // same, but using the sums over the whole waveform
+  void ResetBaseline(WaveformView wvfm_self, const WaveformSums &sums);
+  // same, but using the prefix sums of the waveform
+  void ResetBaseline(const WaveformPrefixSums &prefix);
 
   // get access to the ranges
-  std::vector<std::array<unsigned, 2>> *Ranges() { return &_ranges; }
+  RangeList *Ranges() { return &_ranges; }
+  // number of samples in the noise ranges
+  unsigned NSamples() const;
   // getter for the baseline
   int16_t Baseline() { return _baseline; }
 private:
-  static float CalcRMS(const std::vector<int16_t> &wvfm_self, std::vector<std::array<unsigned,2>> &ranges, int16_t baseline);
+  static float CalcRMS(WaveformView wvfm_self, RangeList &ranges, int16_t baseline);
   static NoiseSample DoIntersection(NoiseSample &me, NoiseSample &other, int16_t baseline=0.);
+  // sum of x and x^2 over the noise ranges
+  void RangeSums(WaveformView wvfm_self, const WaveformSums &sums, int64_t &sum, int64_t &sum_sq, unsigned &n_samples);
+  // same, from prefix sums
+  void PrefixRangeSums(const WaveformPrefixSums &prefix, int64_t &sum, int64_t &sum_sq, unsigned &n_samples);
 
-  std::vector<std::array<unsigned, 2>> _ranges;
+  RangeList _ranges;
   int16_t _baseline;
 };
 
@@ -0,0 +1,179 @@
+#include <vector>
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "NoiseCorrelation.hh"
+
+// number of channels in a block
+static const unsigned kBlockChannels = 16;
+// number of ticks in a tile. Each lane of the 32 bit SIMD accumulators adds
+// up at most 2*kTileTicks/8 products of two 12 bit ADC values, which has to
+// stay below 2^31
+static const unsigned kTileTicks = 256;
+
+typedef daqAnalysis::NoiseCorrelation::PairSums PairSums;
+
+// add the sums over one tile of ticks for a pair of channels
+static inline void TileSums(const int16_t *x_i, const int16_t *m_i, const int16_t *x_j, const int16_t *m_j, PairSums &sums) {
+#ifdef __SSE2__
+  __m128i covariance = _mm_setzero_si128();
+  __m128i n_samples = _mm_setzero_si128();
+  __m128i sum_sq_i = _mm_setzero_si128();
+  __m128i sum_sq_j = _mm_setzero_si128();
+  for (unsigned t = 0; t < kTileTicks; t += 8) {
+    __m128i xi = _mm_loadu_si128((const __m128i *)(x_i + t));
+    __m128i mi = _mm_loadu_si128((const __m128i *)(m_i + t));
+    __m128i xj = _mm_loadu_si128((const __m128i *)(x_j + t));
+    __m128i mj = _mm_loadu_si128((const __m128i *)(m_j + t));
+    covariance = _mm_add_epi32(covariance, _mm_madd_epi16(xi, xj));
+    // masks are -1, so their product is 1 where both are set
+    n_samples = _mm_add_epi32(n_samples, _mm_madd_epi16(mi, mj));
+    sum_sq_i = _mm_add_epi32(sum_sq_i, _mm_madd_epi16(_mm_and_si128(xi, mj), xi));
+    sum_sq_j = _mm_add_epi32(sum_sq_j, _mm_madd_epi16(_mm_and_si128(xj, mi), xj));
+  }
+  int32_t lanes[4][4];
+  _mm_storeu_si128((__m128i *)lanes[0], covariance);
+  _mm_storeu_si128((__m128i *)lanes[1], n_samples);
+  _mm_storeu_si128((__m128i *)lanes[2], sum_sq_i);
+  _mm_storeu_si128((__m128i *)lanes[3], sum_sq_j);
+  sums.covariance += (int64_t)lanes[0][0] + lanes[0][1] + lanes[0][2] + lanes[0][3];
+  sums.n_samples += (int64_t)lanes[1][0] + lanes[1][1] + lanes[1][2] + lanes[1][3];
+  sums.sum_sq_i += (int64_t)lanes[2][0] + lanes[2][1] + lanes[2][2] + lanes[2][3];
+  sums.sum_sq_j += (int64_t)lanes[3][0] + lanes[3][1] + lanes[3][2] + lanes[3][3];
+#else
+  // a whole tile of products can overflow 32 bits, so sum in 64
+  int64_t covariance = 0;
+  int64_t n_samples = 0;
+  int64_t sum_sq_i = 0;
+  int64_t sum_sq_j = 0;
+  for (unsigned t = 0; t < kTileTicks; t++) {
+    covariance += (int32_t)x_i[t] * x_j[t];
+    n_samples += (int32_t)m_i[t] * m_j[t];
+    sum_sq_i += (int32_t)(x_i[t] & m_j[t]) * x_i[t];
+    sum_sq_j += (int32_t)(x_j[t] & m_i[t]) * x_j[t];
+  }
+  sums.covariance += covariance;
+  sums.n_samples += n_samples;
+  sums.sum_sq_i += sum_sq_i;
+  sums.sum_sq_j += sum_sq_j;
+#endif
+}
+
+void daqAnalysis::MaskedNoise::Fill(std::vector<daqAnalysis::NoiseSample> &noise, const std::vector<daqAnalysis::WaveformView> &waveforms, unsigned stride) {
+  _n_channels = (noise.size() + stride - 1) / stride;
+
+  size_t max_size = 0;
+  for (unsigned i = 0; i < _n_channels; i++) {
+    max_size = std::max(max_size, waveforms[i * stride].size());
+  }
+  _row_size = ((max_size + kTileTicks - 1) / kTileTicks) * kTileTicks;
+
+  // baseline subtract and mask each waveform once
+  _values.assign(_n_channels * _row_size, 0);
+  _masks.assign(_n_channels * _row_size, 0);
+  for (unsigned i = 0; i < _n_channels; i++) {
+    NoiseSample &sample = noise[i * stride];
+    WaveformView waveform = waveforms[i * stride];
+    int16_t *values = &_values[i * _row_size];
+    int16_t *masks = &_masks[i * _row_size];
+    for (auto &range: *sample.Ranges()) {
+      for (unsigned t = range[0]; t <= range[1] && t < waveform.size(); t++) {
+        values[t] = waveform[t] - sample.Baseline();
+        masks[t] = -1;
+      }
+    }
+  }
+}
+
+daqAnalysis::NoiseCorrelation::NoiseCorrelation(unsigned n_threads, unsigned stride):
+  _thread_pool(std::max(n_threads, 1u)),
+  _stride(std::max(stride, 1u)),
+  _n_channels(0),
+  _n_events(0)
+{}
+
+void daqAnalysis::NoiseCorrelation::Calculate(std::vector<daqAnalysis::NoiseSample> &noise, const std::vector<daqAnalysis::WaveformView> &waveforms) {
+  _masked.Fill(noise, waveforms, _stride);
+  Clear();
+  Add(_masked);
+  Finish();
+}
+
+void daqAnalysis::NoiseCorrelation::Clear() {
+  PairSums zero = {0, 0, 0, 0};
+  _sums.assign(_sums.size(), zero);
+  _n_events = 0;
+}
+
+void daqAnalysis::NoiseCorrelation::Add(const daqAnalysis::MaskedNoise &event) {
+  if (event.NChannels() != _n_channels || _sums.empty()) {
+    _n_channels = event.NChannels();
+    _sums.resize((size_t)(_n_channels + 1) * _n_channels / 2);
+    Clear();
+  }
+
+  unsigned n_blocks = (_n_channels + kBlockChannels - 1) / kBlockChannels;
+  _block_pairs.clear();
+  for (unsigned block_i = 0; block_i < n_blocks; block_i++) {
+    for (unsigned block_j = block_i; block_j < n_blocks; block_j++) {
+      _block_pairs.emplace_back(block_i, block_j);
+    }
+  }
+  // each task adds to its own entries of the sums
+  _thread_pool.Run(_block_pairs.size(), [this, &event](unsigned task, unsigned thread) {
+    DoBlocks(event, _block_pairs[task].first, _block_pairs[task].second);
+  });
+  _n_events ++;
+}
+
+void daqAnalysis::NoiseCorrelation::DoBlocks(const daqAnalysis::MaskedNoise &event, unsigned block_i, unsigned block_j) {
+  unsigned start_i = block_i * kBlockChannels;
+  unsigned end_i = std::min(start_i + kBlockChannels, _n_channels);
+  unsigned start_j = block_j * kBlockChannels;
+  unsigned end_j = std::min(start_j + kBlockChannels, _n_channels);
+
+  PairSums sums[kBlockChannels][kBlockChannels];
+  memset(sums, 0, sizeof(sums));
+
+  // go over ticks on the outside so that both blocks of a tile stay in cache
+  for (size_t tick = 0; tick < event.RowSize(); tick += kTileTicks) {
+    for (unsigned i = start_i; i < end_i; i++) {
+      const int16_t *x_i = event.Values(i) + tick;
+      const int16_t *m_i = event.Masks(i) + tick;
+      // only the upper-right half is needed
+      for (unsigned j = std::max(i, start_j); j < end_j; j++) {
+        const int16_t *x_j = event.Values(j) + tick;
+        const int16_t *m_j = event.Masks(j) + tick;
+        TileSums(x_i, m_i, x_j, m_j, sums[i - start_i][j - start_j]);
+      }
+    }
+  }
+
+  for (unsigned i = start_i; i < end_i; i++) {
+    for (unsigned j = std::max(i, start_j); j < end_j; j++) {
+      PairSums &pair = sums[i - start_i][j - start_j];
+      PairSums &total = _sums[Index(i, j)];
+      total.covariance += pair.covariance;
+      total.n_samples += pair.n_samples;
+      total.sum_sq_i += pair.sum_sq_i;
+      total.sum_sq_j += pair.sum_sq_j;
+    }
+  }
+}
+
+void daqAnalysis::NoiseCorrelation::Finish() {
+  _matrix.resize(_sums.size());
+  // same arithmetic as NoiseSample::Correlation()
+  for (size_t k = 0; k < _sums.size(); k++) {
+    PairSums &pair = _sums[k];
+    float n_samples = pair.n_samples;
+    float covariance = ((float)pair.covariance) / n_samples;
+    float scaling = (float)sqrt((float)pair.sum_sq_i / n_samples) * (float)sqrt((float)pair.sum_sq_j / n_samples);
+    _matrix[k] = covariance / scaling;
+  }
+}
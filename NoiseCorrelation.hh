@@ -0,0 +1,108 @@
+#ifndef _sbnddaq_analysis_NoiseCorrelation
+#define _sbnddaq_analysis_NoiseCorrelation
+#include <vector>
+#include <cstdint>
+
+#include "Noise.hh"
+#include "WaveformView.hh"
+#include "ThreadPool.hh"
+
+// Calculates the noise correlation matrix between all pairs of channels.
+//
+// Gives the same result as calling NoiseSample::Correlation() on each pair,
+// but each waveform is only read once: it is baseline subtracted and the
+// samples outside of its noise ranges are zeroed (see MaskedNoise). Each
+// (i, j) entry then only needs four dot products over the masked waveforms
+// (covariance, the number of shared noise samples and each channel's sum of
+// squares over the samples shared with the other), which are done over
+// blocks of channels and ticks that fit in cache, split across the threads
+// of a ThreadPool.
+//
+// The sums can also be kept running over many events (Add()), in which case
+// the matrix is the correlation over all of the noise samples seen since the
+// last Clear().
+//
+// If a stride > 1 is given, only every stride-th channel is used, for a
+// quicker, coarser map.
+namespace daqAnalysis {
+
+// baseline subtracted waveforms of one event, zeroed outside of the noise ranges.
+// Stored as int16 (2 bytes per tick per channel, plus the same again for the masks).
+class MaskedNoise {
+public:
+  MaskedNoise(): _n_channels(0), _row_size(0) {}
+
+  // the i-th noise sample goes with the i-th waveform. Only every stride-th channel is kept
+  void Fill(std::vector<NoiseSample> &noise, const std::vector<WaveformView> &waveforms, unsigned stride=1);
+
+  unsigned NChannels() const { return _n_channels; }
+  // length of each row (ticks, padded out to a whole number of tiles)
+  size_t RowSize() const { return _row_size; }
+  const int16_t *Values(unsigned channel) const { return &_values[channel * _row_size]; }
+  const int16_t *Masks(unsigned channel) const { return &_masks[channel * _row_size]; }
+
+private:
+  unsigned _n_channels;
+  size_t _row_size;
+  // baseline subtracted ADC values, zero outside of the noise ranges
+  std::vector<int16_t> _values;
+  // -1 (all bits set) inside of the noise ranges, 0 outside
+  std::vector<int16_t> _masks;
+};
+
+class NoiseCorrelation {
+public:
+  explicit NoiseCorrelation(unsigned n_threads=1, unsigned stride=1);
+
+  // calculate the matrix for one event. The i-th noise sample goes with the i-th waveform
+  void Calculate(std::vector<NoiseSample> &noise, const std::vector<WaveformView> &waveforms);
+
+  // add an event to the running sums. If the number of channels changed, the
+  // sums are started over
+  void Add(const MaskedNoise &event);
+  // calculate the matrix from the running sums
+  void Finish();
+  // start the running sums over
+  void Clear();
+
+  // number of channels in the matrix (after the stride)
+  unsigned NChannels() const { return _n_channels; }
+  unsigned Stride() const { return _stride; }
+  // number of events in the running sums
+  unsigned NEvents() const { return _n_events; }
+  // correlation between the i-th and j-th channel in the matrix
+  float At(unsigned i, unsigned j) const { return i <= j ? _matrix[Index(i, j)] : _matrix[Index(j, i)]; }
+  // upper-right half of the matrix, in the order:
+  // (0, 0), (0, 1) ... (0, n-1), (1, 1), (1, 2) ... (n-1, n-1)
+  const std::vector<float> &Matrix() const { return _matrix; }
+
+  // running sums for a pair of channels
+  struct PairSums {
+    int64_t covariance;
+    int64_t n_samples;
+    // sum of squares of each channel over the samples shared with the other
+    int64_t sum_sq_i;
+    int64_t sum_sq_j;
+  };
+
+private:
+  // index into the matrix of the i-th channel with the j-th channel (i <= j)
+  inline size_t Index(unsigned i, unsigned j) const { return (size_t)i * _n_channels - (size_t)i * (i - 1) / 2 + j - i; }
+  // add in all of the entries between two blocks of channels
+  void DoBlocks(const MaskedNoise &event, unsigned block_i, unsigned block_j);
+
+  ThreadPool _thread_pool;
+  unsigned _stride;
+  unsigned _n_channels;
+  unsigned _n_events;
+  // used by Calculate()
+  MaskedNoise _masked;
+  // (block_i, block_j) of each task
+  std::vector<std::pair<unsigned, unsigned>> _block_pairs;
+  // same layout as the matrix
+  std::vector<PairSums> _sums;
+  std::vector<float> _matrix;
+};
+
+} // namespace daqAnalysis
+#endif
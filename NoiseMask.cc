@@ -0,0 +1,174 @@
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <math.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "NoiseMask.hh"
+
+// what to sum over the masked ticks, with da = a - a_offset and db = b - b_offset
+enum SumKind {
+  kSquare, // da^2
+  kProduct, // da * db
+  kSumSquare, // (da + db)^2
+  kDiffSquare // (da - db)^2
+};
+
+template<int kKind>
+static inline int64_t ScalarTerm(int16_t a, int16_t a_offset, int16_t b, int16_t b_offset) {
+  int32_t da = a - a_offset;
+  int32_t db = b - b_offset;
+  if (kKind == kSquare) return (int64_t)da * da;
+  if (kKind == kProduct) return (int64_t)da * db;
+  // same truncation as the NoiseSample functions
+  int16_t val = (kKind == kSumSquare) ? da + db : da - db;
+  return (int64_t)val * val;
+}
+
+// sum over the ticks set in (mask_a & mask_b) below n_ticks. Also counts the ticks
+template<int kKind>
+static int64_t MaskedSum(const std::vector<uint64_t> &mask_a, const std::vector<uint64_t> &mask_b, unsigned n_ticks,
+    const int16_t *a, int16_t a_offset, const int16_t *b, int16_t b_offset, unsigned &n_samples) {
+  unsigned n_words = std::min(std::min(mask_a.size(), mask_b.size()), (size_t)(n_ticks + 63) / 64);
+  int64_t ret = 0;
+  n_samples = 0;
+#ifdef __SSE2__
+  const __m128i lane_bits = _mm_set_epi16(128, 64, 32, 16, 8, 4, 2, 1);
+  const __m128i a_off = _mm_set1_epi16(a_offset);
+  const __m128i b_off = _mm_set1_epi16(b_offset);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i total = _mm_setzero_si128();
+#endif
+  for (unsigned word = 0; word < n_words; word++) {
+    uint64_t bits = mask_a[word] & mask_b[word];
+    unsigned base = word * 64;
+    // don't go past the end of the waveforms
+    if (base + 64 > n_ticks) {
+      bits &= (1ull << (n_ticks - base)) - 1;
+    }
+    if (bits == 0) continue;
+    n_samples += __builtin_popcountll(bits);
+#ifdef __SSE2__
+    // whole words are done 8 ticks at a time
+    if (base + 64 <= n_ticks) {
+      for (unsigned chunk = 0; chunk < 8; chunk++) {
+        int16_t byte = (bits >> (8 * chunk)) & 0xff;
+        if (byte == 0) continue;
+        unsigned tick = base + 8 * chunk;
+        // spread the 8 bits out to 8 lanes of all 0's or all 1's
+        __m128i lane_mask = _mm_cmpeq_epi16(_mm_and_si128(_mm_set1_epi16(byte), lane_bits), lane_bits);
+        __m128i da = _mm_and_si128(_mm_sub_epi16(_mm_loadu_si128((const __m128i *)(a + tick)), a_off), lane_mask);
+        if (kKind == kSquare) {
+          // squares are positive, so zero extending is enough
+          __m128i sq = _mm_madd_epi16(da, da);
+          total = _mm_add_epi64(total, _mm_unpacklo_epi32(sq, zero));
+          total = _mm_add_epi64(total, _mm_unpackhi_epi32(sq, zero));
+          continue;
+        }
+        __m128i db = _mm_sub_epi16(_mm_loadu_si128((const __m128i *)(b + tick)), b_off);
+        if (kKind == kProduct) {
+          __m128i prod = _mm_madd_epi16(da, db);
+          __m128i sign = _mm_srai_epi32(prod, 31);
+          total = _mm_add_epi64(total, _mm_unpacklo_epi32(prod, sign));
+          total = _mm_add_epi64(total, _mm_unpackhi_epi32(prod, sign));
+        }
+        else {
+          db = _mm_and_si128(db, lane_mask);
+          __m128i val = (kKind == kSumSquare) ? _mm_add_epi16(da, db) : _mm_sub_epi16(da, db);
+          __m128i sq = _mm_madd_epi16(val, val);
+          total = _mm_add_epi64(total, _mm_unpacklo_epi32(sq, zero));
+          total = _mm_add_epi64(total, _mm_unpackhi_epi32(sq, zero));
+        }
+      }
+      continue;
+    }
+#endif
+    // one tick at a time
+    while (bits != 0) {
+      unsigned tick = base + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      ret += ScalarTerm<kKind>(a[tick], a_offset, b[tick], b_offset);
+    }
+  }
+#ifdef __SSE2__
+  int64_t lanes[2];
+  _mm_storeu_si128((__m128i *)lanes, total);
+  ret += lanes[0] + lanes[1];
+#endif
+  return ret;
+}
+
+void daqAnalysis::NoiseMask::ToRanges(std::vector<std::array<unsigned, 2>> &ranges) const {
+  ranges.clear();
+  bool in_range = false;
+  unsigned start = 0;
+  for (unsigned word = 0; word < _words.size(); word++) {
+    uint64_t bits = _words[word];
+    // skip over words with nothing going on
+    if (!in_range && bits == 0) continue;
+    if (in_range && bits == ~0ull) continue;
+    for (unsigned bit = 0; bit < 64; bit++) {
+      bool set = (bits >> bit) & 1;
+      if (set && !in_range) {
+        start = word * 64 + bit;
+        in_range = true;
+      }
+      else if (!set && in_range) {
+        ranges.push_back({start, word * 64 + bit - 1});
+        in_range = false;
+      }
+    }
+  }
+  if (in_range) {
+    ranges.push_back({start, (unsigned)_words.size() * 64 - 1});
+  }
+}
+
+void daqAnalysis::NoiseMask::Intersect(const daqAnalysis::NoiseMask &other) {
+  _n_ticks = std::min(_n_ticks, other._n_ticks);
+  _words.resize((_n_ticks + 63) / 64);
+  for (unsigned word = 0; word < _words.size(); word++) {
+    _words[word] &= other._words[word];
+  }
+}
+
+unsigned daqAnalysis::NoiseMask::Count() const {
+  unsigned ret = 0;
+  for (uint64_t bits: _words) {
+    ret += __builtin_popcountll(bits);
+  }
+  return ret;
+}
+
+int64_t daqAnalysis::NoiseMask::SumSquares(daqAnalysis::WaveformView wvfm, int16_t baseline) const {
+  unsigned n_samples;
+  unsigned n_ticks = std::min((size_t)_n_ticks, wvfm.size());
+  return MaskedSum<kSquare>(_words, _words, n_ticks, wvfm.data(), baseline, wvfm.data(), baseline, n_samples);
+}
+
+float daqAnalysis::NoiseMask::Covariance(const daqAnalysis::NoiseMask &mask_a, daqAnalysis::WaveformView wvfm_a, int16_t baseline_a,
+    const daqAnalysis::NoiseMask &mask_b, daqAnalysis::WaveformView wvfm_b, int16_t baseline_b) {
+  unsigned n_samples;
+  unsigned n_ticks = std::min(wvfm_a.size(), wvfm_b.size());
+  int64_t ret = MaskedSum<kProduct>(mask_a._words, mask_b._words, n_ticks, wvfm_a.data(), baseline_a, wvfm_b.data(), baseline_b, n_samples);
+  return ((float)ret) / n_samples;
+}
+
+float daqAnalysis::NoiseMask::SumRMS(const daqAnalysis::NoiseMask &mask_a, daqAnalysis::WaveformView wvfm_a, int16_t baseline_a,
+    const daqAnalysis::NoiseMask &mask_b, daqAnalysis::WaveformView wvfm_b, int16_t baseline_b) {
+  unsigned n_samples;
+  unsigned n_ticks = std::min(wvfm_a.size(), wvfm_b.size());
+  int64_t ret = MaskedSum<kSumSquare>(mask_a._words, mask_b._words, n_ticks, wvfm_a.data(), baseline_a, wvfm_b.data(), baseline_b, n_samples);
+  return sqrt(((float)ret) / n_samples);
+}
+
+float daqAnalysis::NoiseMask::DNoise(const daqAnalysis::NoiseMask &mask_a, daqAnalysis::WaveformView wvfm_a, int16_t baseline_a,
+    const daqAnalysis::NoiseMask &mask_b, daqAnalysis::WaveformView wvfm_b, int16_t baseline_b) {
+  unsigned n_samples;
+  unsigned n_ticks = std::min(wvfm_a.size(), wvfm_b.size());
+  int64_t ret = MaskedSum<kDiffSquare>(mask_a._words, mask_b._words, n_ticks, wvfm_a.data(), baseline_a, wvfm_b.data(), baseline_b, n_samples);
+  return sqrt(((float)ret) / n_samples);
+}
@@ -0,0 +1,86 @@
+#ifndef _sbnddaq_analysis_NoiseMask
+#define _sbnddaq_analysis_NoiseMask
+#include <vector>
+#include <array>
+#include <cstdint>
+
+#include "WaveformView.hh"
+
+// The ticks of a waveform that are suitable for noise calculations, stored
+// as one bit per tick (packed into 64 bit words).
+//
+// The alternative to the list of ranges in NoiseSample: the intersection of
+// two masks is a word-wise AND no matter how many ranges they have, and sums
+// over the masked ticks are done 8 ticks at a time with SIMD. Converts to and
+// from the range form, so e.g. ChannelData::noise_ranges doesn't change.
+namespace daqAnalysis {
+class NoiseMask {
+public:
+  NoiseMask(): _n_ticks(0) {}
+
+  // set from a list of sorted, inclusive [start, end] ranges. Ticks past
+  // n_ticks are dropped. Memory is kept between calls.
+  template<typename Ranges>
+  void FromRanges(const Ranges &ranges, unsigned n_ticks);
+  // convert back to the list of ranges
+  void ToRanges(std::vector<std::array<unsigned, 2>> &ranges) const;
+
+  // keep only the ticks that are also in other
+  void Intersect(const NoiseMask &other);
+
+  unsigned NTicks() const { return _n_ticks; }
+  // number of ticks in the mask
+  unsigned Count() const;
+
+  // sum of (x - baseline)^2 over the masked ticks
+  int64_t SumSquares(WaveformView wvfm, int16_t baseline) const;
+
+  // Functions over the ticks in both masks. Same values as the NoiseSample
+  // functions of the same name with the same ranges
+  static float Covariance(const NoiseMask &mask_a, WaveformView wvfm_a, int16_t baseline_a,
+    const NoiseMask &mask_b, WaveformView wvfm_b, int16_t baseline_b);
+  static float SumRMS(const NoiseMask &mask_a, WaveformView wvfm_a, int16_t baseline_a,
+    const NoiseMask &mask_b, WaveformView wvfm_b, int16_t baseline_b);
+  static float DNoise(const NoiseMask &mask_a, WaveformView wvfm_a, int16_t baseline_a,
+    const NoiseMask &mask_b, WaveformView wvfm_b, int16_t baseline_b);
+
+  const std::vector<uint64_t> &Words() const { return _words; }
+
+private:
+  inline void SetRange(unsigned start, unsigned end);
+
+  unsigned _n_ticks;
+  std::vector<uint64_t> _words;
+};
+
+inline void NoiseMask::SetRange(unsigned start, unsigned end) {
+  // [start, end] inclusive
+  unsigned first_word = start / 64;
+  unsigned last_word = end / 64;
+  uint64_t first_bits = ~0ull << (start % 64);
+  uint64_t last_bits = ~0ull >> (63 - end % 64);
+  if (first_word == last_word) {
+    _words[first_word] |= first_bits & last_bits;
+    return;
+  }
+  _words[first_word] |= first_bits;
+  for (unsigned i = first_word + 1; i < last_word; i++) {
+    _words[i] = ~0ull;
+  }
+  _words[last_word] |= last_bits;
+}
+
+template<typename Ranges>
+void NoiseMask::FromRanges(const Ranges &ranges, unsigned n_ticks) {
+  _n_ticks = n_ticks;
+  _words.assign((n_ticks + 63) / 64, 0);
+  for (auto &range: ranges) {
+    if (range[0] >= n_ticks) continue;
+    unsigned end = range[1] < n_ticks ? range[1] : n_ticks - 1;
+    if (range[0] > end) continue;
+    SetRange(range[0], end);
+  }
+}
+
+} // namespace daqAnalysis
+#endif
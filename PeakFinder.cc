@@ -22,7 +22,11 @@ inline bool doMatchPeaks(unsigned plane_type) {
   return plane_type == 1;
 }
 
-PeakFinder::PeakFinder(const std::vector<art::Ptr<recob::Hit> > &hits){
+PeakFinder::PeakFinder(const std::vector<art::Ptr<recob::Hit> > &hits, daqAnalysis::Arena *arena):
+  _smoothed_waveform(daqAnalysis::ArenaAllocator<int16_t>(arena)),
+  _peaks(daqAnalysis::ArenaAllocator<Peak>(arena))
+{
+  _peaks.reserve(hits.size());
   //Creates peak objects used for the gettting the channel info by using the hits found using RawHitFinder.                                
   for(std::vector<art::Ptr<recob::Hit> >::const_iterator hit_iter=hits.begin(); hit_iter!=hits.end(); ++hit_iter){
     PeakFinder::Peak peak;
@@ -45,13 +49,20 @@ PeakFinder::PeakFinder(const std::vector<art::Ptr<recob::Hit> > &hits){
 // plane_type == 0 means fit up and down peaks and don't match (i.e. debug mode)
 // plane_type == 1 means fit up and down peaks and match (induction planes)
 // plane_type == 2 means fit up peaks only (collection planes)
-PeakFinder::PeakFinder(std::vector<int16_t> &inp_waveform, int16_t baseline, float threshold, unsigned n_smoothing_samples, unsigned n_above_threshold, unsigned plane_type ) {
+PeakFinder::PeakFinder(daqAnalysis::WaveformView inp_waveform, int16_t baseline, float threshold, unsigned n_smoothing_samples, unsigned n_above_threshold, unsigned plane_type,
+    daqAnalysis::Arena *arena):
+  _smoothed_waveform(daqAnalysis::ArenaAllocator<int16_t>(arena)),
+  _peaks(daqAnalysis::ArenaAllocator<Peak>(arena))
+{
   // number of smoothing samples must be odd to make sense
   assert(n_smoothing_samples % 2 == 1);
 
   // smooth out input waveform if need be
   if (n_smoothing_samples > 1) {
     unsigned smoothing_per_direction = n_smoothing_samples / 2;
+    if (inp_waveform.size() > 2 * smoothing_per_direction) {
+      _smoothed_waveform.reserve(inp_waveform.size() - 2 * smoothing_per_direction);
+    }
     for (unsigned i = smoothing_per_direction; i < inp_waveform.size() - smoothing_per_direction; i++) {
       unsigned begin = i - smoothing_per_direction;
       unsigned end = i + smoothing_per_direction + 1;
@@ -62,7 +73,7 @@ PeakFinder::PeakFinder(std::vector<int16_t> &inp_waveform, int16_t baseline, flo
   }
 
   // use the smoothed waveform or the passed in waveform
-  std::vector<int16_t> *waveform = (n_smoothing_samples > 1) ? &_smoothed_waveform : &inp_waveform;
+  daqAnalysis::WaveformView waveform = (n_smoothing_samples > 1) ? daqAnalysis::WaveformView(_smoothed_waveform) : inp_waveform;
 
   // iterate through smoothed samples
   bool inside_peak = false;
@@ -72,8 +83,8 @@ PeakFinder::PeakFinder(std::vector<int16_t> &inp_waveform, int16_t baseline, flo
   // keep track of how many points above threshold
   unsigned n_points = 0;
 
-  for (unsigned i = 0; i < waveform->size(); i++) {
-    int16_t dat = (*waveform)[i];
+  for (unsigned i = 0; i < waveform.size(); i++) {
+    int16_t dat = waveform[i];
     // detect a new peak, or continue on the current one
 
     // up-peak
@@ -149,7 +160,7 @@ PeakFinder::PeakFinder(std::vector<int16_t> &inp_waveform, int16_t baseline, flo
   }
   // finish peak if we're inside one at the end
   if (inside_peak) {
-    peak = FinishPeak(peak, waveform, n_smoothing_samples, baseline, up_peak, waveform->size()-1);
+    peak = FinishPeak(peak, waveform, n_smoothing_samples, baseline, up_peak, waveform.size()-1);
     _peaks.emplace_back(peak);
   }
 
@@ -161,14 +172,14 @@ PeakFinder::PeakFinder(std::vector<int16_t> &inp_waveform, int16_t baseline, flo
 }
 
 
-PeakFinder::Peak PeakFinder::FinishPeak(PeakFinder::Peak peak, std::vector<int16_t> *waveform, unsigned n_smoothing_samples, int16_t baseline, bool up_peak, unsigned index) {
+PeakFinder::Peak PeakFinder::FinishPeak(PeakFinder::Peak peak, daqAnalysis::WaveformView waveform, unsigned n_smoothing_samples, int16_t baseline, bool up_peak, unsigned index) {
   peak.end_tight = index;
   // find the upper and lower bounds to determine the max width
   peak.start_loose = peak.start_tight;
   unsigned n_at_baseline = 0;
   while (peak.start_loose > 0) {
-    if ((up_peak && (*waveform)[peak.start_loose] <= baseline) ||
-       (!up_peak && (*waveform)[peak.start_loose] >= baseline)) {
+    if ((up_peak && waveform[peak.start_loose] <= baseline) ||
+       (!up_peak && waveform[peak.start_loose] >= baseline)) {
 
       n_at_baseline ++;
     }
@@ -185,9 +196,9 @@ PeakFinder::Peak PeakFinder::FinishPeak(PeakFinder::Peak peak, std::vector<int16
   // now find upper bound on end
   peak.end_loose = peak.end_tight;
   n_at_baseline = 0;
-  while (peak.end_loose < waveform->size()-1) {
-    if ((up_peak && (*waveform)[peak.end_loose] <= baseline) ||
-       (!up_peak && (*waveform)[peak.end_loose] >= baseline)) {
+  while (peak.end_loose < waveform.size()-1) {
+    if ((up_peak && waveform[peak.end_loose] <= baseline) ||
+       (!up_peak && waveform[peak.end_loose] >= baseline)) {
       n_at_baseline ++;
     }
     if (n_at_baseline > 2) {
@@ -196,13 +207,13 @@ PeakFinder::Peak PeakFinder::FinishPeak(PeakFinder::Peak peak, std::vector<int16
     peak.end_loose ++;
   }
   // set end_loose such that it isn't under the influence of any points inside peak
-  peak.end_loose = std::min(peak.end_loose + n_smoothing_samples/2, (unsigned)waveform->size()-1);
+  peak.end_loose = std::min(peak.end_loose + n_smoothing_samples/2, (unsigned)waveform.size()-1);
   return peak;
 }
 
 // match up peak - down peak pairs for collection planes
 void PeakFinder::matchPeaks(unsigned match_range) {
-  std::vector<PeakFinder::Peak> pruned_peaks;
+  daqAnalysis::ArenaVector<PeakFinder::Peak> pruned_peaks(_peaks.get_allocator());
 
   bool last_was_up_peak = false;
   for (unsigned i = 0; i < _peaks.size(); i++) {
@@ -219,7 +230,7 @@ void PeakFinder::matchPeaks(unsigned match_range) {
     last_was_up_peak = _peaks[i].is_up;
   }
   // set the peaks to the pruned version
-  _peaks = pruned_peaks;
+  _peaks = std::move(pruned_peaks);
 }
 
 // Print for debugging purposes
@@ -239,7 +250,7 @@ std::string PeakFinder::Peak::Print() {
 
 
 // Calculate the threshold by fitting a gaussian to a histogram of ADC values from the waveform
-Threshold::Threshold(std::vector<int16_t> &waveform, int16_t baseline, float n_sigma, bool verbose) {
+Threshold::Threshold(daqAnalysis::WaveformView waveform, int16_t baseline, float n_sigma, bool verbose) {
   int16_t min = *std::min_element(waveform.begin(), waveform.end());
   int16_t max = *std::max_element(waveform.begin(), waveform.end());
   size_t length = waveform.size();
@@ -276,18 +287,27 @@ Threshold::Threshold(std::vector<int16_t> &waveform, int16_t baseline, float n_s
 
 // gets the RMS from a wavefrom including any present signal 
 // i.e. will always overestimate the "true" RMS unless no signal is present
-float rawRMS(std::vector<int16_t> &waveform, int16_t baseline) {
+float rawRMS(daqAnalysis::WaveformView waveform, int16_t baseline) {
   daqAnalysis::NoiseSample temp({{0, (unsigned)waveform.size() -1}}, baseline);
   return temp.RMS(waveform);
 }
 
 // get the threshold from a running average of rms values
-float RunningThreshold::Threshold(std::vector<int16_t> &waveform, int16_t baseline, float n_sigma) {
+float RunningThreshold::Threshold(daqAnalysis::WaveformView waveform, int16_t baseline, float n_sigma) {
+  // only need the raw RMS if there's no history
+  return ThresholdFromRMS((_n_past_rms == 0) ? rawRMS(waveform, baseline) : 0., n_sigma);
+}
+
+float RunningThreshold::Threshold(const daqAnalysis::WaveformSums &sums, int16_t baseline, float n_sigma) {
+  return ThresholdFromRMS((_n_past_rms == 0) ? sums.RMS(baseline) : 0., n_sigma);
+}
+
+float RunningThreshold::ThresholdFromRMS(float raw_rms, float n_sigma) {
   // if there's no history, just use the raw RMS
   if (_n_past_rms == 0) {
     // 2x penalty since rawRMS will overestimate the true RMS
     // edit: no penalty for now
-    return rawRMS(waveform, baseline) * n_sigma;
+    return raw_rms * n_sigma;
   }
   else {
     float rms = 0;
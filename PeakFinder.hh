@@ -8,6 +8,10 @@
 #include "canvas/Persistency/Common/Ptr.h"
 #include "lardataobj/RecoBase/Hit.h"
 
+#include "WaveformView.hh"
+#include "WaveformSums.hh"
+#include "Arena.hh"
+
 // Reinventing the wheel: search for a bunch of peaks in a set of data
 // 
 // Implementation: searches for points above some threshold (requiring a 
@@ -41,16 +45,18 @@ public:
   };
 
   // initialize internal vector of peaks from art product
-  explicit PeakFinder(const std::vector<art::Ptr<recob::Hit> > &hits);
+  // (internal storage is taken from arena if provided)
+  explicit PeakFinder(const std::vector<art::Ptr<recob::Hit> > &hits, daqAnalysis::Arena *arena=nullptr);
 
   // generate list of peaks by providing waveform -- does hitfinding internally
-  PeakFinder(std::vector<int16_t> &waveform, int16_t baseline, float threshold, unsigned n_smoothing_samples=1, unsigned n_above_threshold=0, unsigned plane_type=0);
-  inline std::vector<Peak> *Peaks() { return &_peaks; }
+  PeakFinder(daqAnalysis::WaveformView waveform, int16_t baseline, float threshold, unsigned n_smoothing_samples=1, unsigned n_above_threshold=0, unsigned plane_type=0,
+      daqAnalysis::Arena *arena=nullptr);
+  inline daqAnalysis::ArenaVector<Peak> *Peaks() { return &_peaks; }
 private:
-  Peak FinishPeak(Peak peak, std::vector<int16_t> *waveform, unsigned n_smoothing_samples, int16_t baseline, bool up_peak, unsigned index);
+  Peak FinishPeak(Peak peak, daqAnalysis::WaveformView waveform, unsigned n_smoothing_samples, int16_t baseline, bool up_peak, unsigned index);
   void matchPeaks(unsigned match_range);
-  std::vector<int16_t> _smoothed_waveform;
-  std::vector<Peak> _peaks;
+  daqAnalysis::ArenaVector<int16_t> _smoothed_waveform;
+  daqAnalysis::ArenaVector<Peak> _peaks;
 };
 
 // Classes for different types of threshold calculation
@@ -58,7 +64,7 @@ private:
 // gets threshold from gaussian fit to histogram of ADC values
 class Threshold {
 public:
-  Threshold(std::vector<int16_t> &waveform, int16_t baseline, float n_sigma=5., bool verbose=true);
+  Threshold(daqAnalysis::WaveformView waveform, int16_t baseline, float n_sigma=5., bool verbose=true);
 
   inline float Val() { return _threshold; }
 private:
@@ -70,10 +76,14 @@ class RunningThreshold {
 public:
   RunningThreshold(): _rms_ind(0), _n_past_rms(0) { std::fill(_past_rms.begin(), _past_rms.end(), 0); }
 
-  float Threshold(std::vector<int16_t> &waveform, int16_t baseline, float n_sigma=5.);
+  float Threshold(daqAnalysis::WaveformView waveform, int16_t baseline, float n_sigma=5.);
+  // same, but get the raw rms from already calculated sums
+  float Threshold(const daqAnalysis::WaveformSums &sums, int16_t baseline, float n_sigma=5.);
   void AddRMS(float rms);
 
 private:
+  float ThresholdFromRMS(float raw_rms, float n_sigma);
+
   std::array<float, 10> _past_rms;
   unsigned _rms_ind;
   unsigned _n_past_rms;
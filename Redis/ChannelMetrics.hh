@@ -0,0 +1,235 @@
+#ifndef ChannelMetrics_h
+#define ChannelMetrics_h
+
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <array>
+#include <ctime>
+#include <cmath>
+
+#include <hiredis/hiredis.h>
+
+#include "messagefacility/MessageLogger/MessageLogger.h"
+
+#include "../ChannelDataStore.hh"
+#include "../VSTChannelMap.hh"
+
+#include "RedisData.hh"
+#include "PackedMetric.hh"
+#include "RedisPipeline.hh"
+
+/*
+ * Keeps all of the per-channel metrics for all of the streams.
+ *
+ * The metrics are given as a list of ChannelMetric types (see RedisData.hh)
+ * so that everything is resolved at compile time. Fill() goes over the
+ * channels once and for each channel updates every metric.
+ *
+ * Only one set of metrics is filled per event: the "current" bucket, which
+ * is the shortest time period any stream can see. Whenever any stream is
+ * about to be sent, Rollup() closes the current bucket and merges it into
+ * every stream. Since each stream sends on a rollup, its data is always
+ * made up of whole buckets, and the merged values are the same as if the
+ * stream had been filled on every event.
+*/
+
+namespace daqAnalysis {
+  template<typename... Metrics>
+  class ChannelMetrics;
+}
+
+template<typename... Metrics>
+class daqAnalysis::ChannelMetrics {
+public:
+  static const size_t NMetrics = sizeof...(Metrics);
+
+  ChannelMetrics(unsigned n_streams, daqAnalysis::VSTChannelMap *channel_map):
+    ChannelMetrics(n_streams, channel_map->Lookup()) {}
+  // the crates, fems and channels are the ones in the lookup
+  ChannelMetrics(unsigned n_streams, const daqAnalysis::ChannelLookup &lookup);
+
+  // add in the data from one event
+  void Fill(const daqAnalysis::ChannelDataStore &channels);
+  // copy the columns of from that Fill() reads into to (the rest of to is left alone)
+  static void CopyColumns(const daqAnalysis::ChannelDataStore &from, daqAnalysis::ChannelDataStore &to);
+  // to be called once per time instance (after Fill())
+  void Update();
+  // merge the current bucket into each stream. Must be called before
+  // any stream is sent.
+  void Rollup();
+  // send the i-th stream to redis. Returns the number of commands sent
+  // If packed is set, each metric is sent as one binary key (see PackedMetric.hh)
+  unsigned Send(unsigned stream, daqAnalysis::RedisPipeline *pipeline, uint64_t index, const char *stream_name, unsigned stream_expire, 
+      bool packed=false);
+  // called after stuff from the i-th stream is sent to Redis
+  void Clear(unsigned stream);
+  void Print(unsigned stream, const char *stream_name);
+
+  // access to the i-th metric of a stream
+  template<size_t I>
+  typename std::tuple_element<I, std::tuple<typename Metrics::Metric...>>::type &Get(unsigned stream)
+    { return std::get<I>(_metrics)[stream]; }
+
+private:
+  // where a channel goes in each of the metric containers
+  struct ChannelIndex {
+    unsigned crate;
+    unsigned crate_channel_ind;
+    unsigned fem_ind;
+    unsigned fem_channel_ind;
+    unsigned wire;
+  };
+
+  template<size_t... I>
+  void FillChannel(const daqAnalysis::ChannelDataStore &channels, const ChannelIndex &index, std::index_sequence<I...>);
+  template<size_t I, typename Metric>
+  void FillMetric(float dat, const ChannelIndex &index);
+
+  // calls func(streams, current) for each metric (in order), where streams
+  // is the vector of the metric over streams and current is its current bucket
+  template<typename Func, size_t... I>
+  void ForEach(Func func, std::index_sequence<I...>);
+  template<typename Func>
+  void ForEach(Func func) { ForEach(func, std::index_sequence_for<Metrics...>()); }
+
+  // mapped channels, in the order they are filled
+  std::vector<ChannelIndex> _channels;
+  // one vector (over streams) per metric
+  std::tuple<std::vector<typename Metrics::Metric>...> _metrics;
+  // metrics filled since the last rollup
+  std::tuple<typename Metrics::Metric...> _current;
+  // scratch space for packed sends
+  daqAnalysis::PackedMetric _packed;
+  // last time a NAN message was printed per metric per wire
+  std::array<std::vector<time_t>, NMetrics> _wire_message_times;
+};
+
+template<typename... Metrics>
+daqAnalysis::ChannelMetrics<Metrics...>::ChannelMetrics(unsigned n_streams, const daqAnalysis::ChannelLookup &lookup):
+  _metrics(std::vector<typename Metrics::Metric>(n_streams, typename Metrics::Metric(lookup))...),
+  _current(typename Metrics::Metric(lookup)...)
+{
+  for (auto &times: _wire_message_times) {
+    times.assign(lookup.NWires(), 0);
+  }
+
+  // work out the indices of each channel once
+  // the channel map has them over crates and fems
+  for (auto const &entry: lookup.Entries()) {
+    ChannelIndex index;
+    index.crate = entry.crate;
+    // index into the fem data cache (over all crates)
+    index.fem_ind = entry.global_fem;
+    // get the wire number
+    index.wire = entry.wire;
+    // get index of channel on fem
+    index.fem_channel_ind = entry.fem_channel_ind;
+    // and in the crate
+    index.crate_channel_ind = entry.crate_channel_ind;
+    _channels.push_back(index);
+  }
+}
+
+template<typename... Metrics>
+void daqAnalysis::ChannelMetrics<Metrics...>::Fill(const daqAnalysis::ChannelDataStore &channels) {
+  for (auto const &index: _channels) {
+    FillChannel(channels, index, std::index_sequence_for<Metrics...>());
+  }
+}
+
+template<typename... Metrics>
+void daqAnalysis::ChannelMetrics<Metrics...>::CopyColumns(const daqAnalysis::ChannelDataStore &from, daqAnalysis::ChannelDataStore &to) {
+  // (a column shared by two metrics is copied twice)
+  int expand[] = {0, (Metrics::Copy(from, to), 0)...};
+  (void) expand;
+}
+
+template<typename... Metrics>
+template<size_t... I>
+inline void daqAnalysis::ChannelMetrics<Metrics...>::FillChannel(const daqAnalysis::ChannelDataStore &channels, const ChannelIndex &index,
+    std::index_sequence<I...>) {
+  // calculate each metric once
+  int expand[] = {0, (FillMetric<I, Metrics>(Metrics::Value(channels, index.wire), index), 0)...};
+  (void) expand;
+}
+
+template<typename... Metrics>
+template<size_t I, typename Metric>
+inline void daqAnalysis::ChannelMetrics<Metrics...>::FillMetric(float dat, const ChannelIndex &index) {
+  // persist through nan's
+  if (std::isnan(dat)) {
+    // don't send error messages too often
+    time_t now = std::time(nullptr);
+    if (now - _wire_message_times[I][index.wire] > 10) {
+      _wire_message_times[I][index.wire] = now;
+      mf::LogError("NAN Metric") << "Metric " << Metric::Metric::Name() << " is NAN on wire " << index.wire << std::endl;
+    }
+    return;
+  }
+  std::get<I>(_current).Fill(dat, index.crate, index.crate_channel_ind, index.fem_ind, index.fem_channel_ind, index.wire);
+}
+
+template<typename... Metrics>
+template<typename Func, size_t... I>
+void daqAnalysis::ChannelMetrics<Metrics...>::ForEach(Func func, std::index_sequence<I...>) {
+  int expand[] = {0, (func(std::get<I>(_metrics), std::get<I>(_current)), 0)...};
+  (void) expand;
+}
+
+template<typename... Metrics>
+void daqAnalysis::ChannelMetrics<Metrics...>::Update() {
+  // only the current bucket has new data
+  ForEach([](auto &streams, auto &current) { current.Update(); });
+}
+
+template<typename... Metrics>
+void daqAnalysis::ChannelMetrics<Metrics...>::Rollup() {
+  ForEach([](auto &streams, auto &current) {
+    for (auto &metric: streams) {
+      metric.Merge(current);
+    }
+    // start a new bucket
+    current.Clear();
+  });
+}
+
+template<typename... Metrics>
+unsigned daqAnalysis::ChannelMetrics<Metrics...>::Send(unsigned stream, daqAnalysis::RedisPipeline *pipeline, uint64_t index, const char *stream_name, unsigned stream_expire,
+    bool packed) {
+  unsigned n_commands = 0;
+  if (packed) {
+    ForEach([&](auto &streams, auto &current) { n_commands += streams[stream].SendPacked(pipeline, index, stream_name, stream_expire, _packed); });
+  }
+  else {
+    ForEach([&](auto &streams, auto &current) { n_commands += streams[stream].Send(pipeline, index, stream_name, stream_expire); });
+  }
+  return n_commands;
+}
+
+template<typename... Metrics>
+void daqAnalysis::ChannelMetrics<Metrics...>::Clear(unsigned stream) {
+  ForEach([stream](auto &streams, auto &current) { streams[stream].Clear(); });
+}
+
+template<typename... Metrics>
+void daqAnalysis::ChannelMetrics<Metrics...>::Print(unsigned stream, const char *stream_name) {
+  ForEach([&](auto &streams, auto &current) { streams[stream].Print(stream_name); });
+}
+
+namespace daqAnalysis {
+  // All of the per-channel metrics sent to redis, in the order they are sent.
+  // To add a metric, define it in RedisData.hh and add it here.
+  typedef ChannelMetrics<
+    RedisRMS,
+    RedisBaseline,
+    RedisBaselineRMS,
+    RedisDNoise,
+    RedisOccupancy,
+    RedisPulseHeight,
+    RedisRawHitOccupancy,
+    RedisRawHitPulseHeight
+  > RedisChannelMetrics;
+}
+
+#endif /* ChannelMetrics_h */
@@ -0,0 +1,170 @@
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <cinttypes>
+
+#include <hiredis/hiredis.h>
+
+#include "messagefacility/MessageLogger/MessageLogger.h"
+
+#include "lardataobj/RawData/RawDigit.h"
+
+#include "../Noise.hh"
+#include "../NoiseCorrelation.hh"
+#include "../WaveformView.hh"
+
+#include "CorrelationAccumulator.hh"
+
+using namespace daqAnalysis;
+
+CorrelationAccumulator::CorrelationAccumulator(const daqAnalysis::Redis::Config &config):
+  _context(redisConnect(config.hostname.c_str(), 6379)),
+  // strided channels are dropped in MaskedNoise::Fill()
+  _correlation(config.correlation_threads, 1),
+  _encoder(config.compress_snapshot),
+  _stride(config.correlation_stride),
+  _do_timing(config.timing),
+  _has_pending(false),
+  _add_time(0.),
+  _stop(false),
+  _n_added(0),
+  _n_skipped(0)
+{
+  if (_context == NULL || _context->err) {
+    mf::LogError("CorrelationAccumulator") << "Redis error: " << (_context ? _context->errstr : "can't allocate context") << std::endl;
+  }
+  _thread = std::thread(&CorrelationAccumulator::Run, this);
+}
+
+CorrelationAccumulator::~CorrelationAccumulator() {
+  Stop();
+  if (_context != NULL) redisFree(_context);
+}
+
+void CorrelationAccumulator::Add(std::vector<daqAnalysis::NoiseSample> &noise, const std::vector<raw::RawDigit> &digits,
+    const std::vector<unsigned> &channel_to_index) {
+  auto start = std::chrono::high_resolution_clock::now();
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    // don't pile up work if the last event hasn't been added yet
+    if (_has_pending) {
+      _n_skipped ++;
+      return;
+    }
+  }
+
+  // the i-th noise sample goes with the waveform at channel_to_index[i]
+  _waveforms.clear();
+  for (unsigned i = 0; i < noise.size(); i++) {
+    _waveforms.emplace_back(digits[channel_to_index[i]].ADCs());
+  }
+  _filling.Fill(noise, _waveforms, _stride);
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    std::swap(_filling, _pending);
+    _has_pending = true;
+    if (_do_timing) {
+      auto now = std::chrono::high_resolution_clock::now();
+      _add_time += std::chrono::duration<float, std::milli>(now - start).count();
+    }
+  }
+  _cv.notify_one();
+}
+
+void CorrelationAccumulator::Publish(uint64_t index, const std::string &stream_name, unsigned expire) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _requests.push_back({index, stream_name, expire, _add_time});
+    _add_time = 0.;
+  }
+  _cv.notify_one();
+}
+
+void CorrelationAccumulator::Stop() {
+  if (!_thread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_one();
+  _thread.join();
+}
+
+void CorrelationAccumulator::Run() {
+  std::unique_lock<std::mutex> lock(_mutex);
+  while (true) {
+    _cv.wait(lock, [this] { return _stop || _has_pending || !_requests.empty(); });
+
+    // add the event before sending so that it's included
+    if (_has_pending) {
+      lock.unlock();
+      _correlation.Add(_pending);
+      lock.lock();
+      _has_pending = false;
+      _n_added ++;
+    }
+    if (!_requests.empty()) {
+      std::vector<Request> requests;
+      requests.swap(_requests);
+      lock.unlock();
+      for (auto const &request: requests) {
+        DoPublish(request);
+      }
+      lock.lock();
+    }
+    // only quit once there is nothing left to do
+    if (_stop && !_has_pending && _requests.empty()) break;
+  }
+}
+
+void CorrelationAccumulator::DoPublish(const Request &request) {
+  if (_context == NULL || _context->err) return;
+  // nothing to send
+  if (_correlation.NEvents() == 0) return;
+
+  auto start = std::chrono::high_resolution_clock::now();
+
+  _correlation.Finish();
+  _encoder.StartFloats();
+  for (float correlation: _correlation.Matrix()) {
+    _encoder.AddFloat(correlation);
+  }
+  _encoder.FinishFloats();
+
+  char key[256];
+  snprintf(key, sizeof(key), "stream/%s:%" PRIu64 ":correlation", request.stream_name.c_str(), request.index);
+  unsigned n_commands = _encoder.Send(_context, key);
+  redisAppendCommand(_context, "SET %s:n_events %u", key, _correlation.NEvents());
+  redisAppendCommand(_context, "SET %s:stride %u", key, _stride);
+  n_commands += 2;
+  if (request.expire > 0) {
+    redisAppendCommand(_context, "EXPIRE %s %u", key, request.expire);
+    redisAppendCommand(_context, "EXPIRE %s:n_events %u", key, request.expire);
+    redisAppendCommand(_context, "EXPIRE %s:stride %u", key, request.expire);
+    n_commands += 3;
+  }
+
+  void *reply;
+  for (unsigned i = 0; i < n_commands; i++) {
+    if (redisGetReply(_context, &reply) != REDIS_OK) {
+      mf::LogError("CorrelationAccumulator") << "Redis error: " << _context->errstr << std::endl;
+      break;
+    }
+    freeReplyObject(reply);
+  }
+
+  if (_do_timing) {
+    auto now = std::chrono::high_resolution_clock::now();
+    // logged rather than printed, so it isn't mixed in with the timing printed on the event thread
+    mf::LogInfo("CorrelationAccumulator") << "CORRELATION : published " << _correlation.NEvents() << " events (added " << _n_added
+              << " skipped " << _n_skipped << ") add time " << request.add_time << " time "
+              << std::chrono::duration<float, std::milli>(now - start).count() << std::endl;
+  }
+
+  _correlation.Clear();
+}
@@ -0,0 +1,98 @@
+#ifndef CorrelationAccumulator_h
+#define CorrelationAccumulator_h
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include <hiredis/hiredis.h>
+
+#include "lardataobj/RawData/RawDigit.h"
+
+#include "../Noise.hh"
+#include "../NoiseCorrelation.hh"
+
+#include "Redis.hh"
+#include "SnapshotEncoder.hh"
+
+/*
+ * Keeps the noise correlation matrix summed over many events, and
+ * publishes it on the cadence of one of the Redis streams.
+ *
+ * On the event thread, Add() only baseline subtracts and masks the
+ * waveforms (one pass over the data) and hands them to a background
+ * thread, which adds them into the running sums of NoiseCorrelation. If
+ * that thread is still busy with the last event, the new one is skipped,
+ * so the matrix is averaged over as many events as it can keep up with.
+ *
+ * Publish() has the background thread send the matrix (encoded as in
+ * SnapshotEncoder.hh) to stream/<stream>:<index>:correlation and start
+ * the sums over.
+*/
+
+namespace daqAnalysis {
+  class CorrelationAccumulator;
+}
+
+class daqAnalysis::CorrelationAccumulator {
+public:
+  CorrelationAccumulator(const daqAnalysis::Redis::Config &config);
+  ~CorrelationAccumulator();
+
+  // Accumulators own a thread and should not be copied
+  CorrelationAccumulator(CorrelationAccumulator const &) = delete;
+  CorrelationAccumulator & operator = (CorrelationAccumulator const &) = delete;
+
+  // add an event. Should always be called from the same thread. With timing
+  // on, the time spent here is printed with the next published matrix
+  void Add(std::vector<daqAnalysis::NoiseSample> &noise, const std::vector<raw::RawDigit> &digits,
+    const std::vector<unsigned> &channel_to_index);
+  // send the matrix of everything added up to now
+  void Publish(uint64_t index, const std::string &stream_name, unsigned expire);
+  // finish adding and publishing and stop the thread
+  void Stop();
+
+private:
+  // a matrix to send
+  struct Request {
+    uint64_t index;
+    std::string stream_name;
+    unsigned expire;
+    // time spent in Add() since the last request [ms]
+    float add_time;
+  };
+
+  void Run();
+  void DoPublish(const Request &request);
+
+  // own connection (hiredis contexts can't be shared between threads)
+  redisContext *_context;
+  daqAnalysis::NoiseCorrelation _correlation;
+  daqAnalysis::SnapshotEncoder _encoder;
+  unsigned _stride;
+  bool _do_timing;
+
+  // filled on the event thread
+  daqAnalysis::MaskedNoise _filling;
+  std::vector<daqAnalysis::WaveformView> _waveforms;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  // waiting to be added (swapped with _filling)
+  daqAnalysis::MaskedNoise _pending;
+  bool _has_pending;
+  // time spent in Add() since the last Publish() [ms]
+  float _add_time;
+  std::vector<Request> _requests;
+  bool _stop;
+  std::thread _thread;
+
+  // bookkeeping
+  std::atomic<unsigned> _n_added;
+  std::atomic<unsigned> _n_skipped;
+};
+
+#endif /* CorrelationAccumulator_h */
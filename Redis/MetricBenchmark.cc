@@ -0,0 +1,139 @@
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <cstdlib>
+
+#include <hiredis/hiredis.h>
+
+#include "../ChannelDataStore.hh"
+#include "../ChannelLookup.hh"
+
+#include "ChannelMetrics.hh"
+#include "RedisPipeline.hh"
+
+/*
+ * Fills and sends the per-channel metrics for a large, multi-crate
+ * detector (by default SBND sized: 11 crates of 16 FEMs of 64 channels,
+ * 11264 in total).
+ *
+ * Usage: RedisMetricBenchmark [hostname] [n_crate] [n_fem_per_crate] [n_events]
+ *
+ * Times filling the metrics on every event (every level at once) and the
+ * rollup into the streams. If a redis server is reachable, also times
+ * sending one stream with one key per wire/fem/crate and packed. Keys are
+ * written under stream/benchmark and expire after a minute.
+*/
+
+using namespace daqAnalysis;
+
+static const unsigned kChannelsPerFEM = 64;
+static const unsigned expire = 60;
+
+// a channel map with n_crate crates of n_fem FEMs, numbered wire by wire
+class BenchmarkMap {
+public:
+  BenchmarkMap(unsigned n_crate, unsigned n_fem): _n_crate(n_crate), _n_fem(n_fem) {}
+
+  unsigned NCrates() const { return _n_crate; }
+  unsigned NFEM() const { return _n_fem; }
+  unsigned NSlotChannel() const { return kChannelsPerFEM; }
+  unsigned NChannels() const { return _n_crate * _n_fem * kChannelsPerFEM; }
+  unsigned Wire2Channel(unsigned wire) const { return wire; }
+  ReadoutChannel Ind2ReadoutChannel(unsigned channel) const {
+    unsigned fem = channel / kChannelsPerFEM;
+    return {fem / _n_fem, fem % _n_fem, channel % kChannelsPerFEM};
+  }
+  unsigned SlotIndex(ReadoutChannel channel) const { return channel.slot; }
+  bool IsGoodSlot(unsigned slot) const { return slot < _n_fem; }
+  bool IsMappedChannel(unsigned channel, unsigned fem, unsigned crate, bool add_offset=false) const {
+    return crate < _n_crate && fem < _n_fem && channel < kChannelsPerFEM;
+  }
+  unsigned Channel2Wire(unsigned channel, unsigned fem, unsigned crate, bool add_offset=false) const {
+    return (crate * _n_fem + fem) * kChannelsPerFEM + channel;
+  }
+  unsigned ReadoutChannel2FEMInd(unsigned channel, unsigned fem, unsigned crate, bool add_offset=false) const {
+    return channel;
+  }
+
+private:
+  unsigned _n_crate;
+  unsigned _n_fem;
+};
+
+static void finishPipeline(redisContext *context, unsigned n_commands) {
+  void *reply;
+  for (unsigned i = 0; i < n_commands; i++) {
+    if (redisGetReply(context, &reply) != REDIS_OK) {
+      std::cerr << "Redis error: " << context->errstr << std::endl;
+      exit(1);
+    }
+    freeReplyObject(reply);
+  }
+}
+
+int main(int argc, char **argv) {
+  const char *hostname = argc > 1 ? argv[1] : "127.0.0.1";
+  unsigned n_crate = argc > 2 ? atoi(argv[2]) : 11;
+  unsigned n_fem = argc > 3 ? atoi(argv[3]) : 16;
+  unsigned n_events = argc > 4 ? atoi(argv[4]) : 100;
+
+  BenchmarkMap map(n_crate, n_fem);
+  std::vector<unsigned> crate_ids;
+  for (unsigned crate = 0; crate < n_crate; crate++) crate_ids.push_back(crate);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  ChannelLookup lookup;
+  lookup.Build(map, crate_ids);
+  // one stream, as with a single redis stream configured
+  RedisChannelMetrics metrics(1, lookup);
+  auto end = std::chrono::high_resolution_clock::now();
+  std::cout << "SETUP   : " << lookup.NWires() << " channels " << lookup.NFEMs() << " fems " << lookup.NCrates() << " crates in "
+            << std::chrono::duration<float, std::milli>(end - start).count() << " ms" << std::endl;
+
+  // random per-channel data
+  ChannelDataStore channels(lookup.NWires());
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(3., 0.5);
+  for (unsigned wire = 0; wire < lookup.NWires(); wire++) {
+    channels.rms[wire] = noise(rng);
+    channels.baseline[wire] = 2000 + (int16_t)noise(rng);
+    channels.next_channel_dnoise[wire] = 1.;
+    channels.occupancy[wire] = 0.1;
+    channels.mean_peak_height[wire] = 50.;
+    channels.Hitoccupancy[wire] = 0.1;
+    channels.Hitmean_peak_height[wire] = 50.;
+  }
+
+  start = std::chrono::high_resolution_clock::now();
+  for (unsigned event = 0; event < n_events; event++) {
+    metrics.Fill(channels);
+    metrics.Update();
+  }
+  end = std::chrono::high_resolution_clock::now();
+  std::cout << "FILL    : " << std::chrono::duration<float, std::milli>(end - start).count() / n_events << " ms/event" << std::endl;
+
+  start = std::chrono::high_resolution_clock::now();
+  metrics.Rollup();
+  end = std::chrono::high_resolution_clock::now();
+  std::cout << "ROLLUP  : " << std::chrono::duration<float, std::milli>(end - start).count() << " ms" << std::endl;
+
+  redisContext *context = redisConnect(hostname, 6379);
+  if (context == nullptr || context->err) {
+    std::cerr << "Redis error: " << (context ? context->errstr : "can't allocate context") << " -- not sending" << std::endl;
+    if (context != nullptr) redisFree(context);
+    return 0;
+  }
+  RedisPipeline pipeline(context);
+  for (int packed = 0; packed < 2; packed++) {
+    start = std::chrono::high_resolution_clock::now();
+    unsigned n_commands = metrics.Send(0, &pipeline, 0, "benchmark", expire, packed);
+    finishPipeline(context, n_commands);
+    end = std::chrono::high_resolution_clock::now();
+    std::cout << (packed ? "PACKED  : " : "PER KEY : ") << n_commands << " commands "
+              << std::chrono::duration<float, std::milli>(end - start).count() << " ms" << std::endl;
+  }
+  redisFree(context);
+  return 0;
+}
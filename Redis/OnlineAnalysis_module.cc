@@ -2,6 +2,7 @@
 #include <iostream>
 #include <string>
 #include <ctime>
+#include <memory>
 
 #include "TROOT.h"
 #include "TTree.h"
@@ -22,6 +23,7 @@
 #include "../VSTChannelMap.hh"
 
 #include "Redis.hh"
+#include "RedisSender.hh"
 
 /*
  * Uses the Analysis class to send stuff to Redis
@@ -50,12 +52,19 @@ public:
   // finalize to send out sub-run data
   void endJob() override;
 private:
+  // copy the analysis output of this event for the sender thread
+  std::unique_ptr<daqAnalysis::RedisEvent> MakeRedisEvent(art::Event const & e, uint64_t now, bool snapshot);
+
   // handle to the channel map service
   art::ServiceHandle<daqAnalysis::VSTChannelMap> _channel_map;
 
   daqAnalysis::Analysis _analysis;
   daqAnalysis::Redis *_redis_manager;
+  // only set if sending to redis on a separate thread
+  std::unique_ptr<daqAnalysis::RedisSender> _redis_sender;
   bool _config_use_event_time;
+  // when the last snapshot was asked for (used to decide when to copy snapshot data)
+  uint64_t _last_snapshot;
 };
 
 daqAnalysis::OnlineAnalysis::OnlineAnalysis(fhicl::ParameterSet const & p):
@@ -75,6 +84,15 @@ daqAnalysis::OnlineAnalysis::OnlineAnalysis(fhicl::ParameterSet const & p):
   config.monitor_name = p.get<std::string>("monitor_name", "");
   config.flush_data = p.get<bool>("flush_data", true);
   config.print_data = p.get<bool>("print_data", false);
+  config.packed_metrics = p.get<bool>("packed_metrics", false);
+  config.async_output = p.get<bool>("async_output", false);
+  config.max_in_flight = p.get<unsigned>("max_in_flight", 100000);
+  config.binary_snapshot = p.get<bool>("binary_snapshot", false);
+  config.compress_snapshot = p.get<bool>("compress_snapshot", false);
+  config.correlation_threads = std::max(p.get<unsigned>("correlation_threads", 1), 1u);
+  config.correlation_stride = std::max(p.get<unsigned>("correlation_stride", 1), 1u);
+  config.correlation_accumulate = p.get<bool>("correlation_accumulate", false);
+  config.correlation_stream = p.get<unsigned>("correlation_stream", 0);
   
   // have Redis alloc fft if you don't calculate them and you know the input size
   config.waveform_input_size = (!_analysis._config.fft_per_channel && _analysis._config.static_input_size > 0) ?
@@ -87,6 +105,55 @@ daqAnalysis::OnlineAnalysis::OnlineAnalysis(fhicl::ParameterSet const & p):
 
   // config for online analysis module
   _config_use_event_time = p.get<bool>("use_event_time", false);
+  _last_snapshot = 0;
+
+  // whether to send to redis on a separate thread
+  if (p.get<bool>("async_send", false)) {
+    unsigned queue_size = p.get<unsigned>("send_queue_size", 4);
+    RedisSender::QueuePolicy policy = RedisSender::ParsePolicy(p.get<std::string>("send_queue_policy", "block"));
+    _redis_sender.reset(new RedisSender(_redis_manager, queue_size, policy, config.timing));
+  }
+}
+
+std::unique_ptr<daqAnalysis::RedisEvent> daqAnalysis::OnlineAnalysis::MakeRedisEvent(art::Event const & e, uint64_t now, bool snapshot) {
+  std::unique_ptr<RedisEvent> event(new RedisEvent);
+  event->time = now;
+  event->run = e.run();
+  event->sub_run = e.subRun();
+  // only the columns that are sent to redis
+  RedisChannelMetrics::CopyColumns(_analysis._channel_data_store, event->channel_data);
+  event->event_info = _analysis._event_info;
+  event->send_headers = _analysis._config.n_headers > 0;
+  if (event->send_headers) {
+    event->header_data = _analysis._header_data;
+  }
+
+  if (snapshot) {
+    event->has_snapshot_data = true;
+    event->channel_data.channel_no = _analysis._channel_data_store.channel_no;
+    // copy the noise ranges out of the analysis (they live in memory that is re-used next event)
+    event->noise_samples.reserve(_analysis._noise_samples.size());
+    for (auto &noise: _analysis._noise_samples) {
+      auto const &ranges = *noise.Ranges();
+      event->noise_samples.emplace_back(std::vector<std::array<unsigned, 2>>(ranges.begin(), ranges.end()), noise.Baseline());
+    }
+    // the sums are cleared before they are filled again, so they can be taken instead of copied
+    event->fem_summed_waveforms.resize(_analysis._fem_summed_waveforms.size());
+    for (unsigned i = 0; i < _analysis._fem_summed_waveforms.size(); i++) {
+      event->fem_summed_waveforms[i].swap(_analysis._fem_summed_waveforms[i]);
+    }
+    event->fem_summed_fft.resize(_analysis._fem_summed_fft.size());
+    for (unsigned i = 0; i < _analysis._fem_summed_fft.size(); i++) {
+      event->fem_summed_fft[i].swap(_analysis._fem_summed_fft[i]);
+    }
+    // the art event is gone by the time the snapshot is built, so it takes the
+    // waveforms (see Analysis::SnapshotWaveforms())
+    event->waveforms.resize(_analysis._channel_data_store.waveform.size());
+    for (unsigned i = 0; i < _analysis._channel_data_store.waveform.size(); i++) {
+      event->waveforms[i].swap(_analysis._channel_data_store.waveform[i]);
+    }
+  }
+  return event;
 }
 
 void daqAnalysis::OnlineAnalysis::analyze(art::Event const & e) {
@@ -97,7 +164,20 @@ void daqAnalysis::OnlineAnalysis::analyze(art::Event const & e) {
   unsigned sub_run = e.subRun();
   unsigned run = e.run();
 
-  if (_analysis.ReadyToProcess() && !_analysis.EmptyEvent()) {
+  if (_redis_sender && _analysis.ReadyToProcess() && !_analysis.EmptyEvent()) {
+    uint64_t now = (_config_use_event_time) ? e.time().timeLow() : std::time(nullptr);
+    // the manager's own clock belongs to the sender thread, so the time of the last snapshot is kept here
+    bool snapshot = _redis_manager->WillTakeSnapshot(now, _last_snapshot);
+    if (snapshot) {
+      _analysis.SumWaveforms(e);
+      _analysis.SnapshotWaveforms(e);
+      _last_snapshot = now;
+    }
+    // done here so that the digits don't have to be copied
+    _redis_manager->AccumulateCorrelation(&_analysis._noise_samples, *raw_digits_handle, _analysis._channel_index_map);
+    _redis_sender->Push(MakeRedisEvent(e, now, snapshot));
+  }
+  else if (_analysis.ReadyToProcess() && !_analysis.EmptyEvent()) {
     // if configured to, get the time from the event
     if (_config_use_event_time) {
       //std::cout << "TIME HIGH: " << e.time().timeHigh() << std::endl;
@@ -110,13 +190,18 @@ void daqAnalysis::OnlineAnalysis::analyze(art::Event const & e) {
       _redis_manager->StartSend(run, sub_run);
     }
 
-    // sum waveforms if we're gonna take a snapshot
+    // sum waveforms and capture the waveforms if we're gonna take a snapshot
+    // (it is built after the art event is gone)
+    std::vector<std::vector<int16_t>> *snapshot_waveforms = NULL;
     if (_redis_manager->WillTakeSnapshot()) {
       _analysis.SumWaveforms(e);
+      _analysis.SnapshotWaveforms(e);
+      snapshot_waveforms = &_analysis._channel_data_store.waveform;
     }
 
-    _redis_manager->ChannelData(&_analysis._per_channel_data, &_analysis._noise_samples, &_analysis._fem_summed_waveforms, 
-        &_analysis._fem_summed_fft, raw_digits_handle, _analysis._channel_index_map);
+    _redis_manager->AccumulateCorrelation(&_analysis._noise_samples, *raw_digits_handle, _analysis._channel_index_map);
+    _redis_manager->ChannelData(&_analysis._channel_data_store, &_analysis._noise_samples, &_analysis._fem_summed_waveforms, 
+        &_analysis._fem_summed_fft, snapshot_waveforms);
     // send headers if _analysis was configured to copy them
 
     _redis_manager->EventInfo(&_analysis._event_info);
@@ -129,6 +214,10 @@ void daqAnalysis::OnlineAnalysis::analyze(art::Event const & e) {
 }
 
 void daqAnalysis::OnlineAnalysis::endJob() {
+   // finish sending all of the events
+   if (_redis_sender) {
+     _redis_sender->Stop();
+   }
    // flush the reamining data in redis
    _redis_manager->FlushData();
 }
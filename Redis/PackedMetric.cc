@@ -0,0 +1,34 @@
+#include <vector>
+#include <string>
+#include <cstring>
+
+#include <hiredis/hiredis.h>
+
+#include "PackedMetric.hh"
+
+using namespace daqAnalysis;
+
+void PackedMetric::Start(unsigned n_wire, unsigned n_fem, unsigned n_crate) {
+  _buffer.clear();
+  _buffer.reserve(kHeaderSize + (n_wire + n_fem + n_crate) * sizeof(float));
+  AddU32(kVersion);
+  AddU32(n_wire);
+  AddU32(n_fem);
+  AddU32(n_crate);
+}
+
+unsigned PackedMetric::Send(RedisPipeline *pipeline, const char *key, unsigned expire) {
+  // the arguments are copied, so the buffer can be re-used right away
+  if (expire != 0) {
+    std::string expire_str = std::to_string(expire);
+    const char *argv[5] = {"SET", key, _buffer.data(), "EX", expire_str.c_str()};
+    size_t argvlen[5] = {3, strlen(key), _buffer.size(), 2, expire_str.size()};
+    pipeline->AppendArgv(5, argv, argvlen);
+  }
+  else {
+    const char *argv[3] = {"SET", key, _buffer.data()};
+    size_t argvlen[3] = {3, strlen(key), _buffer.size()};
+    pipeline->AppendArgv(3, argv, argvlen);
+  }
+  return 1;
+}
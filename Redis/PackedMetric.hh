@@ -0,0 +1,71 @@
+#ifndef PackedMetric_h
+#define PackedMetric_h
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <hiredis/hiredis.h>
+
+#include "RedisPipeline.hh"
+
+/*
+ * Writes all the values of a metric in a stream to a single redis key.
+ *
+ * The value of the key is binary, with everything little-endian:
+ *   uint32 version (currently 1)
+ *   uint32 number of wires
+ *   uint32 number of fems
+ *   uint32 number of crates
+ *   float32 values for each wire, then each fem (numbered over all
+ *     crates, crate by crate), then each crate
+ *
+ * It is sent with a single binary-safe "SET key value [EX expire]".
+*/
+
+namespace daqAnalysis {
+  class PackedMetric;
+}
+
+class daqAnalysis::PackedMetric {
+public:
+  static const uint32_t kVersion = 1;
+  static const size_t kHeaderSize = 4 * sizeof(uint32_t);
+
+  // clear the buffer and write the header
+  void Start(unsigned n_wire, unsigned n_fem, unsigned n_crate);
+  // add the next value
+  inline void Add(float value);
+  // append the SET command to the redis pipeline. Returns the number
+  // of commands sent
+  unsigned Send(daqAnalysis::RedisPipeline *pipeline, const char *key, unsigned expire);
+
+  const char *Data() const { return _buffer.data(); }
+  size_t Size() const { return _buffer.size(); }
+
+private:
+  inline void AddU32(uint32_t value);
+
+  std::vector<char> _buffer;
+};
+
+inline void daqAnalysis::PackedMetric::AddU32(uint32_t value) {
+  // write out byte by byte so the layout doesn't depend on the host
+  char bytes[4] = {
+    (char)(value & 0xff),
+    (char)((value >> 8) & 0xff),
+    (char)((value >> 16) & 0xff),
+    (char)((value >> 24) & 0xff)
+  };
+  _buffer.insert(_buffer.end(), bytes, bytes + 4);
+}
+
+inline void daqAnalysis::PackedMetric::Add(float value) {
+  static_assert(sizeof(float) == sizeof(uint32_t), "float must be 32 bits");
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  AddU32(bits);
+}
+
+#endif /* PackedMetric_h */
@@ -0,0 +1,137 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <cinttypes>
+
+#include <hiredis/hiredis.h>
+
+#include "PackedMetric.hh"
+#include "RedisAsyncOutput.hh"
+#include "RedisPipeline.hh"
+
+/*
+ * Compares the time it takes to publish per-channel metrics to redis
+ * with one key per wire/fem/crate against one packed key per metric.
+ *
+ * Usage: RedisPublishBenchmark [hostname] [n_wire] [n_fem] [n_ticks] [async]
+ *
+ * If "async" is given, commands are sent through a RedisAsyncOutput
+ * (as with the async_output option) instead of waiting on each reply.
+ *
+ * Keys are written under stream/benchmark and expire after a minute.
+ *
+ * With the defaults (11264 wires, 176 fems, 20 ticks) against a local
+ * redis-server 6.2 on one core, the per-key format took ~520 ms/tick
+ * (183056 commands) and the packed format ~1 ms/tick (8 commands), the
+ * same with or without "async".
+*/
+
+using namespace daqAnalysis;
+
+// same as the number of per-channel metrics sent by the Redis manager
+static const unsigned n_metrics = 8;
+static const unsigned expire = 60;
+
+static void finishPipeline(redisContext *context, unsigned n_commands) {
+  void *reply;
+  for (unsigned i = 0; i < n_commands; i++) {
+    if (redisGetReply(context, &reply) != REDIS_OK) {
+      std::cerr << "Redis error: " << context->errstr << std::endl;
+      exit(1);
+    }
+    freeReplyObject(reply);
+  }
+}
+
+// what DetectorMetric::Send() does
+static unsigned sendKeys(RedisPipeline *pipeline, uint64_t index, const char *name, const std::vector<float> &wire,
+    const std::vector<float> &fem, const std::vector<float> &crate) {
+  for (unsigned i = 0; i < wire.size(); i++) {
+    pipeline->Append("SET stream/benchmark:%" PRIu64 ":%s:wire:%i %f", index, name, i, wire[i]);
+    pipeline->Append("EXPIRE stream/benchmark:%" PRIu64 ":%s:wire:%i %u", index, name, i, expire);
+  }
+  for (unsigned i = 0; i < fem.size(); i++) {
+    pipeline->Append("SET stream/benchmark:%" PRIu64 ":%s:crate:0:fem:%i %f", index, name, i, fem[i]);
+    pipeline->Append("EXPIRE stream/benchmark:%" PRIu64 ":%s:crate:0:fem:%i %u", index, name, i, expire);
+  }
+  for (unsigned i = 0; i < crate.size(); i++) {
+    pipeline->Append("SET stream/benchmark:%" PRIu64 ":%s:crate:%i %f", index, name, i, crate[i]);
+    pipeline->Append("EXPIRE stream/benchmark:%" PRIu64 ":%s:crate:%i %u", index, name, i, expire);
+  }
+  return 2 * (wire.size() + fem.size() + crate.size());
+}
+
+// what DetectorMetric::SendPacked() does
+static unsigned sendPacked(RedisPipeline *pipeline, uint64_t index, const char *name, const std::vector<float> &wire,
+    const std::vector<float> &fem, const std::vector<float> &crate, PackedMetric &packed) {
+  packed.Start(wire.size(), fem.size(), crate.size());
+  for (float val: wire) packed.Add(val);
+  for (float val: fem) packed.Add(val);
+  for (float val: crate) packed.Add(val);
+  char key[256];
+  snprintf(key, sizeof(key), "stream/benchmark:%" PRIu64 ":%s:packed", index, name);
+  return packed.Send(pipeline, key, expire);
+}
+
+int main(int argc, char **argv) {
+  const char *hostname = argc > 1 ? argv[1] : "127.0.0.1";
+  unsigned n_wire = argc > 2 ? atoi(argv[2]) : 11264;
+  unsigned n_fem = argc > 3 ? atoi(argv[3]) : 176;
+  unsigned n_ticks = argc > 4 ? atoi(argv[4]) : 20;
+  bool async = argc > 5 && std::string(argv[5]) == "async";
+
+  redisContext *context = redisConnect(hostname, 6379);
+  if (context == nullptr || context->err) {
+    std::cerr << "Redis error: " << (context ? context->errstr : "can't allocate context") << std::endl;
+    return 1;
+  }
+
+  std::vector<float> wire(n_wire), fem(n_fem), crate(1);
+  for (unsigned i = 0; i < n_wire; i++) wire[i] = 2000. + (i % 17) * 0.1;
+  for (unsigned i = 0; i < n_fem; i++) fem[i] = 2000. + (i % 5) * 0.1;
+  crate[0] = 2000.;
+
+  PackedMetric packed;
+  for (int format = 0; format < 2; format++) {
+    // a new output per format so the stats are separate
+    std::unique_ptr<RedisAsyncOutput> output;
+    if (async) output.reset(new RedisAsyncOutput(hostname, 6379, 1000000));
+    // commands are buffered to be handed to the async output
+    RedisPipeline pipeline(context, async);
+
+    unsigned n_commands = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned tick = 0; tick < n_ticks; tick++) {
+      unsigned tick_commands = 0;
+      for (unsigned metric = 0; metric < n_metrics; metric++) {
+        std::string name = "metric" + std::to_string(metric);
+        tick_commands += (format == 0) ?
+          sendKeys(&pipeline, tick, name.c_str(), wire, fem, crate) :
+          sendPacked(&pipeline, tick, name.c_str(), wire, fem, crate, packed);
+      }
+      if (output) {
+        output->Submit(pipeline.Commands().data(), pipeline.Commands().size(), tick_commands);
+        pipeline.Clear();
+      }
+      else {
+        finishPipeline(context, tick_commands);
+      }
+      n_commands += tick_commands;
+    }
+    // count the time waiting on the last replies
+    if (output) output->Stop();
+    auto end = std::chrono::high_resolution_clock::now();
+    float ms = std::chrono::duration<float, std::milli>(end - start).count();
+
+    std::cout << (format == 0 ? "PER KEY" : "PACKED ") << " : " << n_commands / n_ticks << " commands/tick "
+              << ms / n_ticks << " ms/tick" << std::endl;
+    if (output) output->PrintStats();
+  }
+
+  redisFree(context);
+  return 0;
+}
@@ -15,14 +15,18 @@
 #include "lardataobj/RawData/RawDigit.h"
 
 #include "../ChannelData.hh"
+#include "../ChannelDataStore.hh"
 #include "../HeaderData.hh"
 #include "../Noise.hh"
 #include "../VSTChannelMap.hh"
 #include "../FFT.hh"
 #include "../EventInfo.hh"
+#include "../WaveformView.hh"
 
 #include "Redis.hh"
 #include "RedisData.hh"
+#include "SnapshotWorker.hh"
+#include "CorrelationAccumulator.hh"
 
 using namespace daqAnalysis;
 using namespace std;
@@ -30,6 +34,7 @@ using namespace std;
 Redis::Redis(Redis::Config &config, daqAnalysis::VSTChannelMap *channel_map):
   _channel_map(channel_map),
   context(redisConnect(config.hostname.c_str(), 6379)),
+  _pipeline(context, config.async_output),
   _now(std::time(nullptr)),
   _start(std::time(nullptr)),
   _snapshot_time(config.snapshot_time),
@@ -48,25 +53,21 @@ Redis::Redis(Redis::Config &config, daqAnalysis::VSTChannelMap *channel_map):
   _first_run(true),
 
   // allocate and zero-initalize all of the metrics
-  _rms(config.NStreams(), RedisRMS(channel_map)),
-  _baseline(config.NStreams(), RedisBaseline(channel_map)),
-  _baseline_rms(config.NStreams(), RedisBaselineRMS(channel_map)),
-  _dnoise(config.NStreams(), RedisDNoise(channel_map)),
-  _pulse_height(config.NStreams(), RedisPulseHeight(channel_map)),
-  _occupancy(config.NStreams(), RedisOccupancy(channel_map)),
-  _rawhit_pulse_height(config.NStreams(),RedisRawHitPulseHeight(channel_map)),
-  _rawhit_occupancy(config.NStreams(), RedisRawHitOccupancy(channel_map)),
+  _channel_metrics(config.NStreams(), channel_map),
 
   // and the header stuff
   _frame_no(config.NStreams(), RedisFrameNo(channel_map)),
   _trig_frame_no(config.NStreams(), RedisTrigFrameNo(channel_map)),
   _event_no(config.NStreams(), RedisEventNo(channel_map)),
   _blocks(config.NStreams(), RedisBlocks(channel_map)),
+  _current_frame_no(channel_map),
+  _current_trig_frame_no(channel_map),
+  _current_event_no(channel_map),
+  _current_blocks(channel_map),
   
   //event info
   _purity(config.NStreams(), RedisPurity(channel_map)), 
 
-  _fft_manager((config.waveform_input_size > 0) ? config.waveform_input_size: 0),
   _do_timing(config.timing),
   _config(config)
 {
@@ -74,15 +75,36 @@ Redis::Redis(Redis::Config &config, daqAnalysis::VSTChannelMap *channel_map):
     std::cerr << "Redis error: " <<  context->errstr << std::endl;
     exit(1);
   }
+  if (config.async_output) {
+    _async_output.reset(new RedisAsyncOutput(config.hostname, 6379, config.max_in_flight, config.timing));
+  }
+  if (config.snapshot_time > 0) {
+    _snapshot_worker.reset(new SnapshotWorker(config, channel_map));
+  }
+  if (config.correlation_accumulate) {
+    if (config.correlation_stream < config.stream_take.size()) {
+      _correlation_accumulator.reset(new CorrelationAccumulator(config));
+    }
+    else {
+      std::cerr << "WARNING: correlation_stream " << config.correlation_stream << " is not a stream. "
+                << "Not summing the correlation matrix." << std::endl;
+    }
+  }
 }
 
 Redis::~Redis() {
-  //redisAsyncDisconnect(context);
+  // finish off the last snapshot
+  _snapshot_worker.reset();
+  _correlation_accumulator.reset();
+  // wait on any outstanding replies
+  _async_output.reset();
   redisFree(context);
 }
 
 // flush the reamining data
 void Redis::FlushData() {
+  // let the last snapshot go out
+  if (_snapshot_worker) _snapshot_worker->Stop();
   // don't flush if configured
   if (!_config.flush_data) return;
 
@@ -100,21 +122,21 @@ void Redis::FlushData() {
     SendChannelData();
     SendHeaderData();
 
-    void *reply;
-    reply = redisCommand(context, "SET last_subrun_no %u", _this_subrun);
-    freeReplyObject(reply);
+    _pipeline.Append("SET last_subrun_no %u", _this_subrun);
     
     // same with run
-    reply = redisCommand(context, "SET this_run_no %u", _this_run);
-    freeReplyObject(reply);
+    _pipeline.Append("SET this_run_no %u", _this_run);
     
     // send Redis "Alive" signal
-    reply = redisCommand(context, "SET MONITOR_%s_ALIVE %u", _config.monitor_name.c_str(), std::time(nullptr));
-    freeReplyObject(reply);
+    _pipeline.Append("SET MONITOR_%s_ALIVE %u", _config.monitor_name.c_str(), std::time(nullptr));
+
+    FinishPipeline(3);
   }
   else {
     PrintChannelData();
   }
+  // send out the last summed correlation matrix
+  if (_correlation_accumulator) _correlation_accumulator->Stop();
 }
 
 void Redis::StartSend(unsigned run, unsigned sub_run) {
@@ -169,25 +191,30 @@ void Redis::StartSend(uint64_t now, unsigned run, unsigned sub_run) {
 void Redis::FinishSend() {
   if (_do_timing) {
     _timing.Print();
+    if (_async_output) {
+      _async_output->PrintStats();
+    }
   }
 
   if (!_config.print_data) {
+    unsigned n_commands = 0;
     // if a new subrun, set the value in redis
     if (_this_subrun != _last_subrun) {
-      void *reply = redisCommand(context, "SET last_subrun_no %u", _last_subrun);
-      freeReplyObject(reply);
+      _pipeline.Append("SET last_subrun_no %u", _last_subrun);
+      n_commands ++;
     }
 
   // same with run
   if (_this_run != _last_run) {
-    void *reply = redisCommand(context, "SET this_run_no %u", _this_run);
-    freeReplyObject(reply);
+    _pipeline.Append("SET this_run_no %u", _this_run);
+    n_commands ++;
   }
 
   // send Redis "Alive" signal
-  void *reply = redisCommand(context, "SET MONITOR_%s_ALIVE %u", _config.monitor_name.c_str(), std::time(nullptr));
-  freeReplyObject(reply);
+  _pipeline.Append("SET MONITOR_%s_ALIVE %u", _config.monitor_name.c_str(), std::time(nullptr));
+  n_commands ++;
 
+  FinishPipeline(n_commands);
   }
   
   _last_subrun = _this_subrun;
@@ -225,7 +252,7 @@ void Redis::SendEventInfo(){
   for (size_t i = 0; i < _n_streams; i++) {
       unsigned index = _now / _stream_take[i];
       const char *stream_name = std::to_string(_stream_take[i]).c_str(); 
-      n_commands += _purity[i].Send(context, index, stream_name, _stream_expire[i]);
+      n_commands += _purity[i].Send(&_pipeline, index, stream_name, _stream_expire[i]);
       _purity[i].Clear();
   }
 
@@ -238,7 +265,7 @@ void Redis::SendEventInfo(){
 
     // send headers to redis if need be
     if (_stream_send[sub_run_ind]) {
-      n_commands += _purity[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
+      n_commands += _purity[sub_run_ind].Send(&_pipeline, _last_subrun, sub_run_ident, _sub_run_stream_expire);
 
       // the metric was taken iff it was sent to redis
       _purity[sub_run_ind].Clear();
@@ -263,40 +290,57 @@ void Redis::HeaderData(vector<daqAnalysis::HeaderData> *header_data) {
 }
 
 void Redis::FillHeaderData(vector<daqAnalysis::HeaderData> *header_data) {
+  // header info is only filled into the current bucket -- 
+  // it is merged into the streams when they are sent
+  const daqAnalysis::ChannelLookup &lookup = _channel_map->Lookup();
   for (auto &header: *header_data) {
-    // update header info in each stream
-    for (size_t i = 0; i < _n_streams; i++) {
-      // index into the fem data cache
-      unsigned fem_ind = _channel_map->SlotIndex(header);
-      _event_no[i].Fill(header, fem_ind);
-      _frame_no[i].Fill(header, fem_ind);
-      _trig_frame_no[i].Fill(header, fem_ind);
-      _blocks[i].Fill(header, fem_ind);
-    }
+    // index into the fem data cache (over all crates). Headers from crates
+    // that aren't in the map go with the first one
+    int crate_ind = lookup.CrateIndex(header.crate);
+    unsigned fem_ind = lookup.GlobalFEM((crate_ind < 0) ? 0 : crate_ind, _channel_map->SlotIndex(header));
+    _current_event_no.Fill(header, fem_ind);
+    _current_frame_no.Fill(header, fem_ind);
+    _current_trig_frame_no.Fill(header, fem_ind);
+    _current_blocks.Fill(header, fem_ind);
   }
   // update all of the metrics
+  _current_event_no.Update();
+  _current_frame_no.Update();
+  _current_trig_frame_no.Update();
+  _current_blocks.Update();
+}
+
+void Redis::RollupHeaderData() {
   for (size_t i = 0; i < _n_streams; i++) {
-    _event_no[i].Update();
-    _frame_no[i].Update();
-    _trig_frame_no[i].Update();
-    _blocks[i].Update();
-  }
+    _event_no[i].Merge(_current_event_no);
+    _frame_no[i].Merge(_current_frame_no);
+    _trig_frame_no[i].Merge(_current_trig_frame_no);
+    _blocks[i].Merge(_current_blocks);
+  }
+  _current_event_no.Clear();
+  _current_frame_no.Clear();
+  _current_trig_frame_no.Clear();
+  _current_blocks.Clear();
 }
 
 void Redis::SendHeaderData() {
   if (_do_timing) {
     _timing.StartTime();
   }
+  // streams only see header info once it is rolled up
+  if (AnyStreamSend()) {
+    RollupHeaderData();
+  }
   unsigned n_commands = 0;
   for (size_t i = 0; i < _stream_take.size(); i++) {
     // send headers to redis if need be
     if (_stream_send[i]) {
       uint64_t index = _now / _stream_take[i];
       const char *stream_name = std::to_string(_stream_take[i]).c_str(); 
-      n_commands += _event_no[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _frame_no[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _trig_frame_no[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _blocks[i].Send(context, index, stream_name, _stream_expire[i]);
+      n_commands += _event_no[i].Send(&_pipeline, index, stream_name, _stream_expire[i]);
+      n_commands += _frame_no[i].Send(&_pipeline, index, stream_name, _stream_expire[i]);
+      n_commands += _trig_frame_no[i].Send(&_pipeline, index, stream_name, _stream_expire[i]);
+      n_commands += _blocks[i].Send(&_pipeline, index, stream_name, _stream_expire[i]);
       // the metric was taken iff it was sent to redis
       _event_no[i].Clear();
       _frame_no[i].Clear();
@@ -313,10 +357,10 @@ void Redis::SendHeaderData() {
 
     // send headers to redis if need be
     if (_stream_send[sub_run_ind]) {
-      n_commands += _event_no[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _frame_no[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _trig_frame_no[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _blocks[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
+      n_commands += _event_no[sub_run_ind].Send(&_pipeline, _last_subrun, sub_run_ident, _sub_run_stream_expire);
+      n_commands += _frame_no[sub_run_ind].Send(&_pipeline, _last_subrun, sub_run_ident, _sub_run_stream_expire);
+      n_commands += _trig_frame_no[sub_run_ind].Send(&_pipeline, _last_subrun, sub_run_ident, _sub_run_stream_expire);
+      n_commands += _blocks[sub_run_ind].Send(&_pipeline, _last_subrun, sub_run_ident, _sub_run_stream_expire);
 
       // the metric was taken iff it was sent to redis
       _event_no[sub_run_ind].Clear();
@@ -335,263 +379,37 @@ void Redis::SendHeaderData() {
 
 }
 
-inline size_t pushFFTDat(char *buffer, float re, float im) {
-  float dat = re*re + im*im;
-  return sprintf(buffer, " %f", dat);
-}
-
-void Redis::Snapshot(vector<daqAnalysis::ChannelData> *per_channel_data, vector<NoiseSample> *noise, vector<vector<int>> *fem_summed_waveforms, 
-    std::vector<std::vector<double>> *fem_summed_fft, const art::ValidHandle<std::vector<raw::RawDigit>> &digits, const std::vector<unsigned> &channel_to_index) {
-  size_t n_commands = 0;
-
-  // record the time for reference
-  redisAppendCommand(context, "SET snapshot:time %i", _now);
-  redisAppendCommand(context, "SET snapshot:sub_run %i", _this_subrun);
-  redisAppendCommand(context, "SET snapshot:run %i", _this_run);
-  n_commands += 3;
-
-  if (_do_timing) _timing.StartTime();
-
-  // stuff per fem
-  if (fem_summed_waveforms->size() != 0) {
-    for (unsigned fem_ind = 0; fem_ind < _channel_map->NFEM(); fem_ind++) {
-      // sending the summed waveforms to redis
-      // delete old list
-      redisAppendCommand(context, "DEL snapshot:waveform:fem:%i", fem_ind);
-      {
-	// buffer for writing out waveform
-	size_t buffer_len = (*fem_summed_waveforms)[fem_ind].size() * 10 + 50;
-	char *buffer = new char[buffer_len];
-	
-	// print in the base of the command
-	// assumes fem_summed_waveforms are already sorted by id
-	size_t print_len = sprintf(buffer, "RPUSH snapshot:waveform:fem:%i", fem_ind);
-	char *buffer_index = buffer + print_len;
-	for (int dat: (*fem_summed_waveforms)[fem_ind]) {
-	  print_len += sprintf(buffer_index, " %i", dat); 
- 	  buffer_index = buffer + print_len;
-	  if (print_len >= buffer_len - 1) {
-            std::cerr << "ERROR: BUFFER OVERFLOW IN WAVEFORM DATA" << std::endl;
-            std::exit(1);
-          }
-	}
-	// submit the command
-	redisAppendCommand(context, buffer);
-	n_commands += 2;
-	
-	delete buffer;
-      }
-    }
-  }
-  // send fft's
-  if (fem_summed_fft->size() != 0) {
-    for (unsigned fem_ind = 0; fem_ind < _channel_map->NFEM(); fem_ind++) {
-      // sending the ffts of summed waveforms to redis
-      // delete old list
-      redisAppendCommand(context, "DEL snapshot:fft:fem:%i", fem_ind);
-      {
-        // allocate buffer for fft storage command
-        // FFT's are comprised of floats, which can get pretty big
-        // so assume you need ~25 digits per float to be on the safe side
-	size_t buffer_len = (*fem_summed_fft)[fem_ind].size() * 25 + 50;
-	char *buffer = new char[buffer_len];
-	
-	// print in the base of the command
-	// assumes fem_summed_fft is already sorted by id
-	size_t print_len = sprintf(buffer, "RPUSH snapshot:fft:fem:%i", fem_ind);
-	char *buffer_index = buffer + print_len;
-	for (double dat: (*fem_summed_fft)[fem_ind]) {
-	  print_len += sprintf(buffer_index, " %f", dat); 
- 	  buffer_index = buffer + print_len;
-	  if (print_len >= buffer_len - 1) {
-            std::cerr << "ERROR: BUFFER OVERFLOW IN WAVEFORM DATA" << std::endl;
-            std::exit(1);
-          }
-	}
-	// submit the command
-	redisAppendCommand(context, buffer);
-	n_commands += 2;
-	
-	delete buffer;
-      }
-    }
-  }
-
-  if (_do_timing) _timing.EndTime(&_timing.fem_waveforms);
-
-  // stuff per channel
-  for (auto &channel: *per_channel_data) { 
-    if (_do_timing) {
-      _timing.StartTime();
-    }
-    // store the waveform and fft's
-    // also delete old lists
-    redisAppendCommand(context, "DEL snapshot:waveform:wire:%i", channel.channel_no);
-    
-    // we're gonna put the whole waveform into one very large list 
-    // allocate enough space for it 
-    // Assume at max 4 chars per int plus a space each plus another 50 chars to store the base of the command
-    {
-      unsigned digits_ind = channel_to_index[channel.channel_no];
-      auto waveform = (*digits)[digits_ind].ADCs();
-      size_t buffer_len = waveform.size() * 10 + 50;
-      char *buffer = new char[buffer_len];
-
-      // print in the base of the command
-      size_t print_len = sprintf(buffer, "RPUSH snapshot:waveform:wire:%i", channel.channel_no);
-      char *buffer_index = buffer + print_len;
-      // throw in all of the data points
-      for (int16_t dat: waveform) {
-	/* IGNORE: Possible evil way of pushing stuff to redis to be possibly used later */
-	// add the space from the previous command
-	//*buffer_index = ' ';
-	//print_len ++;
-	//buffer_index = buffer + print_len;
-	
-	// add the number in binary:
-	// coerce the integer into a char[2]:
-	//char *binary_dat = (char *) &dat;
-	// to avoid null-termination, mask w/ 
-	//buffer_index[0] = binary_dat[0];
-	//buffer_index[1] = binary_dat[1];
-	
-	// 2 bytes
-	//print_len += 2;
-	
-	print_len += sprintf(buffer_index, " %i", dat); 
-	
-	buffer_index = buffer + print_len;
-	
-	if (print_len >= buffer_len - 1) {
-          std::cerr << "ERROR: BUFFER OVERFLOW IN WAVEFORM DATA" << std::endl;
-          std::exit(1);
-        }
-      }
-      // null terminate the string
-      //*buffer_index = '\0';
-      
-      redisAppendCommand(context, buffer);
-      n_commands += 2;
-      // delete the buffer
-      delete buffer;
-    }
-
-    if (_do_timing) {
-      _timing.EndTime(&_timing.send_waveform);
-    }
-
-    if (_do_timing) {
-      _timing.StartTime();
-    }
-
-    redisAppendCommand(context, "DEL snapshot:fft:wire:%i", channel.channel_no);
-
-    {
-      unsigned digits_ind = channel_to_index[channel.channel_no];
-      auto waveform = (*digits)[digits_ind].ADCs();
-      // allocate buffer for fft storage command
-      // FFT's are comprised of floats, which can get pretty big
-      // so assume you need ~25 digits per float to be on the safe side
-      size_t buffer_len = (waveform.size()/2 +1) * 25 + 50;
-      char *buffer = new char[buffer_len];
-      
-      // print in the base of the command
-      size_t print_len = sprintf(buffer, "RPUSH snapshot:fft:wire:%i", channel.channel_no);
-      char *buffer_index = buffer + print_len;
-      // throw in all of the data points
-      
-      // use already calculated FFT if there
-      if (channel.fft_real.size() != 0) {
-        for (size_t i = 0; i < channel.fft_real.size(); i++) {
-          print_len += pushFFTDat(buffer_index, channel.fft_real[i], channel.fft_imag[i]);
-          buffer_index = buffer + print_len;
-        }
-      }
-      // otherwise calculate it yourself
-      else {
-        // re-allocate if necessary
-        if (_fft_manager.InputSize() != waveform.size()) {
-          _fft_manager.Set(waveform.size());
-        }
-        // fill up the fft data in
-        for (size_t i = 0; i < waveform.size(); i++) {
-          double *input = _fft_manager.InputAt(i);
-          *input = (double) waveform[i];
-        }
-        _fft_manager.Execute();
-        int adc_fft_size = _fft_manager.OutputSize();
-        for (int i = 0; i < adc_fft_size; i++) {
-          print_len += pushFFTDat(buffer_index, _fft_manager.ReOutputAt(i), _fft_manager.ImOutputAt(i));
-          buffer_index = buffer + print_len;
-        }
-      }
-      redisAppendCommand(context, buffer);
-      n_commands += 2;
-      // delete the buffer
-      delete buffer;
-    }
-
-    if (_do_timing) {
-      _timing.EndTime(&_timing.send_fft);
-    }
-  }
-
+void Redis::Snapshot(daqAnalysis::ChannelDataStore *per_channel_data, vector<NoiseSample> *noise, vector<vector<int>> *fem_summed_waveforms, 
+    std::vector<std::vector<double>> *fem_summed_fft, std::vector<std::vector<int16_t>> *waveforms) {
   if (_do_timing) {
     _timing.StartTime();
   }
-  // also store the noise correlation matrix if taking a snapshot
-  redisAppendCommand(context, "DEL snapshot:correlation");
-  
-  {
-    // allocate for the covariance matrix command
-    // again, get ~25 digits for each float
-    size_t buffer_len = ((noise->size() + 1) * noise->size() / 2) * 25 + 50;
-    char *buffer = new char[buffer_len];
-    
-    // print in the base of the command
-    size_t print_len = sprintf(buffer, "RPUSH snapshot:correlation");
-    char *buffer_index = buffer + print_len;
-    // Only calculate the upper-right half of the matrix since it is symmetric
-    // The index 'k' into the list of the i-th sample with the j-th sample (where i <= j) is:
-    // k = ((n+1)*n/2) - (n-i+1)*(n-i)/2 + j - i
-    for (size_t i = 0; i < noise->size(); i++) {
-      for (size_t j = i; j < noise->size(); j++) {
-        unsigned digits_i = channel_to_index[i];
-        unsigned digits_j = channel_to_index[j];
-        auto waveform_i = (*digits)[digits_i].ADCs();
-        auto waveform_j = (*digits)[digits_j].ADCs();
-
-        float correlation = (*noise)[i].Correlation(waveform_i, (*noise)[j], waveform_j);
-        print_len += sprintf(buffer_index, " %f", correlation);
-        buffer_index = buffer + print_len;
-      }
-    }
-    redisAppendCommand(context, buffer);
-    n_commands += 2;
-    delete buffer;
-  }
-
+  // hand what the snapshot needs to the worker and let it build and send it
+  _snapshot_worker->Push(std::make_shared<SnapshotInput>(_now, _this_run, _this_subrun, per_channel_data->channel_no, *noise,
+    *fem_summed_waveforms, *fem_summed_fft, *waveforms));
   if (_do_timing) {
-    _timing.EndTime(&_timing.correlation);
+    _timing.EndTime(&_timing.copy_snapshot);
   }
+}
 
-  if (_do_timing) {
-    _timing.StartTime();
-  }
-  FinishPipeline(n_commands);
-  if (_do_timing) {
-    _timing.EndTime(&_timing.clear_pipeline);
-  }
-  
+void Redis::AccumulateCorrelation(vector<NoiseSample> *noise_samples, const std::vector<raw::RawDigit> &digits,
+    const std::vector<unsigned> &channel_to_index) {
+  if (!_correlation_accumulator) return;
+  // (timed by the accumulator, since this can run on a different thread than the rest of the manager)
+  _correlation_accumulator->Add(*noise_samples, digits, channel_to_index);
 }
 
 bool Redis::WillTakeSnapshot() {
-  int64_t time_diff = ((int)_now - _last_snapshot);
-  return _snapshot_time > 0 && time_diff >= _snapshot_time && _last_snapshot != _now;
+  return WillTakeSnapshot(_now, _last_snapshot);
+}
+
+bool Redis::WillTakeSnapshot(uint64_t now, uint64_t last_snapshot) const {
+  int64_t time_diff = ((int)now - last_snapshot);
+  return _snapshot_time > 0 && time_diff >= _snapshot_time && last_snapshot != now;
 }
 
-void Redis::ChannelData(vector<daqAnalysis::ChannelData> *per_channel_data, vector<NoiseSample> *noise_samples, vector<vector<int>> *fem_summed_waveforms, 
-    std::vector<std::vector<double>> *fem_summed_fft, const art::ValidHandle<std::vector<raw::RawDigit>> &digits, const std::vector<unsigned> &channel_to_index) {
+void Redis::ChannelData(daqAnalysis::ChannelDataStore *per_channel_data, vector<NoiseSample> *noise_samples, vector<vector<int>> *fem_summed_waveforms, 
+    std::vector<std::vector<double>> *fem_summed_fft, std::vector<std::vector<int16_t>> *waveforms) {
 
   if (!_config.print_data) {
     SendChannelData();
@@ -601,84 +419,38 @@ void Redis::ChannelData(vector<daqAnalysis::ChannelData> *per_channel_data, vect
   }
   FillChannelData(per_channel_data);
 
-  int64_t time_diff = ((int)_now - _last_snapshot);
-  bool take_snapshot = _snapshot_time > 0 && time_diff >= _snapshot_time && _last_snapshot != _now;
-  if (take_snapshot) {
-    Snapshot(per_channel_data, noise_samples, fem_summed_waveforms, fem_summed_fft, digits, channel_to_index);
+  if (WillTakeSnapshot() && waveforms != NULL) {
+    Snapshot(per_channel_data, noise_samples, fem_summed_waveforms, fem_summed_fft, waveforms);
     _last_snapshot = _now;
   }
 
 }
 
-void Redis::FillChannelData(vector<daqAnalysis::ChannelData> *per_channel_data) {
+void Redis::FillChannelData(daqAnalysis::ChannelDataStore *per_channel_data) {
   if (_do_timing) {
     _timing.StartTime();
   }
 
-  // iterate over crates and fems
-  for (unsigned crate = 0; crate < _channel_map->NCrates(); crate++) {
-    for (unsigned fem = 0; fem < _channel_map->NFEM(); fem++) {
-      // @VST INSTALLATION: OK -- crate is always 0
-      // index into the fem data cache
-      unsigned fem_ind = fem;
-
-      for (unsigned channel = 0; channel < _channel_map->NSlotChannel(); channel ++) {
-        if (!_channel_map->IsMappedChannel(channel, fem, crate, true)) continue;
-
-        // get the wire number
-	uint16_t wire = _channel_map->Channel2Wire(channel, fem, crate, true);
-
-        // get index of channel on fem
-        unsigned fem_channel_ind = _channel_map->ReadoutChannel2FEMInd(channel, fem, crate, true);
-
-        // since there is only one crate, we can use the wire id as the crate index
-        unsigned crate_channel_ind = wire;
- 
-        // fill metrics for each stream
-        for (size_t i = 0; i < _n_streams; i++) {
-          _rms[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-          _baseline[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-          _baseline_rms[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-          _dnoise[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-          _pulse_height[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-	  _rawhit_pulse_height[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-          _occupancy[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-	  _rawhit_occupancy[i].Fill((*per_channel_data)[wire], crate, crate_channel_ind, fem_ind, fem_channel_ind, wire);
-        }
-
-      }
+  // fill metrics for each stream
+  _channel_metrics.Fill(*per_channel_data);
 
-    }
-  }
   if (_do_timing) {
     _timing.EndTime(&_timing.copy_data);
   }
 
   // update all of the metrics
-  for (size_t i = 0; i < _n_streams; i++) {
-    _rms[i].Update();
-    _baseline[i].Update();
-    _baseline_rms[i].Update();
-    _dnoise[i].Update();
-    _pulse_height[i].Update();
-    _rawhit_pulse_height[i].Update();
-    _occupancy[i].Update();
-    _rawhit_occupancy[i].Update();
-  }
+  _channel_metrics.Update();
 }
 
 void Redis::PrintChannelData() {
+  // streams only see metrics once they are rolled up
+  if (AnyStreamSend()) {
+    _channel_metrics.Rollup();
+  }
   for (size_t i = 0; i < _stream_take.size(); i++) {
     if (_stream_send[i]) {
-      const char *stream_name = std::to_string(_stream_take[i]).c_str(); 
-      _rms[i].Print(stream_name);
-      _baseline[i].Print(stream_name);
-      _baseline_rms[i].Print(stream_name);
-      _dnoise[i].Print(stream_name);
-      _occupancy[i].Print(stream_name);
-      _pulse_height[i].Print(stream_name);
-      _rawhit_occupancy[i].Print(stream_name);
-      _rawhit_pulse_height[i].Print(stream_name);
+      std::string stream_name = std::to_string(_stream_take[i]); 
+      _channel_metrics.Print(i, stream_name.c_str());
     }
   }
 
@@ -689,20 +461,23 @@ void Redis::PrintChannelData() {
     
       std::stringstream ss;
       ss << "sub_run_" << _this_run;
-      const char *stream_name = ss.str().c_str();
-      _rms[sub_run_ind].Print(stream_name);
-      _baseline[sub_run_ind].Print(stream_name);
-      _baseline_rms[sub_run_ind].Print(stream_name);
-      _dnoise[sub_run_ind].Print(stream_name);
-      _occupancy[sub_run_ind].Print(stream_name);
-      _pulse_height[sub_run_ind].Print(stream_name);
-      _rawhit_occupancy[sub_run_ind].Print(stream_name);
-      _rawhit_pulse_height[sub_run_ind].Print(stream_name);
+      std::string stream_name = ss.str();
+      _channel_metrics.Print(sub_run_ind, stream_name.c_str());
     }
   }
 }
 
 void Redis::SendChannelData() {
+  // streams only see metrics once they are rolled up
+  if (AnyStreamSend()) {
+    if (_do_timing) {
+      _timing.StartTime();
+    }
+    _channel_metrics.Rollup();
+    if (_do_timing) {
+      _timing.EndTime(&_timing.copy_data);
+    }
+  }
   unsigned n_commands = 0;
   for (size_t i = 0; i < _stream_take.size(); i++) {
     // Send stuff to redis if it's time
@@ -711,25 +486,14 @@ void Redis::SendChannelData() {
         _timing.StartTime();
       }
       uint64_t index = _now / _stream_take[i];
-      const char *stream_name = std::to_string(_stream_take[i]).c_str(); 
+      std::string stream_name = std::to_string(_stream_take[i]); 
       // metrics control the sending of everything else
-      n_commands += _rms[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _baseline[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _baseline_rms[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _dnoise[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _occupancy[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _pulse_height[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _rawhit_occupancy[i].Send(context, index, stream_name, _stream_expire[i]);
-      n_commands += _rawhit_pulse_height[i].Send(context, index, stream_name, _stream_expire[i]);
-
-      _rms[i].Clear();
-      _baseline[i].Clear();
-      _baseline_rms[i].Clear();
-      _dnoise[i].Clear();
-      _pulse_height[i].Clear();
-      _occupancy[i].Clear();
-      _rawhit_pulse_height[i].Clear();
-      _rawhit_occupancy[i].Clear();
+      n_commands += _channel_metrics.Send(i, &_pipeline, index, stream_name.c_str(), _stream_expire[i], _config.packed_metrics);
+      _channel_metrics.Clear(i);
+      // sent separately on the accumulator thread
+      if (_correlation_accumulator && i == _config.correlation_stream) {
+        _correlation_accumulator->Publish(index, stream_name, _stream_expire[i]);
+      }
 
       if (_do_timing) {
         _timing.EndTime(&_timing.send_metrics);
@@ -747,28 +511,15 @@ void Redis::SendChannelData() {
 
       std::stringstream ss;
       ss << "sub_run_" << _this_run;
-      const char *sub_run_ident = ss.str().c_str();
+      std::string sub_run_ident = ss.str();
 
       // metrics control the sending of everything else
-      n_commands += _rms[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _baseline[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _baseline_rms[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _dnoise[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _occupancy[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _pulse_height[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _rawhit_occupancy[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
-      n_commands += _rawhit_pulse_height[sub_run_ind].Send(context, _last_subrun, sub_run_ident, _sub_run_stream_expire);
+      n_commands += _channel_metrics.Send(sub_run_ind, &_pipeline, _last_subrun, sub_run_ident.c_str(), _sub_run_stream_expire, 
+          _config.packed_metrics);
 
       // the metric was taken iff it was sent to redis
       // clear all of the metrics
-      _rms[sub_run_ind].Clear();
-      _baseline[sub_run_ind].Clear();
-      _baseline_rms[sub_run_ind].Clear();
-      _dnoise[sub_run_ind].Clear();
-      _pulse_height[sub_run_ind].Clear();
-      _occupancy[sub_run_ind].Clear();
-      _rawhit_pulse_height[sub_run_ind].Clear();
-      _rawhit_occupancy[sub_run_ind].Clear();
+      _channel_metrics.Clear(sub_run_ind);
 
       if (_do_timing) {
         _timing.EndTime(&_timing.send_metrics);
@@ -782,6 +533,12 @@ void Redis::SendChannelData() {
 
 // clear out a sequence of Append Commands
 void Redis::FinishPipeline(size_t n_commands) {
+  // hand the formatted commands off to the async context instead
+  if (_async_output) {
+    _async_output->Submit(_pipeline.Commands().data(), _pipeline.Commands().size(), n_commands);
+    _pipeline.Clear();
+    return;
+  }
   // TODO: Error Handling
   void *reply;
   for (size_t i =0; i <n_commands; i++) {
@@ -797,14 +554,15 @@ void RedisTiming::EndTime(float *field) {
   auto now = std::chrono::high_resolution_clock::now();
   *field += std::chrono::duration<float, std::milli>(now- start).count();
 }
-void RedisTiming::Print() {
-  std::cout << "COPY DATA: " << copy_data << std::endl;
-  std::cout << "SEND METRICS: " << send_metrics << std::endl;
-  std::cout << "SEND HEADER : " << send_header_data << std::endl;
-  std::cout << "SEND WAVEFORM " << send_waveform << std::endl;
-  std::cout << "SEND FFT    : " << send_fft << std::endl;
-  std::cout << "CORRELATION : " << correlation << std::endl;
-  std::cout << "CLEAR PIPE  : " << clear_pipeline << std::endl;
-  std::cout << "FEM WAVEFORM: " << fem_waveforms << std::endl;
+void RedisTiming::Print(std::ostream &out) {
+  out << "COPY DATA: " << copy_data << std::endl;
+  out << "SEND METRICS: " << send_metrics << std::endl;
+  out << "SEND HEADER : " << send_header_data << std::endl;
+  out << "SEND WAVEFORM " << send_waveform << std::endl;
+  out << "SEND FFT    : " << send_fft << std::endl;
+  out << "CORRELATION : " << correlation << std::endl;
+  out << "CLEAR PIPE  : " << clear_pipeline << std::endl;
+  out << "FEM WAVEFORM: " << fem_waveforms << std::endl;
+  out << "COPY SNAPSHT: " << copy_snapshot << std::endl;
 }
 
@@ -2,9 +2,12 @@
 #define Redis_h
 
 #include <vector>
+#include <memory>
+#include <algorithm>
 #include <ctime>
 #include <numeric>
 #include <chrono>
+#include <iostream>
 
 #include <hiredis/hiredis.h>
 #include <hiredis/async.h>
@@ -14,16 +17,22 @@
 #include "lardataobj/RawData/RawDigit.h"
 
 #include "../ChannelData.hh"
+#include "../ChannelDataStore.hh"
 #include "../HeaderData.hh"
 #include "../Noise.hh"
 #include "../FFT.hh"
 #include "../EventInfo.hh"
 
 #include "RedisData.hh"
+#include "ChannelMetrics.hh"
+#include "RedisPipeline.hh"
+#include "RedisAsyncOutput.hh"
 
 namespace daqAnalysis {
   class Redis;
   class RedisTiming;
+  class SnapshotWorker;
+  class CorrelationAccumulator;
 
 }
 // keep track of timing information
@@ -38,6 +47,7 @@ public:
   float correlation;
   float clear_pipeline;
   float fem_waveforms;
+  float copy_snapshot;
 
   RedisTiming():
     copy_data(0),
@@ -47,13 +57,14 @@ public:
     send_fft(0),
     correlation(0),
     clear_pipeline(0),
-    fem_waveforms(0)
+    fem_waveforms(0),
+    copy_snapshot(0)
   {}
   
   void StartTime();
   void EndTime(float *field);
 
-  void Print();
+  void Print(std::ostream &out=std::cout);
 };
 
 class daqAnalysis::Redis {
@@ -72,6 +83,24 @@ public:
     bool timing;
     bool flush_data;
     bool print_data;
+    // send each per-channel metric as a single binary key
+    bool packed_metrics;
+    // send commands through a redisAsyncContext instead of waiting on replies
+    bool async_output;
+    // max number of commands waiting on replies in async_output mode
+    unsigned max_in_flight;
+    // store snapshots as binary strings instead of lists of numbers
+    bool binary_snapshot;
+    // compress binary snapshots
+    bool compress_snapshot;
+    // threads used to calculate the snapshot correlation matrix
+    unsigned correlation_threads;
+    // only use every n-th channel in the snapshot correlation matrix
+    unsigned correlation_stride;
+    // also sum the correlation matrix over events and send it with a stream
+    bool correlation_accumulate;
+    // index into stream_take of the stream to send the summed matrix with
+    unsigned correlation_stream;
     Config(): 
       hostname("127.0.0.1"),
       sub_run_stream(false),
@@ -79,7 +108,16 @@ public:
       first_subrun(0),
       snapshot_time(-1),
       waveform_input_size(-1),
-      timing(false) 
+      timing(false),
+      packed_metrics(false),
+      async_output(false),
+      max_in_flight(100000),
+      binary_snapshot(false),
+      compress_snapshot(false),
+      correlation_threads(1),
+      correlation_stride(1),
+      correlation_accumulate(false),
+      correlation_stream(0)
     {}
     unsigned NStreams() { return stream_take.size() + (sub_run_stream ? 1:0); }
   };
@@ -87,9 +125,11 @@ public:
   explicit Redis(Config &config, daqAnalysis::VSTChannelMap *channel_map);
   ~Redis();
   // send info associated w/ ChannelData
-  void ChannelData(std::vector<daqAnalysis::ChannelData> *per_channel_data, std::vector<daqAnalysis::NoiseSample> *noise_samples, 
+  // (snapshots are only taken if the waveform of each channel is provided, indexed
+  // like per_channel_data. A snapshot takes the waveforms and FEM sums, leaving them empty)
+  void ChannelData(daqAnalysis::ChannelDataStore *per_channel_data, std::vector<daqAnalysis::NoiseSample> *noise_samples, 
       std::vector<std::vector<int>> *fem_summed_waveforms, std::vector<std::vector<double>> *fem_summed_fft,
-      const art::ValidHandle<std::vector<raw::RawDigit>> &digits, const std::vector<unsigned> &channel_to_index);
+      std::vector<std::vector<int16_t>> *waveforms);
   // send info associated w/ HeaderData
   void HeaderData(std::vector<daqAnalysis::HeaderData> *header_data);
   // must be called before calling Send functions
@@ -98,8 +138,16 @@ public:
   void StartSend(uint64_t now, unsigned run, unsigned sub_run);
   // must be called after calling Send functions
   void FinishSend();
+  // add the noise of this event to the summed correlation matrix (if configured).
+  // Can be called from a different thread than the rest of the manager
+  void AccumulateCorrelation(std::vector<daqAnalysis::NoiseSample> *noise_samples, const std::vector<raw::RawDigit> &digits,
+      const std::vector<unsigned> &channel_to_index);
   // whether the code will call Snapshot() on ChannelData
   bool WillTakeSnapshot();
+  // same, for an event at time now when the last snapshot was taken at
+  // last_snapshot. Only reads the configuration, so it can be called
+  // from a different thread than the rest of the manager
+  bool WillTakeSnapshot(uint64_t now, uint64_t last_snapshot) const;
   // clear out all remaining data in the manager
   void FlushData();
 
@@ -108,17 +156,19 @@ protected:
   void SendChannelData();
   // per channel data to stdout
   void PrintChannelData();
-  void FillChannelData(std::vector<daqAnalysis::ChannelData> *per_channel_data);
+  void FillChannelData(daqAnalysis::ChannelDataStore *per_channel_data);
   // send info associated w/ HeaderData
   void SendHeaderData();
   void FillHeaderData(std::vector<daqAnalysis::HeaderData> *header_data);
+  // merge header info since the last send into each stream
+  void RollupHeaderData();
   // snapshot stuff
   void SendEventInfo();
   void FillEventInfo(daqAnalysis::EventInfo *event_info);
 
-  void Snapshot(std::vector<daqAnalysis::ChannelData> *per_channel_data, std::vector<daqAnalysis::NoiseSample> *noise, 
+  void Snapshot(daqAnalysis::ChannelDataStore *per_channel_data, std::vector<daqAnalysis::NoiseSample> *noise, 
     std::vector<std::vector<int>> *fem_summed_waveforms, std::vector<std::vector<double>> *fem_summed_fft,
-    const art::ValidHandle<std::vector<raw::RawDigit>> &digits, const std::vector<unsigned> &channel_to_index);
+    std::vector<std::vector<int16_t>> *waveforms);
   // clear out a pipeline of n_commands commands
   void FinishPipeline(size_t n_commands);
 
@@ -126,6 +176,9 @@ protected:
   daqAnalysis::VSTChannelMap *_channel_map;
 
   redisContext *context;
+  // commands are written here. Buffered (instead of appended to context)
+  // if they are sent through _async_output
+  daqAnalysis::RedisPipeline _pipeline;
   uint64_t _now;
   std::time_t _start;
   int _snapshot_time;
@@ -139,6 +192,9 @@ protected:
   std::vector<uint64_t> _stream_last;
   // whether, this time around, the i-th stream will send to redis. Calculated in StartSend()
   std::vector<bool> _stream_send;
+  // whether any stream will send to redis this time around
+  bool AnyStreamSend() const
+    { return std::find(_stream_send.begin(), _stream_send.end(), true) != _stream_send.end(); }
   // whether there is a sub run stream
   bool _sub_run_stream;
   // expire time on sub run stream
@@ -158,31 +214,34 @@ protected:
   // whether this is the first run
   bool _first_run;
 
-  // running averates of Redis metrics per stream
-  std::vector<daqAnalysis::RedisRMS> _rms;
-  std::vector<daqAnalysis::RedisBaseline> _baseline;
-  std::vector<daqAnalysis::RedisBaselineRMS> _baseline_rms;
-  std::vector<daqAnalysis::RedisDNoise> _dnoise;
-  std::vector<daqAnalysis::RedisPulseHeight> _pulse_height;
-  std::vector<daqAnalysis::RedisOccupancy> _occupancy;
-  std::vector<daqAnalysis::RedisRawHitPulseHeight> _rawhit_pulse_height;
-  std::vector<daqAnalysis::RedisRawHitOccupancy> _rawhit_occupancy;
+  // running averates of Redis per-channel metrics for all streams
+  daqAnalysis::RedisChannelMetrics _channel_metrics;
 
   // header info
   std::vector<daqAnalysis::RedisFrameNo> _frame_no;
   std::vector<daqAnalysis::RedisTrigFrameNo> _trig_frame_no;
   std::vector<daqAnalysis::RedisEventNo> _event_no;
   std::vector<daqAnalysis::RedisBlocks> _blocks;
+  // header info since the last send (see RollupHeaderData())
+  daqAnalysis::RedisFrameNo _current_frame_no;
+  daqAnalysis::RedisTrigFrameNo _current_trig_frame_no;
+  daqAnalysis::RedisEventNo _current_event_no;
+  daqAnalysis::RedisBlocks _current_blocks;
 
   //Event Info
   std::vector<daqAnalysis::RedisPurity> _purity; 
 
-  // FFT's for snapshots
-  FFTManager _fft_manager;
+  // builds and sends snapshots off of the event thread (see SnapshotWorker.hh)
+  std::unique_ptr<daqAnalysis::SnapshotWorker> _snapshot_worker;
+  // sums the correlation matrix over events (see CorrelationAccumulator.hh)
+  std::unique_ptr<daqAnalysis::CorrelationAccumulator> _correlation_accumulator;
 
   bool _do_timing;
   daqAnalysis::RedisTiming _timing;
 
+  // set if commands are sent through a redisAsyncContext
+  std::unique_ptr<daqAnalysis::RedisAsyncOutput> _async_output;
+
   // store config
   Config _config;
 };
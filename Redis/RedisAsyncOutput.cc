@@ -0,0 +1,326 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+
+#include "messagefacility/MessageLogger/MessageLogger.h"
+
+#include "RedisAsyncOutput.hh"
+
+using namespace daqAnalysis;
+
+// how long the event loop waits on the socket if nothing wakes it up (ms)
+static const int poll_timeout = 1000;
+// how long Stop() waits for outstanding replies
+static const std::chrono::seconds stop_timeout(10);
+// bounds on the time between attempts to reconnect
+static const std::chrono::milliseconds min_reconnect_wait(100);
+static const std::chrono::milliseconds max_reconnect_wait(10000);
+
+RedisAsyncOutput::RedisAsyncOutput(const std::string &hostname, int port, unsigned max_in_flight, bool timing):
+  _hostname(hostname),
+  _port(port),
+  _context(nullptr),
+  _reading(false),
+  _writing(false),
+  _reconnect_wait(min_reconnect_wait),
+  _next_connect(std::chrono::steady_clock::now()),
+  _queue(64),
+  _max_in_flight(max_in_flight),
+  _timing(timing),
+  _stop(false),
+  _n_in_flight(0),
+  _n_batches(0),
+  _n_dropped(0),
+  _total_latency_us(0),
+  _max_latency_us(0),
+  _submit_wait(0)
+{
+  // without the pipe, the event loop still sees new batches after poll_timeout
+  if (pipe(_wake_fd) != 0) {
+    mf::LogError("RedisAsyncOutput") << "Can't make wake up pipe" << std::endl;
+    _wake_fd[0] = _wake_fd[1] = -1;
+  }
+  else {
+    fcntl(_wake_fd[0], F_SETFL, O_NONBLOCK);
+    fcntl(_wake_fd[1], F_SETFL, O_NONBLOCK);
+  }
+  Connect();
+  _thread = std::thread(&RedisAsyncOutput::Run, this);
+}
+
+RedisAsyncOutput::~RedisAsyncOutput() {
+  Stop();
+  if (_wake_fd[0] >= 0) close(_wake_fd[0]);
+  if (_wake_fd[1] >= 0) close(_wake_fd[1]);
+}
+
+bool RedisAsyncOutput::Connect() {
+  _context = redisAsyncConnect(_hostname.c_str(), _port);
+  if (_context == nullptr || _context->err) {
+    mf::LogError("RedisAsyncOutput") << "Redis error: " << (_context ? _context->errstr : "can't allocate context") << std::endl;
+    if (_context != nullptr) redisAsyncFree(_context);
+    _context = nullptr;
+    Disconnected();
+    return false;
+  }
+  // hook up the event loop
+  _context->data = this;
+  _context->ev.data = this;
+  _context->ev.addRead = &RedisAsyncOutput::AddRead;
+  _context->ev.delRead = &RedisAsyncOutput::DelRead;
+  _context->ev.addWrite = &RedisAsyncOutput::AddWrite;
+  _context->ev.delWrite = &RedisAsyncOutput::DelWrite;
+  _context->ev.cleanup = &RedisAsyncOutput::Cleanup;
+  redisAsyncSetConnectCallback(_context, &RedisAsyncOutput::OnConnect);
+  redisAsyncSetDisconnectCallback(_context, &RedisAsyncOutput::OnDisconnect);
+  return true;
+}
+
+void RedisAsyncOutput::Disconnected() {
+  _context = nullptr;
+  if (_stop) return;
+  mf::LogWarning("RedisAsyncOutput") << "Not connected to redis. Dropping commands and trying again in "
+    << _reconnect_wait.count() << " ms" << std::endl;
+  _next_connect = std::chrono::steady_clock::now() + _reconnect_wait;
+  _reconnect_wait = std::min(2 * _reconnect_wait, max_reconnect_wait);
+}
+
+void RedisAsyncOutput::Wake() {
+  // if the pipe is full, the event loop has a wake up coming already
+  char byte = 0;
+  if (write(_wake_fd[1], &byte, 1) < 0) return;
+}
+
+void RedisAsyncOutput::NotifyInFlight() {
+  // Submit() checks the count under the lock, so holding it here means the
+  // notification can't land between the check and the wait
+  std::lock_guard<std::mutex> lock(_in_flight_mutex);
+  _in_flight_cv.notify_one();
+}
+
+bool RedisAsyncOutput::SplitCommands(const char *commands, size_t len, std::vector<size_t> &offsets) {
+  // commands are "*<n args>\r\n" followed by n of "$<arg length>\r\n<arg>\r\n"
+  size_t pos = 0;
+  while (pos < len) {
+    offsets.push_back(pos);
+    if (commands[pos] != '*') return false;
+    char *end;
+    long n_args = strtol(commands + pos + 1, &end, 10);
+    pos = end - commands + 2;
+    for (long i = 0; i < n_args; i++) {
+      if (pos >= len || commands[pos] != '$') return false;
+      long arg_len = strtol(commands + pos + 1, &end, 10);
+      pos = end - commands + 2 + arg_len + 2;
+    }
+    if (pos > len) return false;
+  }
+  return true;
+}
+
+void RedisAsyncOutput::Submit(const char *commands, size_t len, unsigned n_commands) {
+  std::unique_ptr<Batch> batch(new Batch);
+  batch->output = this;
+  batch->n_replies = 0;
+  if (!SplitCommands(commands, len, batch->offsets) || batch->offsets.size() != n_commands) {
+    mf::LogError("RedisAsyncOutput") << "Expected " << n_commands << " redis commands, found " << batch->offsets.size()
+      << ". Dropping them." << std::endl;
+    _n_dropped += n_commands;
+    return;
+  }
+  if (n_commands == 0) return;
+  batch->commands.assign(commands, len);
+
+  auto start = std::chrono::steady_clock::now();
+  // back-pressure: wait for redis to catch up
+  {
+    std::unique_lock<std::mutex> lock(_in_flight_mutex);
+    _in_flight_cv.wait(lock, [this, n_commands] { return _n_in_flight == 0 || _n_in_flight + n_commands <= _max_in_flight; });
+    _n_in_flight += n_commands;
+  }
+  batch->start = std::chrono::steady_clock::now();
+  _queue.Push(batch);
+  Wake();
+
+  if (_timing) {
+    _submit_wait += std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+  }
+}
+
+void RedisAsyncOutput::Stop() {
+  if (!_thread.joinable()) return;
+  _stop = true;
+  Wake();
+  _thread.join();
+}
+
+float RedisAsyncOutput::MeanLatency() const {
+  unsigned n_batches = _n_batches;
+  if (n_batches == 0) return 0;
+  return _total_latency_us / (1000. * n_batches);
+}
+
+void RedisAsyncOutput::PrintStats() {
+  std::cout << "REDIS ASYNC : in flight " << InFlight() << " batches " << NBatches() << " dropped " << _n_dropped
+            << " latency mean " << MeanLatency() << " max " << MaxLatency() << " wait " << _submit_wait << std::endl;
+}
+
+void RedisAsyncOutput::Run() {
+  bool stopping = false;
+  std::chrono::time_point<std::chrono::steady_clock> stop_start;
+  while (true) {
+    // hand new batches over to hiredis
+    std::unique_ptr<Batch> batch;
+    while (_queue.TryPop(batch)) {
+      if (_context != nullptr) Issue(std::move(batch));
+      else Drop(std::move(batch));
+    }
+
+    // all batches have been submitted before _stop is set, so we're done
+    // once they have all been replied to
+    if (_stop) {
+      if (_n_in_flight == 0 || _context == nullptr) break;
+      if (!stopping) {
+        stopping = true;
+        stop_start = std::chrono::steady_clock::now();
+      }
+      else if (std::chrono::steady_clock::now() - stop_start > stop_timeout) {
+        mf::LogError("RedisAsyncOutput") << "Gave up waiting on " << _n_in_flight << " redis replies" << std::endl;
+        break;
+      }
+    }
+
+    int timeout = poll_timeout;
+    if (_context == nullptr && !_stop) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= _next_connect) Connect();
+      // sleep until the next try
+      if (_context == nullptr) {
+        timeout = std::chrono::duration_cast<std::chrono::milliseconds>(_next_connect - now).count() + 1;
+      }
+    }
+
+    // new batches and Stop() come in through the pipe
+    struct pollfd pfd[2];
+    pfd[0].fd = _wake_fd[0];
+    pfd[0].events = POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = (_context != nullptr) ? _context->c.fd : -1;
+    pfd[1].events = (_reading ? POLLIN : 0) | (_writing ? POLLOUT : 0);
+    pfd[1].revents = 0;
+    if (poll(pfd, 2, timeout) <= 0) continue;
+
+    if (pfd[0].revents & POLLIN) {
+      char bytes[64];
+      while (read(_wake_fd[0], bytes, sizeof(bytes)) > 0) {}
+    }
+    if (_context != nullptr && (pfd[1].revents & (POLLIN | POLLERR | POLLHUP))) {
+      redisAsyncHandleRead(_context);
+    }
+    // handling the read may have dropped the connection
+    if (_context != nullptr && (pfd[1].revents & POLLOUT)) {
+      redisAsyncHandleWrite(_context);
+    }
+  }
+  // any remaining callbacks are called with a null reply
+  if (_context != nullptr) {
+    redisAsyncFree(_context);
+    _context = nullptr;
+  }
+}
+
+void RedisAsyncOutput::Issue(std::unique_ptr<Batch> batch) {
+  // owned by the reply callbacks from here on
+  Batch *issued = batch.release();
+  size_t n_commands = issued->offsets.size();
+  for (size_t i = 0; i < n_commands; i++) {
+    size_t start = issued->offsets[i];
+    size_t end = (i + 1 < n_commands) ? issued->offsets[i+1] : issued->commands.size();
+    // hiredis copies the command into its own buffer
+    if (redisAsyncFormattedCommand(_context, &RedisAsyncOutput::OnReply, issued, issued->commands.data() + start, end - start) != REDIS_OK) {
+      OnReply(_context, nullptr, issued);
+    }
+  }
+}
+
+void RedisAsyncOutput::Drop(std::unique_ptr<Batch> batch) {
+  _n_dropped += batch->offsets.size();
+  _n_in_flight -= batch->offsets.size();
+  NotifyInFlight();
+}
+
+void RedisAsyncOutput::OnReply(redisAsyncContext *ac, void *reply, void *privdata) {
+  Batch *batch = static_cast<Batch *>(privdata);
+  RedisAsyncOutput *output = batch->output;
+
+  redisReply *r = static_cast<redisReply *>(reply);
+  if (r != nullptr && r->type == REDIS_REPLY_ERROR) {
+    mf::LogError("RedisAsyncOutput") << "Redis error: " << r->str << std::endl;
+  }
+
+  batch->n_replies ++;
+  output->_n_in_flight --;
+  // batch is done
+  if (batch->n_replies == batch->offsets.size()) {
+    auto now = std::chrono::steady_clock::now();
+    uint64_t latency = std::chrono::duration_cast<std::chrono::microseconds>(now - batch->start).count();
+    output->_total_latency_us += latency;
+    if (latency > output->_max_latency_us) output->_max_latency_us = latency;
+    output->_n_batches ++;
+    delete batch;
+    output->NotifyInFlight();
+  }
+}
+
+void RedisAsyncOutput::OnConnect(const redisAsyncContext *ac, int status) {
+  RedisAsyncOutput *output = static_cast<RedisAsyncOutput *>(ac->data);
+  if (status != REDIS_OK) {
+    mf::LogError("RedisAsyncOutput") << "Redis error: " << ac->errstr << std::endl;
+    // hiredis frees the context
+    output->Disconnected();
+  }
+  else {
+    output->_reconnect_wait = min_reconnect_wait;
+  }
+}
+
+void RedisAsyncOutput::OnDisconnect(const redisAsyncContext *ac, int status) {
+  if (status != REDIS_OK) {
+    mf::LogError("RedisAsyncOutput") << "Redis error: " << ac->errstr << std::endl;
+  }
+  // hiredis frees the context
+  static_cast<RedisAsyncOutput *>(ac->data)->Disconnected();
+}
+
+void RedisAsyncOutput::AddRead(void *privdata) {
+  static_cast<RedisAsyncOutput *>(privdata)->_reading = true;
+}
+
+void RedisAsyncOutput::DelRead(void *privdata) {
+  static_cast<RedisAsyncOutput *>(privdata)->_reading = false;
+}
+
+void RedisAsyncOutput::AddWrite(void *privdata) {
+  static_cast<RedisAsyncOutput *>(privdata)->_writing = true;
+}
+
+void RedisAsyncOutput::DelWrite(void *privdata) {
+  static_cast<RedisAsyncOutput *>(privdata)->_writing = false;
+}
+
+void RedisAsyncOutput::Cleanup(void *privdata) {
+  RedisAsyncOutput *output = static_cast<RedisAsyncOutput *>(privdata);
+  output->_reading = false;
+  output->_writing = false;
+}
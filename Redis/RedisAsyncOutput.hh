@@ -0,0 +1,133 @@
+#ifndef RedisAsyncOutput_h
+#define RedisAsyncOutput_h
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+
+#include "../BoundedQueue.hh"
+
+/*
+ * Sends already formatted redis commands through a redisAsyncContext,
+ * so that the caller never waits on redis replies.
+ *
+ * The async context is owned by a thread running its own (poll based)
+ * event loop. Batches of commands are handed to that thread through a
+ * queue, and the thread is woken up through a pipe. The time between
+ * handing off a batch and getting the last reply to it is recorded as the
+ * latency of the batch. If too many replies are outstanding, Submit()
+ * waits until redis catches up.
+ *
+ * If the connection is lost (or can't be made), batches are dropped until
+ * the event loop manages to connect again. Attempts to reconnect back off
+ * from 100 ms up to 10 s.
+*/
+
+namespace daqAnalysis {
+  class RedisAsyncOutput;
+}
+
+class daqAnalysis::RedisAsyncOutput {
+public:
+  RedisAsyncOutput(const std::string &hostname, int port, unsigned max_in_flight, bool timing=false);
+  ~RedisAsyncOutput();
+
+  // Outputs own a thread and should not be copied
+  RedisAsyncOutput(RedisAsyncOutput const &) = delete;
+  RedisAsyncOutput & operator = (RedisAsyncOutput const &) = delete;
+
+  // hand off n_commands commands in the redis protocol (as formatted by
+  // redisFormatCommand(), e.g. by a buffered RedisPipeline) to be sent
+  void Submit(const char *commands, size_t len, unsigned n_commands);
+  // wait for all replies and stop the event loop
+  void Stop();
+
+  // number of commands sent but not yet replied to
+  unsigned InFlight() const { return _n_in_flight; }
+  // number of batches which have gotten all of their replies
+  unsigned NBatches() const { return _n_batches; }
+  // latency of finished batches (ms)
+  float MeanLatency() const;
+  float MaxLatency() const { return _max_latency_us / 1000.; }
+  void PrintStats();
+
+  // split a buffer of formatted commands into the offset of each command.
+  // Returns false if the buffer isn't a list of complete commands.
+  static bool SplitCommands(const char *commands, size_t len, std::vector<size_t> &offsets);
+
+private:
+  // a group of commands handed off by Submit()
+  struct Batch {
+    RedisAsyncOutput *output;
+    std::string commands;
+    std::vector<size_t> offsets;
+    unsigned n_replies;
+    std::chrono::time_point<std::chrono::steady_clock> start;
+  };
+
+  void Run();
+  // start connecting to redis. Returns false (and sets when to try again) on failure
+  bool Connect();
+  // called on the event loop thread once the context is gone
+  void Disconnected();
+  // wake up the event loop
+  void Wake();
+  // wake up a Submit() waiting on commands in flight
+  void NotifyInFlight();
+  // pass the batch on to hiredis
+  void Issue(std::unique_ptr<Batch> batch);
+  // drop the batch without sending
+  void Drop(std::unique_ptr<Batch> batch);
+
+  // hiredis callbacks
+  static void OnReply(redisAsyncContext *ac, void *reply, void *privdata);
+  static void OnConnect(const redisAsyncContext *ac, int status);
+  static void OnDisconnect(const redisAsyncContext *ac, int status);
+  // event loop hooks
+  static void AddRead(void *privdata);
+  static void DelRead(void *privdata);
+  static void AddWrite(void *privdata);
+  static void DelWrite(void *privdata);
+  static void Cleanup(void *privdata);
+
+  std::string _hostname;
+  int _port;
+
+  // only used on the event loop thread
+  redisAsyncContext *_context;
+  bool _reading;
+  bool _writing;
+  std::chrono::milliseconds _reconnect_wait;
+  std::chrono::time_point<std::chrono::steady_clock> _next_connect;
+
+  daqAnalysis::BoundedQueue<std::unique_ptr<Batch>> _queue;
+  // read and write ends of the pipe that wakes up the event loop
+  int _wake_fd[2];
+  unsigned _max_in_flight;
+  bool _timing;
+  std::atomic<bool> _stop;
+  std::thread _thread;
+
+  // Submit() waits on this when too many commands are in flight. Signaled
+  // when a batch gets its last reply (or is dropped)
+  std::mutex _in_flight_mutex;
+  std::condition_variable _in_flight_cv;
+
+  // bookkeeping
+  std::atomic<unsigned> _n_in_flight;
+  std::atomic<unsigned> _n_batches;
+  std::atomic<unsigned> _n_dropped;
+  std::atomic<uint64_t> _total_latency_us;
+  std::atomic<uint64_t> _max_latency_us;
+  float _submit_wait;
+};
+
+#endif /* RedisAsyncOutput_h */
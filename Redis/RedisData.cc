@@ -4,6 +4,7 @@
 #include <cassert> 
 #include <ctime>
 #include <numeric>
+#include <algorithm>
 
 #include <hiredis/hiredis.h>
 #include <hiredis/async.h>
@@ -14,12 +15,7 @@
 #include "RedisData.hh"
 
 // Implementing StreamDataMean
-void daqAnalysis::StreamDataMean::Fill(unsigned instance_index, unsigned datum_index, float datum) {
-  // not needed
-  (void) datum_index;
-
-  _instance_data[instance_index] += datum/_n_points_per_time[instance_index];
-}
+// (Fill and Data are in RedisData.hh so that they can be inlined)
 
 // clear data
 void daqAnalysis::StreamDataMean::Clear() {
@@ -29,11 +25,6 @@ void daqAnalysis::StreamDataMean::Clear() {
   _n_values = 0;
 }
 
-float daqAnalysis::StreamDataMean::Data(unsigned index) {
-  float ret = _data[index];
-  return ret;
-}
-
 void daqAnalysis::StreamDataMean::Update() {
   // update instance data
   for (unsigned index = 0; index < _instance_data.size(); index++) {
@@ -43,6 +34,16 @@ void daqAnalysis::StreamDataMean::Update() {
   _n_values ++;
 }
 
+// combine the means of the two streams, weighted by their number of time instances
+void daqAnalysis::StreamDataMean::Merge(const StreamDataMean &other) {
+  if (other._n_values == 0) return;
+  unsigned n_values = _n_values + other._n_values;
+  for (unsigned index = 0; index < _data.size(); index++) {
+    _data[index] = (_data[index] * _n_values + other._data[index] * other._n_values) / n_values;
+  }
+  _n_values = n_values;
+}
+
 // takes new data value out of instance and puts it in _data (not idempotent)
 void daqAnalysis::StreamDataMean::AddInstance(unsigned index) {
   // add instance data to data
@@ -53,19 +54,6 @@ void daqAnalysis::StreamDataMean::AddInstance(unsigned index) {
 }
 
 // Implementing StreamDataVariableMean
-void daqAnalysis::StreamDataVariableMean::Fill(unsigned instance_index, unsigned datum_index, float datum) {
-  // not needed
-  (void) datum_index;
-
-  // don't take values near zero
-  if (datum < 1e-4) {
-    return;
-  }
-  // add to the counter at this time instance
-  _instance_data[instance_index] = (_n_values_current_instance[instance_index] * _instance_data[instance_index] + datum) 
-      / (_n_values_current_instance[instance_index] + 1);
-  _n_values_current_instance[instance_index] ++;
-}
 
 // takes new data value out of instance and puts it in _data (note: is idempotent)
 void daqAnalysis::StreamDataVariableMean::AddInstance(unsigned index) {
@@ -83,6 +71,15 @@ void daqAnalysis::StreamDataVariableMean::AddInstance(unsigned index) {
   _n_values[index] += 1;
 }
 
+// combine the means of each data point, weighted by their number of time instances
+void daqAnalysis::StreamDataVariableMean::Merge(const StreamDataVariableMean &other) {
+  for (unsigned index = 0; index < _data.size(); index++) {
+    if (other._n_values[index] == 0) continue;
+    unsigned n_values = _n_values[index] + other._n_values[index];
+    _data[index] = (_data[index] * _n_values[index] + other._data[index] * other._n_values[index]) / n_values;
+    _n_values[index] = n_values;
+  }
+}
 
 float daqAnalysis::StreamDataVariableMean::Data(unsigned index) {
   // return data
@@ -106,11 +103,11 @@ void daqAnalysis::StreamDataVariableMean::Update() {
 }
 
 // Implementing StreamDataMax
-void daqAnalysis::StreamDataMax::Fill(unsigned instance_index, unsigned datum_index, unsigned datum) {
-  // not needed
-  (void) datum_index;
 
-  if (_data[instance_index] < datum) _data[instance_index] = datum;
+void daqAnalysis::StreamDataMax::Merge(const StreamDataMax &other) {
+  for (unsigned index = 0; index < _data.size(); index++) {
+    if (_data[index] < other._data[index]) _data[index] = other._data[index];
+  }
 }
 
 unsigned daqAnalysis::StreamDataMax::Data(unsigned index) {
@@ -126,11 +123,11 @@ void daqAnalysis::StreamDataMax::Clear() {
 }
 
 // Implementing StreamDataSum
-void daqAnalysis::StreamDataSum::Fill(unsigned instance_index, unsigned datum_index, unsigned datum) {
-  // not needed
-  (void) datum_index;
 
-  _data[instance_index] += datum;
+void daqAnalysis::StreamDataSum::Merge(const StreamDataSum &other) {
+  for (unsigned index = 0; index < _data.size(); index++) {
+    _data[index] += other._data[index];
+  }
 }
 
 unsigned daqAnalysis::StreamDataSum::Data(unsigned index) {
@@ -146,52 +143,52 @@ void daqAnalysis::StreamDataSum::Clear() {
 }
 
 // Implementing StreamDataRMS
-// uses Online RMS algorithm from: 
-// Algorithms for Computing the Sample Variance: Analysis and Recommendations
-// Tony Chan, Gene Golub, and Randall LeVeque
-// The American Statistician
-void daqAnalysis::StreamDataRMS::Fill(unsigned instance_index, unsigned datum_index, float datum) {
-  // store previous mean
-  float last_mean = 0;
-  if (_n_values != 0) {
-    last_mean = _means[instance_index].Data(datum_index); 
+// (Fill is in RedisData.hh)
+
+// combine the moments of the two streams (also from Chan, Golub and LeVeque)
+void daqAnalysis::StreamDataRMS::Merge(const StreamDataRMS &other) {
+  for (unsigned i = 0; i < _moments.size(); i++) {
+    for (unsigned j = 0; j < _moments[i].size(); j++) {
+      Moments &moments = _moments[i][j];
+      const Moments &other_moments = other._moments[i][j];
+      if (other_moments.n == 0) continue;
+      if (moments.n == 0) {
+        moments = other_moments;
+        continue;
+      }
+      unsigned n = moments.n + other_moments.n;
+      float delta = other_moments.mean - moments.mean;
+      moments.mean += delta * other_moments.n / n;
+      moments.m2 += other_moments.m2 + delta * delta * moments.n * other_moments.n / n;
+      moments.n = n;
+    }
   }
-  else {
-    last_mean = datum;
-  }
-  // update mean
-  _means[instance_index].Fill(datum_index, 0, datum);
-  // get new mean
-  float mean = _means[instance_index].Data(datum_index);
-  _rms[instance_index][datum_index] += ( (datum - last_mean)*(datum - mean) - _rms[instance_index][datum_index]) / (_n_values + 1);
+  _n_values += other._n_values;
 }
 
 // clear data
 void daqAnalysis::StreamDataRMS::Clear() {
-  for (unsigned i = 0; i < _means.size(); i++) {
-    _means[i].Clear();
-    std::fill(_rms[i].begin(), _rms[i].end(), 0.);
+  for (auto &moments: _moments) {
+    std::fill(moments.begin(), moments.end(), Moments());
   }
   _n_values = 0;
 }
 
 // get data
 float daqAnalysis::StreamDataRMS::Data(unsigned index) {
-  if (_n_values < 2) return 0;
+  if (_n_values < 2 || _moments[index].size() == 0) return 0;
 
-  float sample_variance = std::accumulate(_rms[index].begin(), _rms[index].end(), 0.) / (_rms[index].size());
+  // data points without any values count as 0
+  float sample_variance = 0.;
+  for (auto const &moments: _moments[index]) {
+    if (moments.n == 0) continue;
+    sample_variance += moments.m2 / moments.n;
+  }
+  sample_variance /= _moments[index].size();
   float sample_rms = sqrt(sample_variance);
   return sample_rms;
 }
 
-// update data
-void daqAnalysis::StreamDataRMS::Update() {
-  for (unsigned i = 0; i < _means.size(); i++) {
-    _means[i].Update();
-  }
-  _n_values ++;
-}
-
 // Defining string literal template parameters for inheritors of DetectorMetric
 char REDIS_NAME_RMS[] = "rms";
 char REDIS_NAME_OCCUPANCY[] = "hit_occupancy";
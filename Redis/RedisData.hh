@@ -6,6 +6,7 @@
 #include <cmath>
 #include <iostream>
 #include <stdlib.h>
+#include <cinttypes>
 
 #include <hiredis/hiredis.h>
 #include <hiredis/async.h>
@@ -13,10 +14,14 @@
 #include "messagefacility/MessageLogger/MessageLogger.h"
 
 #include "../ChannelData.hh"
+#include "../ChannelDataStore.hh"
 #include "../HeaderData.hh"
 #include "../VSTChannelMap.hh"
 #include "../EventInfo.hh"
 
+#include "PackedMetric.hh"
+#include "RedisPipeline.hh"
+
 namespace daqAnalysis {
   // stream types
   class StreamDataMean;
@@ -25,20 +30,13 @@ namespace daqAnalysis {
   class StreamDataSum;
   class StreamDataRMS;
 
-  // detector metric base class
+  // detector metric accumulators
   template<class Stream, char const *REDIS_NAME>
   class DetectorMetric;
 
-  // and the metric classes
-  class RedisRMS;
-  class RedisOccupancy;
-  class RedisBaseline;
-  class RedisBaselineRMS;
-  class RedisPulseHeight;
-  class RedisDNoise;
-  class RedisRawHitOccupancy;
-  class RedisRawHitPulseHeight;
-  class RedisPurity;
+  // description of a per-channel metric (see the list of metrics below)
+  template<class Stream, char const *REDIS_NAME, typename T, std::vector<T> ChannelDataStore::*FIELD>
+  struct ChannelMetric;
 
   // header metric base class
   template<class Stream, char const *REDIS_NAME>
@@ -66,6 +64,8 @@ public:
 
   // add in a new value
   void Fill(unsigned instance_index, unsigned datum_index, float datum);
+  // add in all the time instances of another (updated) stream
+  void Merge(const StreamDataMean &other);
   // clear values
   void Clear();
   // take the data value and reset it
@@ -105,6 +105,8 @@ public:
 
   // add in a new value
   void Fill(unsigned instance_index, unsigned datum_index, float datum);
+  // add in all the time instances of another (updated) stream
+  void Merge(const StreamDataVariableMean &other);
   // take the data value and reset it
   float Data(unsigned index);
   // returns n_data
@@ -139,6 +141,7 @@ public:
   StreamDataMax(unsigned n_data, unsigned _): _data(n_data, 0) {}
 
   void Fill(unsigned instance_index, unsigned datum_index, unsigned datum);
+  void Merge(const StreamDataMax &other);
   unsigned Data(unsigned index);
   unsigned Size() { return _data.size(); }
   void Update() {/* doesn't need to do anything currently */}
@@ -155,6 +158,7 @@ public:
   StreamDataSum(unsigned n_data, unsigned _): _data(n_data, 0) {}
 
   void Fill(unsigned instance_index, unsigned datum_index, unsigned datum);
+  void Merge(const StreamDataSum &other);
   unsigned Data(unsigned index);
   unsigned Size() { return _data.size(); }
   void Update() {/* doesn't need to do anything currently */}
@@ -166,85 +170,144 @@ protected:
 };
 
 // keeps track of running RMS value 
+// The RMS of each instance is the square root of the average over its data
+// points of the variance of each data point (over time instances), M2/n.
+// It is 0 until two time instances have been seen.
 class daqAnalysis::StreamDataRMS {
 public:
   StreamDataRMS(unsigned n_data, unsigned n_points_per_time): 
-    _means(n_data, StreamDataMean(n_points_per_time, 1)), 
-    _rms(n_data, std::vector<float>(n_points_per_time)), 
-    _n_values(0) 
+    _moments(n_data, std::vector<Moments>(n_points_per_time)),
+    _n_values(0)
   {}
 
   // add in a new value
   void Fill(unsigned instance_index, unsigned datum_index, float datum);
+  // add in all the values of another stream
+  void Merge(const StreamDataRMS &other);
   // clear values
   void Clear();
   // take the data value and reset it
   float Data(unsigned index);
   // returns n_data
-  unsigned Size() { return _rms.size(); }
-  // called per iter
-  void Update();
+  unsigned Size() { return _moments.size(); }
+  // called per iter (values are added in Fill(), this only counts them)
+  void Update() { _n_values ++; }
   // update a points per time value
   void SetPointsPerTime(unsigned index, unsigned points) {
-    _means[index] = StreamDataMean(points, 1);
-    _rms[index].resize(points);
+    _moments[index].assign(points, Moments());
   }
 
 protected:
-  // internal data
-  std::vector<daqAnalysis::StreamDataMean> _means;
-  std::vector<std::vector<float>> _rms;
+  // number of values, mean and sum of squared differences from the mean
+  struct Moments {
+    unsigned n;
+    float mean;
+    float m2;
+    Moments(): n(0), mean(0.), m2(0.) {}
+  };
+  std::vector<std::vector<Moments>> _moments;
+  // number of time instances
   unsigned _n_values;
 };
 
+// Fill functions are called for every channel on every event, so define them here
+// so that they can be inlined
+
+inline void daqAnalysis::StreamDataMean::Fill(unsigned instance_index, unsigned datum_index, float datum) {
+  // not needed
+  (void) datum_index;
+
+  _instance_data[instance_index] += datum/_n_points_per_time[instance_index];
+}
+
+inline float daqAnalysis::StreamDataMean::Data(unsigned index) {
+  float ret = _data[index];
+  return ret;
+}
+
+inline void daqAnalysis::StreamDataVariableMean::Fill(unsigned instance_index, unsigned datum_index, float datum) {
+  // not needed
+  (void) datum_index;
+
+  // don't take values near zero
+  if (datum < 1e-4) {
+    return;
+  }
+  // add to the counter at this time instance
+  _instance_data[instance_index] = (_n_values_current_instance[instance_index] * _instance_data[instance_index] + datum) 
+      / (_n_values_current_instance[instance_index] + 1);
+  _n_values_current_instance[instance_index] ++;
+}
+
+inline void daqAnalysis::StreamDataMax::Fill(unsigned instance_index, unsigned datum_index, unsigned datum) {
+  // not needed
+  (void) datum_index;
+
+  if (_data[instance_index] < datum) _data[instance_index] = datum;
+}
+
+inline void daqAnalysis::StreamDataSum::Fill(unsigned instance_index, unsigned datum_index, unsigned datum) {
+  // not needed
+  (void) datum_index;
+
+  _data[instance_index] += datum;
+}
+
+// uses Online RMS algorithm from: 
+// Algorithms for Computing the Sample Variance: Analysis and Recommendations
+// Tony Chan, Gene Golub, and Randall LeVeque
+// The American Statistician
+inline void daqAnalysis::StreamDataRMS::Fill(unsigned instance_index, unsigned datum_index, float datum) {
+  Moments &moments = _moments[instance_index][datum_index];
+  moments.n ++;
+  float delta = datum - moments.mean;
+  moments.mean += delta / moments.n;
+  moments.m2 += delta * (datum - moments.mean);
+}
+
 // holds a StreamDataMean or StreamDataVariableMean across all instances of the detector
 // i.e. per crate, fem, wire, etc.
+// The crates and fems are the ones in the channel map (see ChannelLookup.hh)
 template<class Stream, char const *REDIS_NAME>
 class daqAnalysis::DetectorMetric {
 public:
-  // how to calculate the metric given a channel data reference
-  virtual float Calculate(daqAnalysis::ChannelData &channel) = 0;
-
-  // base class destructors should be virtual
-  virtual ~DetectorMetric() {}
-
   // implementing templated functions in header (because cpp is bad)
 
   // constructor
-  DetectorMetric(daqAnalysis::VSTChannelMap *channel_map) :
-    _wire_data(channel_map->NChannels(), 1),
-    _fem_data(channel_map->NFEM(), 1),
-    _crate_data(channel_map->NCrates(), channel_map->NChannels()), /* NOTE: assume there is only one crate */
-    _wire_message_times(channel_map->NChannels(), 0)
+  DetectorMetric(daqAnalysis::VSTChannelMap *channel_map) : DetectorMetric(channel_map->Lookup()) {}
+
+  DetectorMetric(const daqAnalysis::ChannelLookup &lookup) :
+    _wire_data(lookup.NWires(), 1),
+    _fem_data(lookup.NFEMs(), 1),
+    _crate_data(lookup.NCrates(), 1),
+    _lookup(&lookup)
   {
-    // set the number of channels per fem
-    for (unsigned slot = 0; slot < channel_map->NFEM(); slot++) {
-      _fem_data.SetPointsPerTime(slot, channel_map->NSlotWire(slot));
+    // set the number of channels per fem and crate
+    for (unsigned fem_ind = 0; fem_ind < _lookup->NFEMs(); fem_ind++) {
+      _fem_data.SetPointsPerTime(fem_ind, _lookup->NFEMChannels(fem_ind));
+    }
+    for (unsigned crate = 0; crate < _lookup->NCrates(); crate++) {
+      _crate_data.SetPointsPerTime(crate, _lookup->NCrateChannels(crate));
     }
   }
 
   // add in data
-  void Fill(daqAnalysis::ChannelData &channel, unsigned crate, unsigned crate_channel_ind, unsigned fem_ind, unsigned fem_channel_ind, unsigned wire) {
-    // calculate and add to each container
-    float dat = Calculate(channel);
-
-    // persist through nan's
-    if (std::isnan(dat)) {
-      // don't send error messages too often
-      time_t now = std::time(nullptr);
-      if (now - _wire_message_times[wire] > 10) {
-        _wire_message_times[wire] = now;
-        mf::LogError("NAN Metric") << "Metric " << REDIS_NAME << " is NAN on wire " << wire << std::endl;
-      }
-      return;
-    }
-
+  inline void Fill(float dat, unsigned crate, unsigned crate_channel_ind, unsigned fem_ind, unsigned fem_channel_ind, unsigned wire) {
     // each container is aware of how often it is filled per time instance
     _crate_data.Fill(crate, crate_channel_ind, dat);
     _fem_data.Fill(fem_ind, fem_channel_ind, dat);
     _wire_data.Fill(wire, 0, dat);
   }
 
+  // add in everything from another metric (see ChannelMetrics::Rollup())
+  void Merge(const DetectorMetric &other) {
+    _crate_data.Merge(other._crate_data);
+    _fem_data.Merge(other._fem_data);
+    _wire_data.Merge(other._wire_data);
+  }
+
+  static const char *Name() { return REDIS_NAME; }
+
   float DataCrate(unsigned index) {
     return _crate_data.Data(index);
   }
@@ -272,41 +335,39 @@ public:
   }
 
   // send stuff to Redis
-  unsigned Send(redisContext *context, uint64_t index, const char *stream_name, unsigned stream_expire) {
+  unsigned Send(daqAnalysis::RedisPipeline *pipeline, uint64_t index, const char *stream_name, unsigned stream_expire) {
     // send all the wire stuff
     unsigned n_wires = _wire_data.Size();
     for (unsigned wire = 0; wire < n_wires; wire++) {
-      redisAppendCommand(context, "SET stream/%s:%lu:%s:wire:%i %f",
+      pipeline->Append("SET stream/%s:%" PRIu64 ":%s:wire:%i %f",
         stream_name, index, REDIS_NAME,wire, DataWire(wire)); 
 
       if (stream_expire != 0) {
-        redisAppendCommand(context, "EXPIRE stream/%s:%lu:%s:wire:%i %u",
+        pipeline->Append("EXPIRE stream/%s:%" PRIu64 ":%s:wire:%i %u",
           stream_name, index, REDIS_NAME,wire, stream_expire); 
       }
     } 
     // and the fem stuff
     unsigned n_fem = _fem_data.Size();
     for (unsigned fem_ind = 0; fem_ind < n_fem; fem_ind++) {
-      // @VST: this is ok because there is only 1 crate
-      // TEMPORARY IMPLEMENTATION
-      unsigned fem = fem_ind;
-      unsigned crate = 0;
-      redisAppendCommand(context, "SET stream/%s:%lu:%s:crate:%lu:fem:%i %f",
+      unsigned fem = _lookup->FEMInCrate(fem_ind);
+      unsigned crate = _lookup->FEMCrate(fem_ind);
+      pipeline->Append("SET stream/%s:%" PRIu64 ":%s:crate:%u:fem:%u %f",
         stream_name, index, REDIS_NAME, crate, fem, DataFEM(fem_ind)); 
 
       if (stream_expire != 0) {
-        redisAppendCommand(context, "EXPIRE stream/%s:%lu:%s:crate:%lu:fem:%i %u",
+        pipeline->Append("EXPIRE stream/%s:%" PRIu64 ":%s:crate:%u:fem:%u %u",
          stream_name, index, REDIS_NAME, crate, fem, stream_expire); 
       }
     } 
     // and the crate stuff
     unsigned n_crate = _crate_data.Size();
     for (unsigned crate = 0; crate < n_crate; crate++) {
-      redisAppendCommand(context, "SET stream/%s:%lu:%s:crate:%i %f",
+      pipeline->Append("SET stream/%s:%" PRIu64 ":%s:crate:%i %f",
          stream_name, index, REDIS_NAME, crate, DataCrate(crate));
 
       if (stream_expire != 0) {
-        redisAppendCommand(context, "EXPIRE stream/%s:%lu:%s:crate:%i %u",
+        pipeline->Append("EXPIRE stream/%s:%" PRIu64 ":%s:crate:%i %u",
            stream_name, index, REDIS_NAME, crate, stream_expire);
       }
     }
@@ -314,6 +375,28 @@ public:
     return (n_wires + n_fem + n_crate) * ((stream_expire == 0) ? 1:2);
   }
 
+  // send stuff to Redis as a single binary key (see PackedMetric.hh)
+  unsigned SendPacked(daqAnalysis::RedisPipeline *pipeline, uint64_t index, const char *stream_name, unsigned stream_expire, 
+      daqAnalysis::PackedMetric &packed) {
+    unsigned n_wires = _wire_data.Size();
+    unsigned n_fem = _fem_data.Size();
+    unsigned n_crate = _crate_data.Size();
+    packed.Start(n_wires, n_fem, n_crate);
+    for (unsigned wire = 0; wire < n_wires; wire++) {
+      packed.Add(DataWire(wire));
+    }
+    for (unsigned fem_ind = 0; fem_ind < n_fem; fem_ind++) {
+      packed.Add(DataFEM(fem_ind));
+    }
+    for (unsigned crate = 0; crate < n_crate; crate++) {
+      packed.Add(DataCrate(crate));
+    }
+
+    char key[256];
+    snprintf(key, sizeof(key), "stream/%s:%" PRIu64 ":%s:packed", stream_name, index, REDIS_NAME);
+    return packed.Send(pipeline, key, stream_expire);
+  }
+
   void Print(const char *stream_name) {
     std::cout << "METRIC: " << REDIS_NAME << std::endl;
     std::cout << "STREAM NAME: " << stream_name << std::endl;
@@ -327,8 +410,7 @@ protected:
   Stream _wire_data;
   Stream _fem_data;
   Stream _crate_data;
-
-  std::vector<unsigned> _wire_message_times;
+  const daqAnalysis::ChannelLookup *_lookup;
 };
 
 // string literals can't be template arguments for some reason, so declare them here
@@ -344,79 +426,31 @@ extern char REDIS_NAME_PULSE_HEIGHT[];
 extern char REDIS_NAME_RAWHIT_OCCUPANCY[];
 extern char REDIS_NAME_RAWHIT_PULSE_HEIGHT[];
 
-// RMS is Variable Mean because sometimes noise calculation algorithm can fail
-class daqAnalysis::RedisRMS: public daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_RMS> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_RMS>::DetectorMetric;
-
-  // implement calculate
- inline float Calculate(daqAnalysis::ChannelData &channel) override
-   { return channel.rms; }
+// A per-channel metric: how it is accumulated (Stream), what it is called
+// in redis and which column of the ChannelDataStore it is taken from
+template<class S, char const *REDIS_NAME, typename T, std::vector<T> daqAnalysis::ChannelDataStore::*FIELD>
+struct daqAnalysis::ChannelMetric {
+  typedef S Stream;
+  typedef daqAnalysis::DetectorMetric<S, REDIS_NAME> Metric;
+
+  static inline float Value(const daqAnalysis::ChannelDataStore &channels, unsigned wire) 
+    { return (channels.*FIELD)[wire]; }
+  // copy over only the column the metric is taken from
+  static inline void Copy(const daqAnalysis::ChannelDataStore &from, daqAnalysis::ChannelDataStore &to)
+    { to.*FIELD = from.*FIELD; }
 };
 
-
-class daqAnalysis::RedisOccupancy: public daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_OCCUPANCY> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_OCCUPANCY>::DetectorMetric;
-
-  // implement calculate
- inline float Calculate(daqAnalysis::ChannelData &channel) override
-   { return channel.occupancy; }
-};
-
-class daqAnalysis::RedisRawHitOccupancy: public daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_RAWHIT_OCCUPANCY> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_RAWHIT_OCCUPANCY>::DetectorMetric;
-
-  // implement calculate 
-  inline float Calculate(daqAnalysis::ChannelData &channel) override
-  { return channel.Hitoccupancy; }
-};
-
-class daqAnalysis::RedisDNoise: public daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_DNOISE> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_DNOISE>::DetectorMetric;
-
-  // implement calculate
- inline float Calculate(daqAnalysis::ChannelData &channel) override
-   { return channel.next_channel_dnoise; }
-};
-
-class daqAnalysis::RedisBaseline: public daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_BASLINE> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataMean, REDIS_NAME_BASLINE>::DetectorMetric;
-
-  // implement calculate
- inline float Calculate(daqAnalysis::ChannelData &channel) override
-   { return channel.baseline; }
-};
-
-class daqAnalysis::RedisBaselineRMS: public daqAnalysis::DetectorMetric<StreamDataRMS, REDIS_NAME_BASELINE_RMS> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataRMS, REDIS_NAME_BASELINE_RMS>::DetectorMetric;
-
-  // implement calculate
- inline float Calculate(daqAnalysis::ChannelData &channel) override
-   { return channel.baseline; }
-};
-
-class daqAnalysis::RedisPulseHeight: public daqAnalysis::DetectorMetric<StreamDataVariableMean, REDIS_NAME_PULSE_HEIGHT> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataVariableMean, REDIS_NAME_PULSE_HEIGHT>::DetectorMetric;
-
-  // implement calculate
- inline float Calculate(daqAnalysis::ChannelData &channel) override
-   { return channel.mean_peak_height; }
-};
-
-class daqAnalysis::RedisRawHitPulseHeight: public daqAnalysis::DetectorMetric<StreamDataVariableMean, REDIS_NAME_RAWHIT_PULSE_HEIGHT> {
-  // inherit constructor
-  using daqAnalysis::DetectorMetric<StreamDataVariableMean, REDIS_NAME_RAWHIT_PULSE_HEIGHT>::DetectorMetric;
-
-  // implement calculate 
-  inline float Calculate(daqAnalysis::ChannelData &channel) override
-  {return channel.Hitmean_peak_height; }
-};
+namespace daqAnalysis {
+  // the per-channel metrics
+  typedef ChannelMetric<StreamDataMean, REDIS_NAME_RMS, float, &ChannelDataStore::rms> RedisRMS;
+  typedef ChannelMetric<StreamDataMean, REDIS_NAME_BASLINE, int16_t, &ChannelDataStore::baseline> RedisBaseline;
+  typedef ChannelMetric<StreamDataRMS, REDIS_NAME_BASELINE_RMS, int16_t, &ChannelDataStore::baseline> RedisBaselineRMS;
+  typedef ChannelMetric<StreamDataMean, REDIS_NAME_DNOISE, float, &ChannelDataStore::next_channel_dnoise> RedisDNoise;
+  typedef ChannelMetric<StreamDataMean, REDIS_NAME_OCCUPANCY, float, &ChannelDataStore::occupancy> RedisOccupancy;
+  typedef ChannelMetric<StreamDataVariableMean, REDIS_NAME_PULSE_HEIGHT, float, &ChannelDataStore::mean_peak_height> RedisPulseHeight;
+  typedef ChannelMetric<StreamDataMean, REDIS_NAME_RAWHIT_OCCUPANCY, float, &ChannelDataStore::Hitoccupancy> RedisRawHitOccupancy;
+  typedef ChannelMetric<StreamDataVariableMean, REDIS_NAME_RAWHIT_PULSE_HEIGHT, float, &ChannelDataStore::Hitmean_peak_height> RedisRawHitPulseHeight;
+}
 
 template<class Stream, char const *REDIS_NAME>
 class daqAnalysis::HeaderMetric {
@@ -427,10 +461,14 @@ public:
   // base class destructors should be virtual
   virtual ~HeaderMetric() {}
 
-  HeaderMetric(daqAnalysis::VSTChannelMap *channel_map)
-    : _fem(channel_map->NFEM(), 1)
+  HeaderMetric(daqAnalysis::VSTChannelMap *channel_map) : HeaderMetric(channel_map->Lookup()) {}
+
+  HeaderMetric(const daqAnalysis::ChannelLookup &lookup)
+    : _fem(lookup.NFEMs(), 1),
+      _lookup(&lookup)
   {}
 
+  // fem_ind is over all crates (see ChannelLookup::GlobalFEM())
   void Fill(daqAnalysis::HeaderData &header, unsigned fem_ind) {
     // calculate and add to each container
     unsigned val = Calculate(header);
@@ -448,25 +486,28 @@ public:
     _fem.Update();
   }
 
+  // add in everything from another metric
+  void Merge(const HeaderMetric &other) {
+    _fem.Merge(other._fem);
+  }
+
   // called when stuff is sent to Redis
   void Clear() {
     _fem.Clear();
   }
 
   // send stuff to Redis
-  unsigned Send(redisContext *context, uint64_t index, const char *stream_name, unsigned stream_expire) {
+  unsigned Send(daqAnalysis::RedisPipeline *pipeline, uint64_t index, const char *stream_name, unsigned stream_expire) {
     // send FEM stuff
     unsigned n_fem = _fem.Size();
     for (unsigned fem_ind = 0; fem_ind < n_fem; fem_ind++) {
-      // @VST: this is ok because there is only 1 crate
-      // TEMPORARY IMPLEMENTATION
-      unsigned fem = fem_ind;
-      unsigned crate = 0;
-      redisAppendCommand(context, "SET stream/%s:%lu:%s:crate:%lu:fem:%i %u",
+      unsigned fem = _lookup->FEMInCrate(fem_ind);
+      unsigned crate = _lookup->FEMCrate(fem_ind);
+      pipeline->Append("SET stream/%s:%" PRIu64 ":%s:crate:%u:fem:%u %u",
         stream_name, index, REDIS_NAME, crate, fem, Data(fem_ind)); 
 
       if (stream_expire != 0) {
-        redisAppendCommand(context, "EXPIRE stream/%s:%lu:%s:crate:%lu:fem:%i %u",
+        pipeline->Append("EXPIRE stream/%s:%" PRIu64 ":%s:crate:%u:fem:%u %u",
          stream_name, index, REDIS_NAME, crate, fem, stream_expire); 
       }
     } 
@@ -475,6 +516,7 @@ public:
 
 protected:
   Stream _fem;
+  const daqAnalysis::ChannelLookup *_lookup;
 
 };
 
@@ -558,12 +600,12 @@ public:
   }
 
   // send stuff to Redis
-  unsigned Send(redisContext *context, unsigned index, const char *stream_name, unsigned stream_expire) {
+  unsigned Send(daqAnalysis::RedisPipeline *pipeline, unsigned index, const char *stream_name, unsigned stream_expire) {
     std::cout << "Data(): " << Data() << std::endl;
-    redisAppendCommand(context, "SET stream/%s:%lu:%s: %f",
+    pipeline->Append("SET stream/%s:%u:%s: %f",
         stream_name, index, REDIS_NAME, Data()); 
       if (stream_expire != 0) {
-        redisAppendCommand(context, "EXPIRE stream/%s:%lu:%s: %u",
+        pipeline->Append("EXPIRE stream/%s:%u:%s: %u",
          stream_name, index, REDIS_NAME, stream_expire); 
       } 
     return ((stream_expire == 0) ? 1 : 2);
@@ -0,0 +1,48 @@
+#include <string>
+#include <cstdarg>
+
+#include <hiredis/hiredis.h>
+
+#include "RedisPipeline.hh"
+
+using namespace daqAnalysis;
+
+int RedisPipeline::Append(const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  int ret;
+  if (_buffered) {
+    char *command;
+    int len = redisvFormatCommand(&command, format, ap);
+    Add(command, len);
+    ret = (len < 0) ? REDIS_ERR : REDIS_OK;
+  }
+  else {
+    ret = redisvAppendCommand(_context, format, ap);
+  }
+  va_end(ap);
+  return ret;
+}
+
+int RedisPipeline::AppendArgv(int argc, const char **argv, const size_t *argvlen) {
+  if (!_buffered) {
+    return redisAppendCommandArgv(_context, argc, argv, argvlen);
+  }
+  char *command;
+  int len = redisFormatCommandArgv(&command, argc, argv, argvlen);
+  Add(command, len);
+  return (len < 0) ? REDIS_ERR : REDIS_OK;
+}
+
+void RedisPipeline::Add(char *command, int len) {
+  // the command is only allocated if it was formatted
+  if (len < 0) return;
+  _commands.append(command, len);
+  _n_commands ++;
+  redisFreeCommand(command);
+}
+
+void RedisPipeline::Clear() {
+  _commands.clear();
+  _n_commands = 0;
+}
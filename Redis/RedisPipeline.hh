@@ -0,0 +1,55 @@
+#ifndef RedisPipeline_h
+#define RedisPipeline_h
+
+#include <string>
+#include <cstddef>
+
+#include <hiredis/hiredis.h>
+
+/*
+ * Where the redis commands of a pipeline are written before they are sent.
+ *
+ * By default, commands are appended to a redisContext, and the replies are
+ * read back from it with redisGetReply(). If the pipeline is buffered,
+ * each command is instead formatted by hiredis (redisvFormatCommand() or
+ * redisFormatCommandArgv()) into a buffer owned by the pipeline, which can
+ * be handed off as is (e.g. to a RedisAsyncOutput).
+*/
+
+namespace daqAnalysis {
+  class RedisPipeline;
+}
+
+class daqAnalysis::RedisPipeline {
+public:
+  // context can be null if the pipeline is buffered
+  explicit RedisPipeline(redisContext *context, bool buffered=false):
+    _context(context),
+    _buffered(buffered),
+    _n_commands(0)
+  {}
+
+  // add a command, formatted like redisAppendCommand(). Returns REDIS_OK or REDIS_ERR
+  int Append(const char *format, ...);
+  // add a (binary safe) command, like redisAppendCommandArgv()
+  int AppendArgv(int argc, const char **argv, const size_t *argvlen);
+
+  bool Buffered() const { return _buffered; }
+  redisContext *Context() const { return _context; }
+
+  // the formatted commands and how many of them there are (only if buffered)
+  const std::string &Commands() const { return _commands; }
+  unsigned NCommands() const { return _n_commands; }
+  // empty the buffer (keeps the storage)
+  void Clear();
+
+private:
+  void Add(char *command, int len);
+
+  redisContext *_context;
+  bool _buffered;
+  std::string _commands;
+  unsigned _n_commands;
+};
+
+#endif /* RedisPipeline_h */
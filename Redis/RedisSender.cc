@@ -0,0 +1,98 @@
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <iostream>
+
+#include "messagefacility/MessageLogger/MessageLogger.h"
+
+#include "Redis.hh"
+#include "RedisSender.hh"
+
+using namespace daqAnalysis;
+
+RedisSender::QueuePolicy RedisSender::ParsePolicy(const std::string &name) {
+  if (name == "block") return kBlock;
+  if (name == "drop_oldest") return kDropOldest;
+  if (name == "keep_latest") return kKeepLatest;
+  mf::LogWarning("RedisSender") << "Unknown send_queue_policy: " << name << ". Using \"block\"." << std::endl;
+  return kBlock;
+}
+
+RedisSender::RedisSender(Redis *redis, unsigned queue_size, QueuePolicy policy, bool timing):
+  _redis(redis),
+  _queue(queue_size),
+  _policy(policy),
+  _timing(timing),
+  _n_pushed(0),
+  _n_dropped(0),
+  _n_replaced(0),
+  _push_wait(0)
+{
+  _thread = std::thread(&RedisSender::Run, this);
+}
+
+RedisSender::~RedisSender() {
+  Stop();
+}
+
+void RedisSender::Send(Redis &redis, RedisEvent &event) {
+  redis.StartSend(event.time, event.run, event.sub_run);
+  redis.ChannelData(&event.channel_data, &event.noise_samples, &event.fem_summed_waveforms, &event.fem_summed_fft,
+      event.has_snapshot_data ? &event.waveforms : NULL);
+  redis.EventInfo(&event.event_info);
+  if (event.send_headers) {
+    redis.HeaderData(&event.header_data);
+  }
+  redis.FinishSend();
+}
+
+void RedisSender::Push(std::unique_ptr<RedisEvent> event) {
+  auto start = std::chrono::high_resolution_clock::now();
+  _n_pushed ++;
+
+  switch (_policy) {
+    case kBlock:
+      _queue.Push(event);
+      break;
+    case kDropOldest:
+      while (!_queue.TryPush(event)) {
+        // make room by throwing out the oldest event (if the sender hasn't taken it already)
+        std::unique_ptr<RedisEvent> oldest;
+        if (_queue.TryPop(oldest)) {
+          _n_dropped ++;
+        }
+      }
+      break;
+    case kKeepLatest:
+      // if the queue is full, this event replaces the newest one waiting in it
+      if (_queue.PushReplaceNewest(event)) {
+        _n_replaced ++;
+      }
+      break;
+  }
+
+  if (_timing) {
+    auto now = std::chrono::high_resolution_clock::now();
+    _push_wait += std::chrono::duration<float, std::milli>(now - start).count();
+    std::cout << "REDIS QUEUE  : pushed " << _n_pushed << " dropped " << _n_dropped
+              << " replaced " << _n_replaced << " wait " << _push_wait << std::endl;
+  }
+}
+
+void RedisSender::Stop() {
+  if (!_thread.joinable()) return;
+  // the sender finishes what is in the queue before it stops
+  _queue.Close();
+  _thread.join();
+}
+
+void RedisSender::Run() {
+  std::unique_ptr<RedisEvent> event;
+  // only quits once the queue is closed and empty
+  while (_queue.Pop(event)) {
+    Send(*_redis, *event);
+    event.reset();
+  }
+}
@@ -0,0 +1,109 @@
+#ifndef RedisSender_h
+#define RedisSender_h
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+
+#include "../ChannelDataStore.hh"
+#include "../HeaderData.hh"
+#include "../Noise.hh"
+#include "../EventInfo.hh"
+#include "../BoundedQueue.hh"
+
+#include "Redis.hh"
+
+/*
+ * Sends analysis output to Redis from a background thread, so that
+ * waiting on Redis for one event overlaps with analyzing the next one.
+*/
+
+namespace daqAnalysis {
+  class RedisEvent;
+  class RedisSender;
+}
+
+// Everything sent to Redis for one event. Owns copies of all of the
+// analysis output it needs (including the waveforms, if there is a
+// snapshot) so that it stays valid after the art event is gone. Only used by the
+// RedisSender once it is handed off.
+class daqAnalysis::RedisEvent {
+public:
+  uint64_t time;
+  unsigned run;
+  unsigned sub_run;
+
+  // only the columns sent as metrics (see ChannelMetrics::CopyColumns()),
+  // plus channel_no if there is a snapshot
+  daqAnalysis::ChannelDataStore channel_data;
+  daqAnalysis::EventInfo event_info;
+  bool send_headers;
+  std::vector<daqAnalysis::HeaderData> header_data;
+
+  // only filled if a snapshot is due on this event
+  bool has_snapshot_data;
+  std::vector<daqAnalysis::NoiseSample> noise_samples;
+  std::vector<std::vector<int>> fem_summed_waveforms;
+  std::vector<std::vector<double>> fem_summed_fft;
+  // indexed the same as the ChannelDataStore
+  std::vector<std::vector<int16_t>> waveforms;
+
+  RedisEvent():
+    time(0),
+    run(0),
+    sub_run(0),
+    send_headers(false),
+    has_snapshot_data(false)
+  {}
+};
+
+class daqAnalysis::RedisSender {
+public:
+  // what to do with a new event when the queue is full
+  enum QueuePolicy {
+    // wait for the sender to make room
+    kBlock,
+    // throw away the oldest event in the queue
+    kDropOldest,
+    // the new event takes the place of the newest event in the queue,
+    // whose output is lost (nothing is merged). Events already ahead of
+    // it are still sent
+    kKeepLatest
+  };
+  // "block", "drop_oldest" or "keep_latest"
+  static QueuePolicy ParsePolicy(const std::string &name);
+
+  RedisSender(daqAnalysis::Redis *redis, unsigned queue_size, QueuePolicy policy, bool timing=false);
+  ~RedisSender();
+
+  // Senders own a thread and should not be copied
+  RedisSender(RedisSender const &) = delete;
+  RedisSender & operator = (RedisSender const &) = delete;
+
+  // hand off an event to be sent
+  void Push(std::unique_ptr<daqAnalysis::RedisEvent> event);
+  // send all queued events and stop the thread
+  void Stop();
+
+  // send one event to redis on the calling thread
+  static void Send(daqAnalysis::Redis &redis, daqAnalysis::RedisEvent &event);
+
+private:
+  void Run();
+
+  daqAnalysis::Redis *_redis;
+  daqAnalysis::BoundedQueue<std::unique_ptr<daqAnalysis::RedisEvent>> _queue;
+  QueuePolicy _policy;
+  bool _timing;
+  std::thread _thread;
+
+  // bookkeeping
+  unsigned _n_pushed;
+  unsigned _n_dropped;
+  // events replaced by a later one with keep_latest
+  unsigned _n_replaced;
+  float _push_wait;
+};
+
+#endif /* RedisSender_h */
@@ -0,0 +1,55 @@
+#include <vector>
+#include <cstring>
+
+#include <zlib.h>
+#include <hiredis/hiredis.h>
+
+#include "SnapshotEncoder.hh"
+
+using namespace daqAnalysis;
+
+void SnapshotEncoder::StartFloats() {
+  _buffer.resize(kHeaderSize);
+  _n_values = 0;
+}
+
+void SnapshotEncoder::FinishFloats() {
+  Finish(kFloat, _n_values);
+}
+
+void SnapshotEncoder::Finish(Type type, unsigned n_values) {
+  size_t raw_size = _buffer.size() - kHeaderSize;
+  uint8_t compression = kNone;
+
+  if (_compress && raw_size > 0) {
+    uLongf compressed_size = compressBound(raw_size);
+    _compressed.resize(kHeaderSize + compressed_size);
+    int ret = compress2((Bytef *)_compressed.data() + kHeaderSize, &compressed_size,
+      (const Bytef *)_buffer.data() + kHeaderSize, raw_size, Z_BEST_SPEED);
+    // only keep it if it helps
+    if (ret == Z_OK && compressed_size < raw_size) {
+      _compressed.resize(kHeaderSize + compressed_size);
+      _buffer.swap(_compressed);
+      compression = kZlib;
+    }
+  }
+
+  std::vector<char> header;
+  header.reserve(kHeaderSize);
+  header.push_back((char)kVersion);
+  header.push_back((char)type);
+  header.push_back((char)compression);
+  header.push_back(0);
+  AddU32(header, n_values);
+  AddU32(header, raw_size);
+  AddU32(header, _buffer.size() - kHeaderSize);
+  std::memcpy(_buffer.data(), header.data(), kHeaderSize);
+}
+
+unsigned SnapshotEncoder::Send(redisContext *context, const char *key) {
+  // hiredis copies the arguments, so the buffer can be re-used right away
+  const char *argv[3] = {"SET", key, _buffer.data()};
+  size_t argvlen[3] = {3, strlen(key), _buffer.size()};
+  redisAppendCommandArgv(context, 3, argv, argvlen);
+  return 1;
+}
@@ -0,0 +1,117 @@
+#ifndef SnapshotEncoder_h
+#define SnapshotEncoder_h
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#include <hiredis/hiredis.h>
+
+/*
+ * Binary encoding of snapshot waveforms, spectra and correlations.
+ *
+ * Each list of values is stored as a single redis string with a 16 byte
+ * header, everything little-endian:
+ *   uint8  version (currently 1)
+ *   uint8  type: 0 for integers, 1 for float32
+ *   uint8  compression: 0 for none, 1 for zlib
+ *   uint8  unused (0)
+ *   uint32 number of values
+ *   uint32 size of the payload before compression
+ *   uint32 size of the payload as stored
+ * followed by the payload.
+ *
+ * Integers (ADC's) are stored as the difference to the previous value
+ * (starting from 0), zig-zag encoded, as a base-128 varint. Noise-level
+ * waveforms come out at about 1 byte per sample. Floats are stored as is.
+ * If compression is on, the payload is only kept compressed if that makes
+ * it smaller.
+*/
+
+namespace daqAnalysis {
+  class SnapshotEncoder;
+}
+
+class daqAnalysis::SnapshotEncoder {
+public:
+  static const uint8_t kVersion = 1;
+  static const size_t kHeaderSize = 16;
+  enum Type { kInt = 0, kFloat = 1 };
+  enum Compression { kNone = 0, kZlib = 1 };
+
+  explicit SnapshotEncoder(bool compress=false): _compress(compress) {}
+
+  // encode a list of integers
+  template<typename Iter>
+  void EncodeInts(Iter begin, Iter end);
+  // start a list of floats and add to it
+  void StartFloats();
+  inline void AddFloat(float value);
+  // finish off the last list of floats
+  void FinishFloats();
+
+  // append a binary-safe "SET key value" of the encoded data to the redis pipeline.
+  // Returns the number of commands sent
+  unsigned Send(redisContext *context, const char *key);
+
+  const char *Data() const { return _buffer.data(); }
+  size_t Size() const { return _buffer.size(); }
+
+private:
+  inline void AddVarint(uint32_t value);
+  inline void AddU32(std::vector<char> &buffer, uint32_t value);
+  // write the header and compress the payload
+  void Finish(Type type, unsigned n_values);
+
+  bool _compress;
+  unsigned _n_values;
+  // header + payload
+  std::vector<char> _buffer;
+  // scratch space for compression
+  std::vector<char> _compressed;
+};
+
+inline void daqAnalysis::SnapshotEncoder::AddU32(std::vector<char> &buffer, uint32_t value) {
+  char bytes[4] = {
+    (char)(value & 0xff),
+    (char)((value >> 8) & 0xff),
+    (char)((value >> 16) & 0xff),
+    (char)((value >> 24) & 0xff)
+  };
+  buffer.insert(buffer.end(), bytes, bytes + 4);
+}
+
+inline void daqAnalysis::SnapshotEncoder::AddVarint(uint32_t value) {
+  while (value >= 0x80) {
+    _buffer.push_back((char)((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  _buffer.push_back((char)value);
+}
+
+template<typename Iter>
+void daqAnalysis::SnapshotEncoder::EncodeInts(Iter begin, Iter end) {
+  _buffer.resize(kHeaderSize);
+  int32_t last = 0;
+  unsigned n_values = 0;
+  for (Iter it = begin; it != end; ++it) {
+    int32_t value = *it;
+    int32_t delta = value - last;
+    last = value;
+    // zig-zag: small negative and positive numbers both become small
+    AddVarint(((uint32_t)delta << 1) ^ (uint32_t)(delta >> 31));
+    n_values ++;
+  }
+  Finish(kInt, n_values);
+}
+
+inline void daqAnalysis::SnapshotEncoder::AddFloat(float value) {
+  static_assert(sizeof(float) == sizeof(uint32_t), "float must be 32 bits");
+  uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  AddU32(_buffer, bits);
+  _n_values ++;
+}
+
+#endif /* SnapshotEncoder_h */
@@ -0,0 +1,406 @@
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <iterator>
+#include <cstdlib>
+#include <cinttypes>
+
+#include <hiredis/hiredis.h>
+
+#include "messagefacility/MessageLogger/MessageLogger.h"
+
+#include "lardataobj/RawData/RawDigit.h"
+
+#include "../ChannelDataStore.hh"
+#include "../Noise.hh"
+#include "../FFT.hh"
+#include "../NoiseCorrelation.hh"
+#include "../VSTChannelMap.hh"
+#include "../WaveformView.hh"
+
+#include "SnapshotWorker.hh"
+
+using namespace daqAnalysis;
+using namespace std;
+
+// prefix of keys that snapshots are written to before they are published
+static const char *staging_prefix = "staging:";
+// number of channels of the same size to take the FFT of at once
+static const unsigned fft_batch_size = 64;
+
+// Each snapshot is written by one walk over its keys (SnapshotWorker::WriteSnapshot())
+// with one of these to write each list in its encoding. The lists are
+// integers, floats or the power in each bin of a spectrum.
+
+// writes each list as "DEL key" and "RPUSH key value ...".
+class TextSnapshotEmitter {
+public:
+  explicit TextSnapshotEmitter(redisContext *context): _context(context), _len(0) {}
+
+  const char *Encoding() const { return "text"; }
+
+  template<class Iter>
+  size_t Ints(const char *key, Iter begin, Iter end) {
+    // assume at max 4 chars per int plus a space each
+    Start(key, std::distance(begin, end) * 10);
+    for (; begin != end; ++begin) {
+      _len += sprintf(_buffer.data() + _len, " %i", (int)*begin);
+      CheckOverflow();
+    }
+    return Finish();
+  }
+
+  template<class Iter>
+  size_t Floats(const char *key, Iter begin, Iter end) {
+    // floats can get pretty big, so assume you need ~25 digits
+    // per float to be on the safe side
+    Start(key, std::distance(begin, end) * 25);
+    for (; begin != end; ++begin) {
+      _len += sprintf(_buffer.data() + _len, " %f", (double)*begin);
+      CheckOverflow();
+    }
+    return Finish();
+  }
+
+  template<class Precision>
+  size_t Spectrum(const char *key, const BasicSpectra<Precision> &spectra, unsigned wire) {
+    Start(key, spectra.NBins(wire) * 25);
+    for (unsigned i = 0; i < spectra.NBins(wire); i++) {
+      float dat = spectra.Abs(wire, i);
+      _len += sprintf(_buffer.data() + _len, " %f", dat);
+      CheckOverflow();
+    }
+    return Finish();
+  }
+
+private:
+  void Start(const char *key, size_t data_len) {
+    // delete old list
+    redisAppendCommand(_context, "DEL %s", key);
+    // plus another 100 chars to store the base of the command
+    _buffer.resize(data_len + 100);
+    _len = sprintf(_buffer.data(), "RPUSH %s", key);
+  }
+  void CheckOverflow() {
+    if (_len >= _buffer.size() - 1) {
+      std::cerr << "ERROR: BUFFER OVERFLOW IN SNAPSHOT DATA" << std::endl;
+      std::exit(1);
+    }
+  }
+  size_t Finish() {
+    redisAppendCommand(_context, _buffer.data());
+    return 2;
+  }
+
+  redisContext *_context;
+  // buffer for the RPUSH command, re-used between lists
+  std::vector<char> _buffer;
+  size_t _len;
+};
+
+// writes each list as one binary-safe SET of its SnapshotEncoder encoding
+// (SET replaces the old lists, so there's no need to delete them)
+class BinarySnapshotEmitter {
+public:
+  BinarySnapshotEmitter(redisContext *context, daqAnalysis::SnapshotEncoder &encoder):
+    _context(context),
+    _encoder(encoder)
+  {}
+
+  const char *Encoding() const { return "binary"; }
+
+  template<class Iter>
+  size_t Ints(const char *key, Iter begin, Iter end) {
+    _encoder.EncodeInts(begin, end);
+    return _encoder.Send(_context, key);
+  }
+
+  template<class Iter>
+  size_t Floats(const char *key, Iter begin, Iter end) {
+    _encoder.StartFloats();
+    for (; begin != end; ++begin) {
+      _encoder.AddFloat(*begin);
+    }
+    _encoder.FinishFloats();
+    return _encoder.Send(_context, key);
+  }
+
+  template<class Precision>
+  size_t Spectrum(const char *key, const BasicSpectra<Precision> &spectra, unsigned wire) {
+    _encoder.StartFloats();
+    for (unsigned i = 0; i < spectra.NBins(wire); i++) {
+      _encoder.AddFloat(spectra.Abs(wire, i));
+    }
+    _encoder.FinishFloats();
+    return _encoder.Send(_context, key);
+  }
+
+private:
+  redisContext *_context;
+  daqAnalysis::SnapshotEncoder &_encoder;
+};
+
+SnapshotInput::SnapshotInput(uint64_t t, unsigned r, unsigned sr, const std::vector<unsigned> &channels,
+    std::vector<daqAnalysis::NoiseSample> &noise, std::vector<std::vector<int>> &fem_waveforms,
+    std::vector<std::vector<double>> &fem_fft, std::vector<std::vector<int16_t>> &wire_waveforms):
+  time(t),
+  run(r),
+  sub_run(sr),
+  channel_no(channels),
+  fem_summed_waveforms(fem_waveforms.size()),
+  fem_summed_fft(fem_fft.size()),
+  waveforms(wire_waveforms.size())
+{
+  // copy the noise ranges out of the analysis (they live in memory that is re-used next event)
+  noise_samples.reserve(noise.size());
+  for (auto &sample: noise) {
+    auto const &ranges = *sample.Ranges();
+    noise_samples.emplace_back(std::vector<std::array<unsigned, 2>>(ranges.begin(), ranges.end()), sample.Baseline());
+  }
+  // the sums are cleared before they are filled again, so they can be taken instead of copied
+  for (unsigned i = 0; i < fem_waveforms.size(); i++) {
+    fem_summed_waveforms[i].swap(fem_waveforms[i]);
+  }
+  for (unsigned i = 0; i < fem_fft.size(); i++) {
+    fem_summed_fft[i].swap(fem_fft[i]);
+  }
+  // same for the waveforms
+  for (unsigned i = 0; i < wire_waveforms.size(); i++) {
+    waveforms[i].swap(wire_waveforms[i]);
+  }
+}
+
+SnapshotWorker::SnapshotWorker(const daqAnalysis::Redis::Config &config, daqAnalysis::VSTChannelMap *channel_map):
+  _channel_map(channel_map),
+  _context(redisConnect(config.hostname.c_str(), 6379)),
+  _binary(config.binary_snapshot),
+  _fft_manager((config.waveform_input_size > 0) ? config.waveform_input_size: 0),
+  _batch_fft((config.waveform_input_size > 0) ? config.waveform_input_size: 0, fft_batch_size),
+  _encoder(config.compress_snapshot),
+  _correlation(config.correlation_threads, config.correlation_stride),
+  _do_timing(config.timing),
+  _stop(false),
+  _n_built(0),
+  _n_replaced(0)
+{
+  if (_context == NULL || _context->err) {
+    mf::LogError("SnapshotWorker") << "Redis error: " << (_context ? _context->errstr : "can't allocate context") << std::endl;
+  }
+  _thread = std::thread(&SnapshotWorker::Run, this);
+}
+
+SnapshotWorker::~SnapshotWorker() {
+  Stop();
+  if (_context != NULL) redisFree(_context);
+}
+
+void SnapshotWorker::Push(std::shared_ptr<daqAnalysis::SnapshotInput> input) {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_pending) _n_replaced ++;
+    _pending = std::move(input);
+  }
+  _cv.notify_one();
+}
+
+void SnapshotWorker::Stop() {
+  if (!_thread.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _cv.notify_one();
+  _thread.join();
+}
+
+void SnapshotWorker::Run() {
+  while (true) {
+    std::shared_ptr<SnapshotInput> input;
+    unsigned n_replaced;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this] { return _stop || _pending; });
+      // only quit once there is nothing left to do
+      if (!_pending) break;
+      input = std::move(_pending);
+      n_replaced = _n_replaced;
+    }
+    if (_context == NULL || _context->err) continue;
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    if (_do_timing) {
+      _timing.StartTime();
+    }
+    ChannelFFTs(*input);
+    if (_do_timing) {
+      _timing.EndTime(&_timing.send_fft);
+    }
+
+    _keys.clear();
+    size_t n_commands;
+    if (_binary) {
+      BinarySnapshotEmitter emit(_context, _encoder);
+      n_commands = WriteSnapshot(*input, emit);
+    }
+    else {
+      TextSnapshotEmitter emit(_context);
+      n_commands = WriteSnapshot(*input, emit);
+    }
+    n_commands += Publish();
+
+    if (_do_timing) {
+      _timing.StartTime();
+    }
+    FinishPipeline(n_commands);
+    if (_do_timing) {
+      _timing.EndTime(&_timing.clear_pipeline);
+    }
+    _n_built ++;
+
+    if (_do_timing) {
+      auto now = std::chrono::high_resolution_clock::now();
+      // as one message, so it isn't mixed in with the timing printed on the event thread
+      std::ostringstream timing;
+      timing << "SNAPSHOT    : built " << _n_built << " replaced " << n_replaced
+             << " time " << std::chrono::duration<float, std::milli>(now - start).count() << std::endl;
+      _timing.Print(timing);
+      mf::LogInfo("SnapshotWorker") << timing.str();
+    }
+  }
+}
+
+const char *SnapshotWorker::StageKey(const char *format, int index) {
+  char key[100];
+  snprintf(key, sizeof(key), format, index);
+  _keys.emplace_back(key);
+  _staged_key = std::string(staging_prefix) + key;
+  return _staged_key.c_str();
+}
+
+size_t SnapshotWorker::Publish() {
+  // move everything over at once
+  redisAppendCommand(_context, "MULTI");
+  for (auto const &key: _keys) {
+    redisAppendCommand(_context, "RENAME %s%s %s", staging_prefix, key.c_str(), key.c_str());
+  }
+  redisAppendCommand(_context, "EXEC");
+  return _keys.size() + 2;
+}
+
+void SnapshotWorker::FinishPipeline(size_t n_commands) {
+  void *reply;
+  for (size_t i = 0; i < n_commands; i++) {
+    if (redisGetReply(_context, &reply) != REDIS_OK) {
+      mf::LogError("SnapshotWorker") << "Redis error: " << _context->errstr << std::endl;
+      return;
+    }
+    freeReplyObject(reply);
+  }
+}
+
+void SnapshotWorker::CalculateCorrelation(daqAnalysis::SnapshotInput &input) {
+  // the i-th noise sample goes with the i-th waveform
+  std::vector<WaveformView> waveforms;
+  waveforms.reserve(input.noise_samples.size());
+  for (unsigned i = 0; i < input.noise_samples.size(); i++) {
+    waveforms.emplace_back(input.waveforms[i]);
+  }
+  _correlation.Calculate(input.noise_samples, waveforms);
+}
+
+void SnapshotWorker::ChannelFFTs(const daqAnalysis::SnapshotInput &input) {
+  unsigned n_wires = input.channel_no.size();
+  std::vector<const std::vector<int16_t> *> waveforms(n_wires, NULL);
+  size_t max_n_adc = 0;
+  for (unsigned wire = 0; wire < n_wires; wire++) {
+    waveforms[wire] = &input.waveforms[wire];
+    max_n_adc = std::max(max_n_adc, waveforms[wire]->size());
+  }
+  // keeps the storage from the last snapshot
+  _spectra.Resize(n_wires, max_n_adc/2 + 1);
+  if (max_n_adc == 0) return;
+
+  _batch_fft.Set(max_n_adc, fft_batch_size);
+  CalculateSpectra(waveforms, 0, n_wires, _batch_fft, _fft_manager, _spectra);
+}
+
+template<class Emitter>
+size_t SnapshotWorker::WriteSnapshot(daqAnalysis::SnapshotInput &input, Emitter &emit) {
+  size_t n_commands = 0;
+
+  // record the time for reference
+  redisAppendCommand(_context, "SET %s %" PRIu64, StageKey("snapshot:time"), input.time);
+  redisAppendCommand(_context, "SET %s %u", StageKey("snapshot:sub_run"), input.sub_run);
+  redisAppendCommand(_context, "SET %s %u", StageKey("snapshot:run"), input.run);
+  redisAppendCommand(_context, "SET %s %s", StageKey("snapshot:encoding"), emit.Encoding());
+  n_commands += 4;
+
+  if (_do_timing) _timing.StartTime();
+
+  // stuff per fem
+  // assumes fem_summed_waveforms and fem_summed_fft are already sorted by id
+  if (input.fem_summed_waveforms.size() != 0) {
+    for (unsigned fem_ind = 0; fem_ind < _channel_map->NFEM(); fem_ind++) {
+      const std::vector<int> &waveform = input.fem_summed_waveforms[fem_ind];
+      n_commands += emit.Ints(StageKey("snapshot:waveform:fem:%i", fem_ind), waveform.begin(), waveform.end());
+    }
+  }
+  if (input.fem_summed_fft.size() != 0) {
+    for (unsigned fem_ind = 0; fem_ind < _channel_map->NFEM(); fem_ind++) {
+      const std::vector<double> &fft = input.fem_summed_fft[fem_ind];
+      n_commands += emit.Floats(StageKey("snapshot:fft:fem:%i", fem_ind), fft.begin(), fft.end());
+    }
+  }
+
+  if (_do_timing) _timing.EndTime(&_timing.fem_waveforms);
+
+  // stuff per channel
+  for (unsigned wire = 0; wire < input.channel_no.size(); wire++) {
+    unsigned channel_no = input.channel_no[wire];
+    WaveformView waveform(input.waveforms[wire]);
+
+    if (_do_timing) {
+      _timing.StartTime();
+    }
+    n_commands += emit.Ints(StageKey("snapshot:waveform:wire:%i", channel_no), waveform.begin(), waveform.end());
+    if (_do_timing) {
+      _timing.EndTime(&_timing.send_waveform);
+    }
+
+    if (_do_timing) {
+      _timing.StartTime();
+    }
+    const char *key = StageKey("snapshot:fft:wire:%i", channel_no);
+    n_commands += emit.Spectrum(key, _spectra, wire);
+    if (_do_timing) {
+      _timing.EndTime(&_timing.send_fft);
+    }
+  }
+
+  if (_do_timing) {
+    _timing.StartTime();
+  }
+  // also store the noise correlation matrix if taking a snapshot
+  redisAppendCommand(_context, "SET %s %u", StageKey("snapshot:correlation_stride"), _correlation.Stride());
+  n_commands += 1;
+  CalculateCorrelation(input);
+  // Only the upper-right half of the matrix is stored since it is symmetric
+  // The index 'k' into the list of the i-th sample with the j-th sample (where i <= j) is:
+  // k = ((n+1)*n/2) - (n-i+1)*(n-i)/2 + j - i
+  const std::vector<float> &matrix = _correlation.Matrix();
+  n_commands += emit.Floats(StageKey("snapshot:correlation"), matrix.begin(), matrix.end());
+
+  if (_do_timing) {
+    _timing.EndTime(&_timing.correlation);
+  }
+
+  return n_commands;
+}
@@ -0,0 +1,124 @@
+#ifndef SnapshotWorker_h
+#define SnapshotWorker_h
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <hiredis/hiredis.h>
+
+#include "../ChannelDataStore.hh"
+#include "../Noise.hh"
+#include "../FFT.hh"
+#include "../NoiseCorrelation.hh"
+#include "../VSTChannelMap.hh"
+
+#include "Redis.hh"
+#include "SnapshotEncoder.hh"
+
+/*
+ * Builds snapshots and sends them to Redis on a background thread, so
+ * that the event which triggers a snapshot doesn't pay for formatting
+ * waveforms, per-wire FFT's or the noise correlation matrix.
+ *
+ * Each snapshot is written to staging keys ("staging:snapshot:...") and
+ * then moved to the real keys with one MULTI/RENAME.../EXEC transaction,
+ * so readers never see a half-written snapshot.
+*/
+
+namespace daqAnalysis {
+  class SnapshotInput;
+  class SnapshotWorker;
+}
+
+// Everything needed to build a snapshot that the worker can't rebuild
+// itself. Made on the event thread, so it takes as little as it can: the
+// waveforms and FEM sums are swapped out of the analysis and only the noise
+// ranges (a few per channel) are copied. The per-wire FFT's are calculated
+// again from the waveforms by the worker. Only used by the SnapshotWorker
+// once it is handed off.
+class daqAnalysis::SnapshotInput {
+public:
+  uint64_t time;
+  unsigned run;
+  unsigned sub_run;
+
+  // channel number of each wire, indexed the same as the ChannelDataStore
+  std::vector<unsigned> channel_no;
+  std::vector<daqAnalysis::NoiseSample> noise_samples;
+  std::vector<std::vector<int>> fem_summed_waveforms;
+  std::vector<std::vector<double>> fem_summed_fft;
+  // ADC's of each wire, indexed the same as the ChannelDataStore
+  std::vector<std::vector<int16_t>> waveforms;
+
+  // leaves fem_waveforms, fem_fft and wire_waveforms with empty vectors
+  SnapshotInput(uint64_t t, unsigned r, unsigned sr, const std::vector<unsigned> &channels,
+      std::vector<daqAnalysis::NoiseSample> &noise, std::vector<std::vector<int>> &fem_waveforms,
+      std::vector<std::vector<double>> &fem_fft, std::vector<std::vector<int16_t>> &wire_waveforms);
+};
+
+class daqAnalysis::SnapshotWorker {
+public:
+  SnapshotWorker(const daqAnalysis::Redis::Config &config, daqAnalysis::VSTChannelMap *channel_map);
+  ~SnapshotWorker();
+
+  // Workers own a thread and should not be copied
+  SnapshotWorker(SnapshotWorker const &) = delete;
+  SnapshotWorker & operator = (SnapshotWorker const &) = delete;
+
+  // hand off a snapshot to be built. If the last one hasn't been
+  // started yet, it is replaced by this one.
+  void Push(std::shared_ptr<daqAnalysis::SnapshotInput> input);
+  // finish any waiting snapshot and stop the thread
+  void Stop();
+
+private:
+  void Run();
+  // write the snapshot to the staging keys, with each list written by the
+  // emitter of the encoding (see SnapshotWorker.cc). Returns the number of commands
+  template<class Emitter>
+  size_t WriteSnapshot(daqAnalysis::SnapshotInput &input, Emitter &emit);
+  // move the staging keys to the real ones
+  size_t Publish();
+  void FinishPipeline(size_t n_commands);
+  // fill _correlation from the noise samples and waveforms
+  void CalculateCorrelation(daqAnalysis::SnapshotInput &input);
+  // fill _spectra with the FFT of each wire
+  void ChannelFFTs(const daqAnalysis::SnapshotInput &input);
+  // get the staging name of the key and remember to publish it.
+  // The result is only good until the next call
+  const char *StageKey(const char *format, int index=0);
+
+  daqAnalysis::VSTChannelMap *_channel_map;
+  // own connection (hiredis contexts can't be shared between threads)
+  redisContext *_context;
+  bool _binary;
+  FFTManager _fft_manager;
+  BatchFFTManager _batch_fft;
+  // per-wire FFT's of the current snapshot
+  Spectra _spectra;
+  daqAnalysis::SnapshotEncoder _encoder;
+  daqAnalysis::NoiseCorrelation _correlation;
+  // keys written in the current snapshot
+  std::vector<std::string> _keys;
+  // storage for the last key returned by StageKey()
+  std::string _staged_key;
+
+  bool _do_timing;
+  daqAnalysis::RedisTiming _timing;
+
+  std::mutex _mutex;
+  std::condition_variable _cv;
+  std::shared_ptr<daqAnalysis::SnapshotInput> _pending;
+  bool _stop;
+  std::thread _thread;
+
+  // bookkeeping
+  unsigned _n_built;
+  unsigned _n_replaced;
+};
+
+#endif /* SnapshotWorker_h */
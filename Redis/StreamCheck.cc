@@ -0,0 +1,122 @@
+#include <vector>
+#include <random>
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+
+#include "RedisData.hh"
+
+/*
+ * Checks the stream accumulators that are rolled up from per-event
+ * buckets (see ChannelMetrics.hh).
+ *
+ * Usage: RedisStreamCheck [n_events]
+ *
+ * Each stream is filled directly on every event and also through buckets
+ * of random length which are merged into it, the way the Redis streams
+ * are. The two have to agree to float rounding. The RMS is also checked
+ * against the running RMS that the streams used to keep before they were
+ * rolled up, which they have to agree with up to its bias of about
+ * log(n)/n for n events. Returns 1 if any check fails.
+*/
+
+using namespace daqAnalysis;
+
+static const unsigned n_instances = 3;
+static const unsigned n_points = 16;
+
+// the running RMS the streams used to keep, which compares each value to
+// the mean of the events before it
+class OldStreamRMS {
+public:
+  OldStreamRMS(): _means(n_instances, std::vector<float>(n_points, 0.)), _rms(_means), _n_values(0) {}
+
+  void Fill(unsigned instance, unsigned point, float datum) {
+    float last_mean = (_n_values != 0) ? _means[instance][point] : datum;
+    _rms[instance][point] += ((datum - last_mean) * (datum - _means[instance][point]) - _rms[instance][point]) / (_n_values + 1);
+    _new_means.push_back(datum);
+  }
+  void Update() {
+    for (unsigned i = 0; i < n_instances; i++) {
+      for (unsigned j = 0; j < n_points; j++) {
+        _means[i][j] = (_means[i][j] * _n_values + _new_means[i * n_points + j]) / (_n_values + 1);
+      }
+    }
+    _new_means.clear();
+    _n_values ++;
+  }
+  float Data(unsigned instance) {
+    if (_n_values < 2) return 0;
+    float variance = 0.;
+    for (float rms: _rms[instance]) variance += rms;
+    return sqrt(variance / n_points);
+  }
+
+private:
+  std::vector<std::vector<float>> _means;
+  std::vector<std::vector<float>> _rms;
+  std::vector<float> _new_means;
+  unsigned _n_values;
+};
+
+static bool check(const char *name, unsigned instance, float value, float expected, float tolerance) {
+  float error = std::fabs(value - expected) / std::max(std::fabs(expected), 1e-6f);
+  bool pass = error <= tolerance;
+  std::cout << name << " " << instance << " : " << value << " expected " << expected
+            << " (relative error " << error << ")" << (pass ? "" : " FAIL") << std::endl;
+  return pass;
+}
+
+int main(int argc, char **argv) {
+  unsigned n_events = argc > 1 ? atoi(argv[1]) : 1000;
+
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0., 1.);
+  std::uniform_int_distribution<unsigned> bucket_length(1, 20);
+
+  StreamDataRMS rms(n_instances, n_points), rms_rollup(n_instances, n_points), rms_bucket(n_instances, n_points);
+  StreamDataMean mean(n_instances, n_points), mean_rollup(n_instances, n_points), mean_bucket(n_instances, n_points);
+  OldStreamRMS old_rms;
+
+  bool pass = true;
+  unsigned n_until_rollup = bucket_length(rng);
+  for (unsigned event = 0; event < n_events; event++) {
+    for (unsigned i = 0; i < n_instances; i++) {
+      for (unsigned j = 0; j < n_points; j++) {
+        // a different baseline and noise level for each point
+        float datum = 100. * i + j + (1. + 0.5 * i + 0.1 * j) * noise(rng);
+        rms.Fill(i, j, datum);
+        rms_bucket.Fill(i, j, datum);
+        mean.Fill(i, j, datum);
+        mean_bucket.Fill(i, j, datum);
+        old_rms.Fill(i, j, datum);
+      }
+    }
+    rms.Update();
+    rms_bucket.Update();
+    mean.Update();
+    mean_bucket.Update();
+    old_rms.Update();
+
+    if (event == 0) {
+      // no RMS from one event
+      pass = check("RMS ONE EVENT", 0, rms.Data(0), old_rms.Data(0), 0.) && pass;
+    }
+    if (--n_until_rollup == 0 || event + 1 == n_events) {
+      rms_rollup.Merge(rms_bucket);
+      rms_bucket.Clear();
+      mean_rollup.Merge(mean_bucket);
+      mean_bucket.Clear();
+      n_until_rollup = bucket_length(rng);
+    }
+  }
+
+  float old_bias = log((float)n_events) / n_events;
+  for (unsigned i = 0; i < n_instances; i++) {
+    pass = check("MEAN ROLLUP  ", i, mean_rollup.Data(i), mean.Data(i), 1e-5) && pass;
+    pass = check("RMS ROLLUP   ", i, rms_rollup.Data(i), rms.Data(i), 1e-4) && pass;
+    pass = check("RMS OLD      ", i, rms.Data(i), old_rms.Data(i), old_bias) && pass;
+  }
+  std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
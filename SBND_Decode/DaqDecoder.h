@@ -9,6 +9,10 @@
 // from cetlib version v3_01_03.
 ////////////////////////////////////////////////////////////////////////
 
+#include <vector>
+#include <map>
+#include <utility>
+
 #include "art/Framework/Core/EDProducer.h"
 #include "lardataobj/RawData/RawDigit.h"
 #include "artdaq-core/Data/Fragment.hh"
@@ -17,7 +21,11 @@
 #include "sbnddaq-datatypes/Overlays/NevisTPCFragment.hh"
 
 #include "../HeaderData.hh"
+#include "../ChannelSummary.hh"
+#include "../WaveformSums.hh"
+#include "NevisDecoder.hh"
 #include "../VSTChannelMap.hh"
+#include "../ThreadPool.hh"
 
 /*
   * The Decoder module takes as input "NevisTPCFragments" and
@@ -46,7 +54,9 @@ public:
   void produce(art::Event & e) override;
 
   // get checksum from a Nevis fragment
-  static uint32_t compute_checksum(sbnddaq::NevisTPCFragment &fragment);
+  static uint32_t compute_checksum(sbnddaq::NevisTPCFragment &fragment, size_t payload_words);
+  // number of data words after the Nevis header that fit in the fragment
+  static size_t payload_words(const artdaq::Fragment &frag);
 
 private:
   class Config {
@@ -55,11 +65,16 @@ private:
     int wait_usec;
     bool produce_header;
     bool produce_metadata;
+    bool produce_summary;
     bool baseline_calc;
     bool validate_header;
     unsigned n_mode_skip;
+    bool exact_mode;
     bool calc_checksum;
     bool subtract_pedestal;
+    bool direct_decode;
+    bool timing;
+    unsigned n_decode_threads;
 
     // for converting nevis frame time into timestamp
     unsigned timesize;
@@ -74,16 +89,40 @@ private:
     Config(fhicl::ParameterSet const & p);
   };
 
-  // process an individual fragment inside an art event
+  // everything made from one fragment (i.e. one FEM). Filled independently
+  // for each fragment, so that fragments can be decoded in parallel
+  class FragmentProducts {
+    public:
+    std::vector<raw::RawDigit> digits;
+    std::vector<daqAnalysis::ChannelSummary> summaries;
+    bool has_header;
+    daqAnalysis::HeaderData header;
+  };
+
+  // validation state kept for each FEM
+  class FEMHistory {
+    public:
+    uint32_t last_event_number;
+    uint32_t last_trig_frame_number;
+    FEMHistory(): last_event_number(0), last_trig_frame_number(0) {}
+  };
+
+  // process an individual fragment inside an art event. Safe to call
+  // on different fragments from different threads
   void process_fragment(art::Event &event, const artdaq::Fragment &frag,
-    std::unique_ptr<std::vector<raw::RawDigit>> &product_collection,
-    std::unique_ptr<std::vector<daqAnalysis::HeaderData>> &header_collection);
+    FragmentProducts &products, daq::NevisDecoder &decoder);
+
+  // make the RawDigit (and summary) for one decoded waveform. Takes over the buffer
+  void add_waveform(raw::ChannelID_t wire_id, std::vector<int16_t> &&raw_digits_waveform,
+    const daqAnalysis::WaveformSums &sums, FragmentProducts &products);
 
   // validate Nevis header
   void validate_header(const daqAnalysis::HeaderData &header);
 
   // handle to the channel map service
   art::ServiceHandle<daqAnalysis::VSTChannelMap> _channel_map;
+  // its flat lookup tables
+  const daqAnalysis::ChannelLookup *_channel_lookup;
 
   // Gets the WIRE ID of the channel. This wire id can be then passed
   // to the Lariat geometry.
@@ -94,9 +133,14 @@ private:
 
   art::InputTag _tag;
   Config _config;
-  // keeping track of incrementing numbers
-  uint32_t _last_event_number;
-  uint32_t _last_trig_frame_number;
+  // threads for decoding fragments in parallel
+  daqAnalysis::ThreadPool _thread_pool;
+  // decoding straight into RawDigit storage (one per thread)
+  std::vector<daq::NevisDecoder> _nevis_decoders;
+  // products of each fragment in the current event
+  std::vector<FragmentProducts> _fragment_products;
+  // keeping track of incrementing numbers for each (crate, slot)
+  std::map<std::pair<unsigned, unsigned>, FEMHistory> _fem_history;
 };
 
 #endif /* DaqDecoder_h */
@@ -18,6 +18,8 @@
 
 #include <memory>
 #include <iostream>
+#include <iterator>
+#include <algorithm>
 #include <stdlib.h>
 #include <chrono>
 #include <thread>
@@ -33,6 +35,8 @@
 #include "sbnddaq-datatypes/NevisTPC/NevisTPCUtilities.hh"
 
 #include "../HeaderData.hh"
+#include "../ChannelSummary.hh"
+#include "../WaveformSums.hh"
 #include "../VSTChannelMap.hh"
 #include "../Mode.hh"
 
@@ -53,7 +57,7 @@ daqAnalysis::HeaderData Fragment2HeaderData(art::Event &event, const artdaq::Fra
   ret.checksum = raw_header->getChecksum();
   
   if (calc_checksum) {
-    ret.computed_checksum = daq::DaqDecoder::compute_checksum(fragment);
+    ret.computed_checksum = daq::DaqDecoder::compute_checksum(fragment, daq::DaqDecoder::payload_words(frag));
   }
   else {
     ret.computed_checksum = 0;
@@ -94,10 +98,11 @@ daqAnalysis::HeaderData Fragment2HeaderData(art::Event &event, const artdaq::Fra
 
 daq::DaqDecoder::DaqDecoder(fhicl::ParameterSet const & param): 
   _channel_map(),
+  _channel_lookup(&_channel_map->Lookup()),
   _tag(param.get<std::string>("raw_data_label", "daq"),param.get<std::string>("fragment_type_label", "NEVISTPC")),
   _config(param),
-  _last_event_number(0),
-  _last_trig_frame_number(0)
+  _thread_pool(_config.n_decode_threads),
+  _nevis_decoders(_thread_pool.NThreads())
  {
   
   // produce stuff
@@ -108,6 +113,9 @@ daq::DaqDecoder::DaqDecoder(fhicl::ParameterSet const & param):
   if (_config.produce_metadata) {
     produces<std::vector<daqAnalysis::NevisTPCMetaData>>();
   }
+  if (_config.produce_summary) {
+    produces<std::vector<daqAnalysis::ChannelSummary>>();
+  }
 }
 
 daq::DaqDecoder::Config::Config(fhicl::ParameterSet const & param) {
@@ -122,14 +130,24 @@ daq::DaqDecoder::Config::Config(fhicl::ParameterSet const & param) {
   produce_header = param.get<bool>("produce_header", false);
   // whether to put NevisTPCMetaData in the art root file
   produce_metadata = param.get<bool>("produce_metadata", false);
+  // whether to put per-channel ChannelSummary's in the art root file
+  produce_summary = param.get<bool>("produce_summary", false);
   // whether to check if Header looks good and print out error info
   validate_header = param.get<bool>("validate_header", false);
   // how many adc values to skip in mode/pedestal finding
   n_mode_skip = param.get<unsigned>("n_mode_skip", 1);
+  // whether to find the exact mode instead of the approximate one
+  exact_mode = param.get<bool>("exact_mode", false);
   // whether to verify checksum
   calc_checksum = param.get<bool>("calc_checksum", false);
   // whether to subtract pedestal
   subtract_pedestal = param.get<bool>("subtract_pedestal", false);
+  // whether to decode the Nevis data straight into the RawDigit buffers
+  direct_decode = param.get<bool>("direct_decode", false);
+  // whether to print out the decoding speed
+  timing = param.get<bool>("timing", false);
+  // number of threads to decode fragments with (one fragment per task)
+  n_decode_threads = std::max(param.get<unsigned>("n_decode_threads", 1), 1u);
 
   // nevis readout window length
   timesize = param.get<unsigned>("timesize", 1);
@@ -158,13 +176,57 @@ void daq::DaqDecoder::produce(art::Event & event)
   std::unique_ptr<std::vector<raw::RawDigit>> product_collection(new std::vector<raw::RawDigit>);
   // storage for header info
   std::unique_ptr<std::vector<daqAnalysis::HeaderData>> header_collection(new std::vector<daqAnalysis::HeaderData>);
-
-  for (auto const &rawfrag: *daq_handle) {
-    process_fragment(event, rawfrag, product_collection, header_collection);
+  // storage for per-channel statistics
+  std::unique_ptr<std::vector<daqAnalysis::ChannelSummary>> summary_collection(new std::vector<daqAnalysis::ChannelSummary>);
+
+  auto start = std::chrono::high_resolution_clock::now();
+  // each fragment is decoded into its own products (possibly in parallel)
+  unsigned n_fragments = daq_handle->size();
+  _fragment_products.resize(n_fragments);
+  _thread_pool.Run(n_fragments, [&](unsigned frag_ind, unsigned thread) {
+    process_fragment(event, (*daq_handle)[frag_ind], _fragment_products[frag_ind], _nevis_decoders[thread]);
+  });
+
+  // then put together in fragment order, so the output doesn't depend on the number of threads
+  size_t n_bytes = 0;
+  size_t n_digits = 0;
+  size_t n_summaries = 0;
+  for (unsigned frag_ind = 0; frag_ind < n_fragments; frag_ind++) {
+    n_bytes += (*daq_handle)[frag_ind].dataSizeBytes();
+    n_digits += _fragment_products[frag_ind].digits.size();
+    n_summaries += _fragment_products[frag_ind].summaries.size();
+  }
+  product_collection->reserve(n_digits);
+  summary_collection->reserve(n_summaries);
+  for (auto &products: _fragment_products) {
+    std::move(products.digits.begin(), products.digits.end(), std::back_inserter(*product_collection));
+    std::move(products.summaries.begin(), products.summaries.end(), std::back_inserter(*summary_collection));
+    products.digits.clear();
+    products.summaries.clear();
+    if (products.has_header) {
+      if (_config.produce_header || _config.produce_metadata) {
+        // Construct HeaderData from the Nevis Header and throw it in the collection
+        header_collection->push_back(products.header);
+      }
+      // validation keeps state, so it's done here in order
+      if (_config.validate_header) {
+        validate_header(products.header);
+      }
+    }
+  }
+  if (_config.timing) {
+    auto now = std::chrono::high_resolution_clock::now();
+    float time_ms = std::chrono::duration<float, std::milli>(now - start).count();
+    std::cout << "DECODER     : " << daq_handle->size() << " fragments " << (n_bytes / 1.e6) << " MB in "
+              << time_ms << " ms (" << (n_bytes / 1.e3 / time_ms) << " MB/s)" << std::endl;
   }
 
   event.put(std::move(product_collection));
 
+  if (_config.produce_summary) {
+    event.put(std::move(summary_collection));
+  }
+
   if (_config.produce_metadata) {
     // put metadata in event
     std::unique_ptr<std::vector<daqAnalysis::NevisTPCMetaData>> metadata_collection(new std::vector<daqAnalysis::NevisTPCMetaData>);
@@ -182,71 +244,123 @@ void daq::DaqDecoder::produce(art::Event & event)
 
 bool daq::DaqDecoder::is_mapped_channel(const sbnddaq::NevisTPCHeader *header, uint16_t nevis_channel_id) {
   // rely on ChannelMap for implementation
+  int wire = _channel_lookup->NevisChannel2Wire(nevis_channel_id, header->getSlot(), header->getFEMID());
+  if (wire != daqAnalysis::ChannelLookup::kNotInTable) return wire != daqAnalysis::ChannelLookup::kNotMapped;
   return _channel_map->IsMappedChannel(nevis_channel_id, header->getSlot(), header->getFEMID());
 }
 
 raw::ChannelID_t daq::DaqDecoder::get_wire_id(const sbnddaq::NevisTPCHeader *header, uint16_t nevis_channel_id) {
   // rely on ChannelMap for implementation
+  int wire = _channel_lookup->NevisChannel2Wire(nevis_channel_id, header->getSlot(), header->getFEMID());
+  if (wire >= 0) return wire;
   return _channel_map->Channel2Wire(nevis_channel_id, header->getSlot(), header->getFEMID());
 }
 
 void daq::DaqDecoder::process_fragment(art::Event &event, const artdaq::Fragment &frag, 
-  std::unique_ptr<std::vector<raw::RawDigit>> &product_collection,
-  std::unique_ptr<std::vector<daqAnalysis::HeaderData>> &header_collection) {
+  FragmentProducts &products, daq::NevisDecoder &decoder) {
 
   // convert fragment to Nevis fragment
   sbnddaq::NevisTPCFragment fragment(frag);
 
-  std::unordered_map<uint16_t,sbnddaq::NevisTPC_Data_t> waveform_map;
-  size_t n_waveforms = fragment.decode_data(waveform_map);
-  (void)n_waveforms;
+  products.has_header = _config.produce_header || _config.validate_header || _config.produce_metadata /*make header info to convert into metdata later*/;
+  if (products.has_header) {
+    products.header = Fragment2HeaderData(event, frag, _config.frame_to_dt, _config.timesize, _config.calc_checksum);
+  }
 
-  if (_config.produce_header || _config.validate_header || _config.produce_metadata /*make header info to convert into metdata later*/) {
-    auto header_data = Fragment2HeaderData(event, frag, _config.frame_to_dt, _config.timesize, _config.calc_checksum);
-    if (_config.produce_header || _config.produce_metadata) {
-      // Construct HeaderData from the Nevis Header and throw it in the collection
-      header_collection->push_back(header_data);
+  // decode straight into the RawDigit buffers if we can
+  if (_config.direct_decode) {
+    // RETURN VALUE OF getADCWordCount IS OFF BY 1
+    size_t n_words;
+    if (!daq::NevisDecoder::CheckWordCount(fragment.header()->getADCWordCount() + 1, payload_words(frag), n_words)) {
+      mf::LogWarning("DaqDecoder") << "Fragment header says there are " << (fragment.header()->getADCWordCount() + 1)
+        << " ADC words, but the fragment only has " << n_words << ". Decoding it with decode_data()." << std::endl;
     }
-    if (_config.validate_header) {
-      validate_header(header_data);
+    else if (decoder.Decode(fragment.data(), n_words, _config.produce_summary)) {
+      for (auto &channel: decoder.Channels()) {
+        // ignore channels that aren't mapped to a wire
+        if (!is_mapped_channel(fragment.header(), channel.channel)) continue;
+        raw::ChannelID_t wire_id = get_wire_id(fragment.header(), channel.channel);
+        add_waveform(wire_id, std::move(channel.adcs), channel.sums, products);
+      }
+      return;
     }
   }
 
+  std::unordered_map<uint16_t,sbnddaq::NevisTPC_Data_t> waveform_map;
+  size_t n_waveforms = fragment.decode_data(waveform_map);
+  (void)n_waveforms;
+
   for (auto waveform: waveform_map) {
     // ignore channels that aren't mapped to a wire
     if (!is_mapped_channel(fragment.header(), waveform.first)) continue;
 
     std::vector<int16_t> raw_digits_waveform;
     raw::ChannelID_t wire_id = get_wire_id(fragment.header(), waveform.first);
+    // statistics for the summary are taken while converting
+    daqAnalysis::WaveformSums sums;
     // TODO: is this too expensive an operation?
-    for (auto digit: waveform.second) {
-      raw_digits_waveform.push_back( (int16_t) digit);
-    }  
-    // calculate the mode and set it as the pedestal
-    if (_config.baseline_calc || _config.subtract_pedestal) {
-      int16_t mode = Mode(raw_digits_waveform, _config.n_mode_skip);
-      if (_config.subtract_pedestal) {
-        for (unsigned i = 0; i < raw_digits_waveform.size(); i++) {
-          raw_digits_waveform[i] -= mode;
-        }
+    if (_config.produce_summary) {
+      for (auto digit: waveform.second) {
+        raw_digits_waveform.push_back( (int16_t) digit);
+        sums.Add((int16_t) digit);
       }
+    }
+    else {
+      for (auto digit: waveform.second) {
+        raw_digits_waveform.push_back( (int16_t) digit);
+      }  
+    }
+    add_waveform(wire_id, std::move(raw_digits_waveform), sums, products);
+  }
+}
 
-      // construct the next RawDigit object
-      product_collection->emplace_back(wire_id, raw_digits_waveform.size(), raw_digits_waveform);
+void daq::DaqDecoder::add_waveform(raw::ChannelID_t wire_id, std::vector<int16_t> &&raw_digits_waveform,
+  const daqAnalysis::WaveformSums &sums, FragmentProducts &products) {
 
-      if (_config.baseline_calc) {
-        (*product_collection)[product_collection->size() - 1].SetPedestal( mode);
+  // calculate the mode and set it as the pedestal
+  if (_config.baseline_calc || _config.subtract_pedestal || _config.produce_summary) {
+    int16_t mode = (_config.exact_mode) ? ExactMode(raw_digits_waveform, _config.n_mode_skip) : Mode(raw_digits_waveform, _config.n_mode_skip);
+    if (_config.subtract_pedestal) {
+      for (unsigned i = 0; i < raw_digits_waveform.size(); i++) {
+        raw_digits_waveform[i] -= mode;
+      }
+    }
+
+    if (_config.produce_summary) {
+      if (_config.subtract_pedestal) {
+        // describe the ADC's as stored: shifted down by the mode
+        daqAnalysis::WaveformSums shifted;
+        shifted.n_samples = sums.n_samples;
+        shifted.min = sums.min - mode;
+        shifted.max = sums.max - mode;
+        shifted.sum = sums.sum - (int64_t)sums.n_samples * mode;
+        shifted.sum_sq = sums.SumSquares(mode);
+        products.summaries.emplace_back(wire_id, 0, shifted);
+      }
+      else {
+        products.summaries.emplace_back(wire_id, mode, sums);
       }
     }
-    // just push back
-    else {
-      product_collection->emplace_back(wire_id, raw_digits_waveform.size(), raw_digits_waveform);
 
+    // construct the next RawDigit object (taking over the buffer)
+    size_t n_samples = raw_digits_waveform.size();
+    products.digits.emplace_back(wire_id, n_samples, std::move(raw_digits_waveform));
+
+    if (_config.baseline_calc) {
+      products.digits.back().SetPedestal( mode);
     }
   }
+  // just push back
+  else {
+    size_t n_samples = raw_digits_waveform.size();
+    products.digits.emplace_back(wire_id, n_samples, std::move(raw_digits_waveform));
+  }
 }
+
 void daq::DaqDecoder::validate_header(const daqAnalysis::HeaderData &header) {
   bool printed = false;
+  // event and frame numbers only have to increase within each FEM
+  FEMHistory &history = _fem_history[std::make_pair((unsigned)header.crate, (unsigned)header.slot)];
   if (_config.v_checksum && _config.calc_checksum && header.checksum != header.computed_checksum) {
    unsigned checksum = header.checksum;
    unsigned computed_checksum = header.computed_checksum;
@@ -278,38 +392,47 @@ void daq::DaqDecoder::validate_header(const daqAnalysis::HeaderData &header) {
       slot << ", fem ID " << fem_ind << "is 0" ;
     printed = true;
   }
-  if (_config.v_inc_event_no && header.event_number < _last_event_number) {
+  if (_config.v_inc_event_no && header.event_number < history.last_event_number) {
     unsigned event_number = header.event_number;
     mf::LogError("Bad Header") << "Non incrementing event numbers. Last event number: " << 
-      _last_event_number << ". This event number: " << event_number ;
+      history.last_event_number << ". This event number: " << event_number ;
     printed = true;
   }
-  if (_config.v_inc_trig_frame_no && header.trig_frame_number < _last_trig_frame_number) {
+  if (_config.v_inc_trig_frame_no && header.trig_frame_number < history.last_trig_frame_number) {
     unsigned trig_frame_number = header.trig_frame_number;
     mf::LogError("Bad Header") << "Non incrementing trig frame numbers. Last trig frame: " << 
-      _last_trig_frame_number << " This trig frame: " << trig_frame_number ;
+      history.last_trig_frame_number << " This trig frame: " << trig_frame_number ;
     printed = true;
   }
   if (printed) {
      mf::LogInfo("Bad Header") << "Header Info:\n" <<  header.Print() ;
   }
   // store numbers for next time
-  _last_event_number = header.event_number;
-  _last_trig_frame_number = header.trig_frame_number;
+  history.last_event_number = header.event_number;
+  history.last_trig_frame_number = header.trig_frame_number;
   return; 
 }
 
+size_t daq::DaqDecoder::payload_words(const artdaq::Fragment &frag) {
+  size_t n_bytes = frag.dataSizeBytes();
+  if (n_bytes < sizeof(sbnddaq::NevisTPCHeader)) return 0;
+  return (n_bytes - sizeof(sbnddaq::NevisTPCHeader)) / sizeof(sbnddaq::NevisTPC_ADC_t);
+}
+
 // Computes the checksum, given a nevis tpc header
 // Ideally this would be in sbnddaq-datatypes, but it's not and I can't
 // make changes to it, so put it here for now
 //
 // Also note that this only works for uncompressed data
-uint32_t daq::DaqDecoder::compute_checksum(sbnddaq::NevisTPCFragment &fragment) {
+uint32_t daq::DaqDecoder::compute_checksum(sbnddaq::NevisTPCFragment &fragment, size_t payload_words) {
   uint32_t checksum = 0;
 
   const sbnddaq::NevisTPC_ADC_t* data_ptr = fragment.data();
   // RETURN VALUE OF getADCWordCount IS OFF BY 1
-  size_t n_words = fragment.header()->getADCWordCount() + 1;
+  // (a corrupt header won't make this read past the end of the fragment, the
+  // checksum just won't match)
+  size_t n_words;
+  daq::NevisDecoder::CheckWordCount(fragment.header()->getADCWordCount() + 1, payload_words, n_words);
 
   for (size_t word_ind = 0; word_ind < n_words; word_ind++) {
     const sbnddaq::NevisTPC_ADC_t* word_ptr = data_ptr + word_ind;
@@ -0,0 +1,77 @@
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include "../WaveformSums.hh"
+
+#include "NevisDecoder.hh"
+
+daq::NevisDecoder::NevisDecoder() {
+  _channel_ind.fill(-1);
+}
+
+bool daq::NevisDecoder::Decode(const uint16_t *words, size_t n_words, bool fill_sums) {
+  _channels.clear();
+  _runs.clear();
+  _n_adcs.clear();
+  _channel_ind.fill(-1);
+
+  // first pass: find the runs of ADC words of each channel
+  int current = -1;
+  size_t i = 0;
+  while (i < n_words) {
+    uint16_t word = words[i];
+    uint16_t type = word & kWordTypeMask;
+    if (type == kChannelHeader) {
+      unsigned channel = word & kChannelMask;
+      if (channel >= kMaxChannels) return false;
+      if (_channel_ind[channel] < 0) {
+        _channel_ind[channel] = _channels.size();
+        _channels.emplace_back();
+        _channels.back().channel = channel;
+        _n_adcs.push_back(0);
+      }
+      current = _channel_ind[channel];
+      i++;
+    }
+    else if (type == kChannelEnd) {
+      current = -1;
+      i++;
+    }
+    else if (type == kADCWord) {
+      // ADC's outside of a channel
+      if (current < 0) return false;
+      size_t begin = i;
+      while (i < n_words && (words[i] & kWordTypeMask) == kADCWord) i++;
+      _runs.push_back({(unsigned)current, begin, i - begin});
+      _n_adcs[current] += i - begin;
+    }
+    // compressed or unknown words
+    else return false;
+  }
+
+  // second pass: convert straight into buffers of the final size
+  std::vector<size_t> filled(_channels.size(), 0);
+  for (unsigned channel_ind = 0; channel_ind < _channels.size(); channel_ind++) {
+    _channels[channel_ind].adcs.resize(_n_adcs[channel_ind]);
+  }
+  for (auto const &run: _runs) {
+    Channel &channel = _channels[run.channel_ind];
+    const uint16_t *src = words + run.word_begin;
+    int16_t *dst = channel.adcs.data() + filled[run.channel_ind];
+    if (fill_sums) {
+      for (size_t j = 0; j < run.n_words; j++) {
+        int16_t adc = src[j] & kADCMask;
+        dst[j] = adc;
+        channel.sums.Add(adc);
+      }
+    }
+    else {
+      for (size_t j = 0; j < run.n_words; j++) {
+        dst[j] = src[j] & kADCMask;
+      }
+    }
+    filled[run.channel_ind] += run.n_words;
+  }
+  return true;
+}
@@ -0,0 +1,87 @@
+#ifndef NevisDecoder_h
+#define NevisDecoder_h
+
+#include <vector>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+
+#include "../WaveformSums.hh"
+
+/*
+  * Decodes the data words of a NevisTPCFragment straight into one
+  * std::vector<int16_t> per channel, meant to be moved into a RawDigit.
+  *
+  * Compared to NevisTPCFragment::decode_data() this avoids the hash map
+  * and the extra copy: a first pass over the words finds where each
+  * channel's ADC words are and how many there are, so each buffer is
+  * allocated once at its final size, and a second pass converts the ADC
+  * words of each run in a tight loop.
+  *
+  * Only uncompressed data is understood. Decode() returns false on
+  * anything else (e.g. Huffman compressed words), and the caller should
+  * go back to decode_data().
+*/
+
+namespace daq {
+  class NevisDecoder;
+}
+
+class daq::NevisDecoder {
+public:
+  // Nevis data words
+  static const uint16_t kWordTypeMask = 0xF000;
+  static const uint16_t kADCWord = 0x0000;
+  static const uint16_t kChannelHeader = 0x4000;
+  static const uint16_t kChannelEnd = 0x5000;
+  static const uint16_t kADCMask = 0x0FFF;
+  static const uint16_t kChannelMask = 0x0FFF;
+  // most channels on a FEM
+  static const unsigned kMaxChannels = 64;
+
+  // a decoded channel
+  class Channel {
+  public:
+    uint16_t channel;
+    std::vector<int16_t> adcs;
+    // only filled if asked for in Decode()
+    daqAnalysis::WaveformSums sums;
+  };
+
+  NevisDecoder();
+
+  // decode n_words data words. Also fills the sums of each channel if
+  // fill_sums is set. Returns false if the data can't be decoded here.
+  bool Decode(const uint16_t *words, size_t n_words, bool fill_sums=false);
+
+  // number of data words to decode, from the count in the fragment header
+  // (getADCWordCount() + 1) and the number of words actually in the fragment
+  // after the header. Returns false if the header claims more words than
+  // there are (a corrupt header or a truncated fragment). n_words is never
+  // more than payload_words
+  static bool CheckWordCount(size_t header_n_words, size_t payload_words, size_t &n_words) {
+    n_words = (header_n_words <= payload_words) ? header_n_words : payload_words;
+    return header_n_words <= payload_words;
+  }
+
+  // channels in the order they appear in the data. Their ADC vectors can be
+  // moved out -- they are reallocated by the next Decode()
+  std::vector<Channel> &Channels() { return _channels; }
+
+private:
+  // a contiguous run of ADC words belonging to one channel
+  class Run {
+  public:
+    unsigned channel_ind;
+    size_t word_begin;
+    size_t n_words;
+  };
+
+  std::vector<Channel> _channels;
+  std::vector<Run> _runs;
+  std::vector<size_t> _n_adcs;
+  // nevis channel number to index in _channels (or -1)
+  std::array<int, kMaxChannels> _channel_ind;
+};
+
+#endif /* NevisDecoder_h */
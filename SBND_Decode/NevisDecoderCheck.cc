@@ -0,0 +1,92 @@
+#include <vector>
+#include <map>
+#include <random>
+#include <iostream>
+#include <string>
+#include <cstdlib>
+
+#include "NevisDecoder.hh"
+
+/*
+ * Checks NevisDecoder against decoding the same words one at a time into
+ * a map, like NevisTPCFragment::decode_data(), on synthetic fragments.
+ *
+ * Usage: NevisDecoderCheck [n_channels] [n_ticks]
+ *
+ * Also checks a fragment that is cut short of the word count in its
+ * header: the count has to be caught by CheckWordCount() and clamped, so
+ * that nothing past the end of the fragment is read (each fragment is
+ * held in a buffer of exactly its size, to be run under a memory checker).
+ * Returns 1 if any check fails.
+*/
+
+using namespace daq;
+
+// nevis channel number to its ADC's
+typedef std::map<uint16_t, std::vector<int16_t>> Waveforms;
+
+static Waveforms referenceDecode(const std::vector<uint16_t> &words) {
+  Waveforms ret;
+  int channel = -1;
+  for (uint16_t word: words) {
+    uint16_t type = word & NevisDecoder::kWordTypeMask;
+    if (type == NevisDecoder::kChannelHeader) {
+      channel = word & NevisDecoder::kChannelMask;
+      ret[channel];
+    }
+    else if (type == NevisDecoder::kChannelEnd) channel = -1;
+    else ret[channel].push_back(word & NevisDecoder::kADCMask);
+  }
+  return ret;
+}
+
+// decode the first header_n_words words (as if the fragment header said so)
+// of a fragment holding only payload_words words
+static bool check(const std::string &name, const std::vector<uint16_t> &words, size_t payload_words,
+    size_t header_n_words, bool expect_fits) {
+  std::vector<uint16_t> fragment(words.begin(), words.begin() + payload_words);
+  size_t n_words;
+  bool fits = NevisDecoder::CheckWordCount(header_n_words, fragment.size(), n_words);
+
+  NevisDecoder decoder;
+  bool decoded = decoder.Decode(fragment.data(), n_words, true);
+  Waveforms expected = referenceDecode(std::vector<uint16_t>(fragment.begin(), fragment.begin() + n_words));
+  Waveforms result;
+  for (auto &channel: decoder.Channels()) {
+    result[channel.channel] = channel.adcs;
+  }
+
+  bool pass = fits == expect_fits && n_words <= fragment.size() && decoded && result == expected;
+  std::cout << name << " : " << n_words << " of " << header_n_words << " words decoded, "
+            << result.size() << " channels" << (fits ? "" : " (header count clamped)")
+            << (pass ? "" : " FAIL") << std::endl;
+  return pass;
+}
+
+int main(int argc, char **argv) {
+  unsigned n_channels = argc > 1 ? atoi(argv[1]) : 64;
+  unsigned n_ticks = argc > 2 ? atoi(argv[2]) : 3200;
+  if (n_channels > NevisDecoder::kMaxChannels) n_channels = NevisDecoder::kMaxChannels;
+
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<uint16_t> adc(0, NevisDecoder::kADCMask);
+  std::vector<uint16_t> words;
+  for (unsigned channel = 0; channel < n_channels; channel++) {
+    words.push_back(NevisDecoder::kChannelHeader | channel);
+    for (unsigned tick = 0; tick < n_ticks; tick++) {
+      words.push_back(adc(rng));
+    }
+    words.push_back(NevisDecoder::kChannelEnd | channel);
+  }
+
+  bool pass = true;
+  pass = check("WHOLE        ", words, words.size(), words.size(), true) && pass;
+  // the header can count fewer words than there are room for
+  pass = check("SHORT COUNT  ", words, words.size(), words.size() / 2, true) && pass;
+  // cut off in the middle of a channel
+  pass = check("TRUNCATED    ", words, words.size() / 2 + 7, words.size(), false) && pass;
+  pass = check("EMPTY        ", words, 0, words.size(), false) && pass;
+
+  std::cout << (pass ? "PASS" : "FAIL") << std::endl;
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+
+#include "ThreadPool.hh"
+
+daqAnalysis::ThreadPool::ThreadPool(unsigned n_threads):
+  _func(nullptr),
+  _n_tasks(0),
+  _next_task(0),
+  _n_running(0),
+  _generation(0),
+  _stop(false)
+{
+  // the calling thread is always thread 0
+  for (unsigned i = 1; i < n_threads; i++) {
+    _threads.emplace_back(&daqAnalysis::ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+daqAnalysis::ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _start_cv.notify_all();
+  for (auto &thread: _threads) {
+    thread.join();
+  }
+}
+
+void daqAnalysis::ThreadPool::Run(unsigned n_tasks, const Task &func) {
+  // nothing to split up -- just run everything here
+  if (_threads.size() == 0 || n_tasks <= 1) {
+    for (unsigned i = 0; i < n_tasks; i++) {
+      func(i, 0);
+    }
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _func = &func;
+    _n_tasks = n_tasks;
+    _next_task = 0;
+    _n_running = _threads.size();
+    _exception = nullptr;
+    _generation ++;
+  }
+  _start_cv.notify_all();
+
+  // do work on this thread too
+  DoTasks(0);
+
+  std::exception_ptr exception;
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cv.wait(lock, [this] { return _n_running == 0; });
+    _func = nullptr;
+    exception = _exception;
+  }
+  if (exception) std::rethrow_exception(exception);
+}
+
+void daqAnalysis::ThreadPool::DoTasks(unsigned thread_index) {
+  unsigned task;
+  while ((task = _next_task.fetch_add(1)) < _n_tasks) {
+    try {
+      (*_func)(task, thread_index);
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      if (!_exception) _exception = std::current_exception();
+    }
+  }
+}
+
+void daqAnalysis::ThreadPool::WorkerLoop(unsigned thread_index) {
+  unsigned long last_generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _start_cv.wait(lock, [&] { return _stop || _generation != last_generation; });
+      if (_stop) return;
+      last_generation = _generation;
+    }
+
+    DoTasks(thread_index);
+
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _n_running --;
+      if (_n_running == 0) _done_cv.notify_one();
+    }
+  }
+}
@@ -0,0 +1,58 @@
+#ifndef _sbnddaq_analysis_ThreadPool
+#define _sbnddaq_analysis_ThreadPool
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <exception>
+
+// Small persistent pool of worker threads for splitting up per-channel
+// (or per-fragment) work inside of a single art event.
+//
+// Run() hands out task indices [0, n_tasks) to the workers and blocks
+// until all of them are done. The calling thread takes part in the work
+// as thread index 0, so a pool of n threads only spawns n-1 of them.
+// Run() must not be called from more than one thread at a time.
+namespace daqAnalysis {
+class ThreadPool {
+public:
+  // func(task_index, thread_index)
+  typedef std::function<void(unsigned, unsigned)> Task;
+
+  explicit ThreadPool(unsigned n_threads=1);
+  ~ThreadPool();
+
+  // Pools own threads and should not be copied or moved
+  ThreadPool(ThreadPool const &) = delete;
+  ThreadPool & operator = (ThreadPool const &) = delete;
+
+  // run func on each task index and wait for all of them to finish
+  // rethrows the first exception thrown by any task
+  void Run(unsigned n_tasks, const Task &func);
+
+  // total number of threads doing work (including the calling thread)
+  unsigned NThreads() const { return _threads.size() + 1; }
+
+private:
+  void WorkerLoop(unsigned thread_index);
+  void DoTasks(unsigned thread_index);
+
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _start_cv;
+  std::condition_variable _done_cv;
+
+  // state of the current call to Run()
+  const Task *_func;
+  unsigned _n_tasks;
+  std::atomic<unsigned> _next_task;
+  unsigned _n_running;
+  unsigned long _generation;
+  std::exception_ptr _exception;
+  bool _stop;
+};
+
+} // namespace daqAnalysis
+#endif
@@ -68,6 +68,9 @@ void daqAnalysis::VSTAnalysis::analyze(art::Event const & e) {
     // call sum waveforms explicitly
   _analysis.SumWaveforms(e);
   if (_analysis.ReadyToProcess()) {
+    if (!_analysis._config.reduce_data) {
+      _analysis.FillChannelData();
+    }
      _output->Fill();
   }
 }
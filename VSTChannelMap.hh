@@ -3,6 +3,7 @@
 
 #include <map>
 #include <vector>
+#include <mutex>
 
 #include "art/Framework/Services/Registry/ActivityRegistry.h"
 #include "art/Framework/Services/Registry/ServiceMacros.h"
@@ -10,6 +11,7 @@
 
 #include "HeaderData.hh"
 #include "NevisTPCMetaData.hh"
+#include "ChannelLookup.hh"
 
 namespace daqAnalysis {
 
@@ -27,6 +29,8 @@ public:
 
   unsigned NFEM() const;
   unsigned NChannels() const;
+  // The VST map only knows about one crate (crate_id). The Redis metrics
+  // handle more (see ChannelLookup.hh), but only once the map reports them
   unsigned NCrates() const { return 1; /* 1 for VST */ }
   unsigned Channel2Wire(unsigned channel_no) const;
   unsigned Channel2Wire(unsigned channel_ind, unsigned slot_ind, unsigned crate_ind, bool add_offset=false) const;
@@ -53,6 +57,17 @@ public:
   unsigned NSlotWire(unsigned slot) const;
   unsigned NSlotChannel() const;
 
+  // raw crate number in the Nevis headers
+  unsigned CrateID() const { return _crate_id; }
+
+  // Flat tables for the lookups done per waveform or wire. Built from the
+  // maps the first time they are asked for -- callers should keep the
+  // reference rather than ask again for each lookup.
+  const daqAnalysis::ChannelLookup &Lookup() const {
+    std::call_once(_lookup_once, [this] { _lookup.Build(*this, {_crate_id}); });
+    return _lookup;
+  }
+
   // Hard code this for online monitoring
   // 1 == induction plane
   // 2 == collection plane
@@ -77,6 +92,8 @@ private:
   std::map<unsigned, unsigned> _wire_to_channel;
   std::vector<unsigned> _wire_per_fem;
   std::vector<std::vector<unsigned>> _fem_active_channels;
+  mutable std::once_flag _lookup_once;
+  mutable daqAnalysis::ChannelLookup _lookup;
 };
 
 }// end namespace
@@ -0,0 +1,164 @@
+#include <vector>
+#include <chrono>
+#include <random>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+#include "WaveformView.hh"
+#include "Mode.hh"
+#include "PeakFinder.hh"
+#include "Noise.hh"
+#include "Arena.hh"
+
+/*
+ * Compares reading the ADC's of each channel through a WaveformView (as
+ * ProcessChannel() and the Redis snapshot do) with copying them into a
+ * std::vector<int16_t> first (as they did before).
+ *
+ * Usage: WaveformBenchmark [n_channels] [n_ticks] [n_events] [n_correlated]
+ *
+ * Times the per-channel kernels (mode, running threshold, peak finding,
+ * noise ranges and RMS) with one copy per channel, and the noise
+ * correlation between every pair of the first n_correlated channels
+ * with two copies per pair. The results of the two are checked to agree.
+ *
+ * Also times the refined baseline and noise RMS of each channel read
+ * straight from its noise ranges against filling a WaveformPrefixSums and
+ * reading them from that, which sets when Analysis uses prefix_sums.
+*/
+
+using namespace daqAnalysis;
+
+static const unsigned n_pulses = 3;
+
+// the per-channel kernels on one waveform. Returns the noise RMS
+static float processChannel(WaveformView adcs, RunningThreshold &running_threshold, NoiseSample &noise, Arena &arena) {
+  int16_t baseline = Mode(adcs);
+  float threshold = running_threshold.Threshold(adcs, baseline);
+  std::vector<PeakFinder::Peak> peaks;
+  {
+    Arena::Marker mark = arena.Mark();
+    PeakFinder peak_finder(adcs, baseline, threshold, 1, 0, 0, &arena);
+    peaks.assign(peak_finder.Peaks()->begin(), peak_finder.Peaks()->end());
+    arena.Rewind(mark);
+  }
+  noise = NoiseSample(peaks, baseline, adcs.size());
+  return noise.RMS(adcs);
+}
+
+static float toMs(std::chrono::high_resolution_clock::duration time) {
+  return std::chrono::duration<float, std::milli>(time).count();
+}
+
+int main(int argc, char **argv) {
+  unsigned n_channels = argc > 1 ? atoi(argv[1]) : 1024;
+  unsigned n_ticks = argc > 2 ? atoi(argv[2]) : 3200;
+  unsigned n_events = argc > 3 ? atoi(argv[3]) : 10;
+  unsigned n_correlated = std::min(n_channels, argc > 4 ? (unsigned)atoi(argv[4]) : 128u);
+
+  // baseline, noise and a few pulses on each channel
+  std::mt19937 rng(1);
+  std::normal_distribution<float> noise(0., 3.);
+  std::uniform_int_distribution<unsigned> tick(0, n_ticks - 1);
+  std::vector<std::vector<int16_t>> digits(n_channels, std::vector<int16_t>(n_ticks));
+  for (auto &adcs: digits) {
+    for (unsigned j = 0; j < n_ticks; j++) {
+      adcs[j] = 2000 + (int16_t)std::round(noise(rng));
+    }
+    for (unsigned pulse = 0; pulse < n_pulses; pulse++) {
+      unsigned start = tick(rng);
+      for (unsigned j = start; j < std::min(n_ticks, start + 20); j++) {
+        adcs[j] += 200;
+      }
+    }
+  }
+
+  std::vector<RunningThreshold> thresholds(n_channels);
+  std::vector<NoiseSample> samples(n_channels);
+  Arena arena;
+  std::vector<float> view_rms(n_channels), copy_rms(n_channels);
+  std::vector<float> range_rms(n_channels), prefix_rms(n_channels);
+  WaveformPrefixSums prefix_sums;
+  unsigned n_noise_samples = 0;
+  float view_correlation = 0., copy_correlation = 0.;
+  std::chrono::high_resolution_clock::duration view_channel(0), copy_channel(0), view_pair(0), copy_pair(0);
+  std::chrono::high_resolution_clock::duration range_noise(0), prefix_noise(0);
+
+  for (unsigned event = 0; event < n_events; event++) {
+    // per-channel kernels
+    auto start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < n_channels; i++) {
+      view_rms[i] = processChannel(WaveformView(digits[i]), thresholds[i], samples[i], arena);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    view_channel += end - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < n_channels; i++) {
+      std::vector<int16_t> adcs = digits[i];
+      copy_rms[i] = processChannel(adcs, thresholds[i], samples[i], arena);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    copy_channel += end - start;
+
+    // noise from the ranges found above
+    n_noise_samples = 0;
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < n_channels; i++) {
+      NoiseSample noise = samples[i];
+      noise.ResetBaseline(digits[i]);
+      range_rms[i] = noise.RMS(digits[i]);
+      n_noise_samples += noise.NSamples();
+    }
+    end = std::chrono::high_resolution_clock::now();
+    range_noise += end - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    for (unsigned i = 0; i < n_channels; i++) {
+      NoiseSample noise = samples[i];
+      prefix_sums.Fill(digits[i]);
+      noise.ResetBaseline(prefix_sums);
+      prefix_rms[i] = noise.RMS(prefix_sums);
+    }
+    end = std::chrono::high_resolution_clock::now();
+    prefix_noise += end - start;
+
+    // correlation between pairs
+    start = std::chrono::high_resolution_clock::now();
+    view_correlation = 0.;
+    for (unsigned i = 0; i < n_correlated; i++) {
+      for (unsigned j = i + 1; j < n_correlated; j++) {
+        view_correlation += samples[i].Correlation(digits[i], samples[j], digits[j]);
+      }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    view_pair += end - start;
+
+    start = std::chrono::high_resolution_clock::now();
+    copy_correlation = 0.;
+    for (unsigned i = 0; i < n_correlated; i++) {
+      for (unsigned j = i + 1; j < n_correlated; j++) {
+        std::vector<int16_t> waveform_i = digits[i];
+        std::vector<int16_t> waveform_j = digits[j];
+        copy_correlation += samples[i].Correlation(waveform_i, samples[j], waveform_j);
+      }
+    }
+    end = std::chrono::high_resolution_clock::now();
+    copy_pair += end - start;
+  }
+
+  bool agree = view_rms == copy_rms && view_correlation == copy_correlation && range_rms == prefix_rms;
+  unsigned n_pairs = n_correlated * (n_correlated - 1) / 2;
+  std::cout << "INPUT        : " << n_channels << " channels of " << n_ticks << " ticks, " << n_pairs << " pairs" << std::endl;
+  std::cout << "CHANNEL VIEW : " << toMs(view_channel) / n_events << " ms/event" << std::endl;
+  std::cout << "CHANNEL COPY : " << toMs(copy_channel) / n_events << " ms/event" << std::endl;
+  std::cout << "PAIR VIEW    : " << toMs(view_pair) / n_events << " ms/event" << std::endl;
+  std::cout << "PAIR COPY    : " << toMs(copy_pair) / n_events << " ms/event" << std::endl;
+  std::cout << "NOISE SAMPLES: " << (100. * n_noise_samples) / (n_channels * n_ticks) << "% of ticks" << std::endl;
+  std::cout << "NOISE RANGES : " << toMs(range_noise) / n_events << " ms/event" << std::endl;
+  std::cout << "NOISE PREFIX : " << toMs(prefix_noise) / n_events << " ms/event" << std::endl;
+  std::cout << "RESULTS      : " << (agree ? "agree" : "DIFFER") << std::endl;
+  return agree ? 0 : 1;
+}
@@ -0,0 +1,55 @@
+#ifndef _sbnddaq_analysis_WaveformPrefixSums
+#define _sbnddaq_analysis_WaveformPrefixSums
+#include <vector>
+#include <cstdint>
+
+#include "WaveformView.hh"
+
+// Running totals of the ADC values (and their squares) of a waveform up to
+// each tick, filled in a single pass.
+//
+// The sum of x or x^2 over any range of ticks is then the difference of two
+// entries, so statistics over a list of ranges (e.g. the noise ranges of a
+// NoiseSample) cost O(#ranges) instead of O(#samples). Sums of squares are
+// kept in 64 bit integers and are exact. Takes 12 bytes per tick.
+namespace daqAnalysis {
+class WaveformPrefixSums {
+public:
+  WaveformPrefixSums() {}
+
+  // memory is kept between calls
+  void Fill(WaveformView wvfm) {
+    _sum.resize(wvfm.size() + 1);
+    _sum_sq.resize(wvfm.size() + 1);
+    // keep the running totals in locals: read back out of the vectors, each
+    // tick would wait on the store of the last one
+    int32_t sum = 0;
+    int64_t sum_sq = 0;
+    _sum[0] = 0;
+    _sum_sq[0] = 0;
+    for (size_t i = 0; i < wvfm.size(); i++) {
+      sum += wvfm[i];
+      sum_sq += (int64_t)wvfm[i] * wvfm[i];
+      _sum[i+1] = sum;
+      _sum_sq[i+1] = sum_sq;
+    }
+  }
+
+  unsigned NSamples() const { return _sum.empty() ? 0 : _sum.size() - 1; }
+
+  // sums over the ticks in [begin, end] (inclusive, same as NoiseSample ranges)
+  inline int64_t Sum(unsigned begin, unsigned end) const { return _sum[end+1] - _sum[begin]; }
+  inline int64_t SumSq(unsigned begin, unsigned end) const { return _sum_sq[end+1] - _sum_sq[begin]; }
+  // sum of (x - baseline)^2 over the ticks in [begin, end]
+  inline int64_t SumSquares(unsigned begin, unsigned end, int16_t baseline) const {
+    return SumSq(begin, end) - 2 * (int64_t)baseline * Sum(begin, end) + (int64_t)(end - begin + 1) * baseline * baseline;
+  }
+
+private:
+  // 32 bits is plenty for the sum of 12 bit ADC's
+  std::vector<int32_t> _sum;
+  std::vector<int64_t> _sum_sq;
+};
+
+} // namespace daqAnalysis
+#endif
@@ -0,0 +1,42 @@
+#ifndef _sbnddaq_analysis_WaveformSums
+#define _sbnddaq_analysis_WaveformSums
+#include <cstdint>
+#include <math.h>
+
+// Running sums over the ADC values of a waveform, filled in a single pass.
+//
+// Sums are kept in 64 bit integers, so statistics around any baseline can
+// be calculated exactly after the fact without revisiting the waveform.
+namespace daqAnalysis {
+class WaveformSums {
+public:
+  unsigned n_samples;
+  int16_t min;
+  int16_t max;
+  int64_t sum;
+  int64_t sum_sq;
+
+  // same initial min/max values as Analysis::ProcessChannel
+  WaveformSums(): n_samples(0), min(INT16_MAX), max(-INT16_MAX), sum(0), sum_sq(0) {}
+
+  inline void Add(int16_t val) {
+    if (val > max) max = val;
+    if (val < min) min = val;
+    sum += val;
+    sum_sq += (int64_t)val * val;
+    n_samples ++;
+  }
+
+  // sum of (x - baseline)^2 over all samples
+  inline int64_t SumSquares(int16_t baseline) const {
+    return sum_sq - 2 * (int64_t)baseline * sum + (int64_t)n_samples * baseline * baseline;
+  }
+
+  // RMS around the baseline over all samples (i.e. the "raw" RMS)
+  inline float RMS(int16_t baseline) const {
+    return sqrt((float)SumSquares(baseline) / n_samples);
+  }
+};
+
+} // namespace daqAnalysis
+#endif
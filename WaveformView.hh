@@ -0,0 +1,42 @@
+#ifndef _sbnddaq_analysis_WaveformView
+#define _sbnddaq_analysis_WaveformView
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Non-owning, read-only view of a contiguous array of samples.
+//
+// Lets the analysis classes read e.g. the ADC buffer of a raw::RawDigit
+// in place instead of copying it. A view is only valid as long as the
+// memory it points to is. Implicitly constructable from a std::vector so
+// that code passing vectors around doesn't need to change.
+namespace daqAnalysis {
+template<typename T>
+class ArrayView {
+public:
+  typedef T value_type;
+  typedef const T *const_iterator;
+
+  ArrayView(): _data(nullptr), _size(0) {}
+  ArrayView(const T *data, size_t size): _data(data), _size(size) {}
+  template<typename Alloc>
+  ArrayView(const std::vector<T, Alloc> &vec): _data(vec.data()), _size(vec.size()) {}
+
+  inline const T &operator[](size_t index) const { return _data[index]; }
+  inline const T *data() const { return _data; }
+  inline size_t size() const { return _size; }
+  inline bool empty() const { return _size == 0; }
+
+  inline const_iterator begin() const { return _data; }
+  inline const_iterator end() const { return _data + _size; }
+
+private:
+  const T *_data;
+  size_t _size;
+};
+
+// view of the ADC values in a waveform
+typedef ArrayView<int16_t> WaveformView;
+
+} // namespace daqAnalysis
+#endif
@@ -3,6 +3,7 @@
 #include "sbndcode/VSTAnalysis/ChannelData.hh"
 #include "sbndcode/VSTAnalysis/HeaderData.hh"
 #include "sbndcode/VSTAnalysis/NevisTPCMetaData.hh"
+#include "sbndcode/VSTAnalysis/ChannelSummary.hh"
 
 namespace {
   struct dictionary {
@@ -26,6 +27,11 @@ namespace {
     art::Wrapper<daqAnalysis::NevisTPCMetaData> m_w;
     art::Wrapper<std::vector<daqAnalysis::NevisTPCMetaData>> m_v_w;
 
+    daqAnalysis::ChannelSummary s;
+    std::vector<daqAnalysis::ChannelSummary> s_v;
+    art::Wrapper<daqAnalysis::ChannelSummary> s_w;
+    art::Wrapper<std::vector<daqAnalysis::ChannelSummary>> s_v_w;
+
     std::vector<std::vector<short>> vs_v;
     art::Wrapper<std::vector<std::vector<short>>> vs_v_w;
     
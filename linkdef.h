@@ -15,6 +15,8 @@
 #pragma link C++ class std::vector<HeaderData>+;
 #pragma link C++ class NevisTPCMetaData+;
 #pragma link C++ class std::vector<NevisTPCMetaData>+;
+#pragma link C++ class ChannelSummary+;
+#pragma link C++ class std::vector<ChannelSummary>+;
 #pragma link C++ class Noise+;
 #pragma link C++ class FFT+;
 #endif